@@ -0,0 +1,13 @@
+#!/bin/sh
+# Major collection pause times of the stop-the-world collector from 1 to N gc threads on a gc heavy script.
+# With one thread the sweep is lazy and not part of the pause, with more it is.
+# usage: bench/gc_threads.sh [max threads] [script], run from the repository root after `make`
+max=${1:-$(nproc)}
+script=${2:-bench/gc_heavy.mop}
+t=1
+while [ "$t" -le "$max" ]; do
+    ./build/a.out --gc-threads=$t --trace=gc "$script" | awk -v t=$t '
+        / major, pause / { for (i = 1; i <= NF; i++) if ($i == "pause") { p = $(i + 1); n++; sum += p; if (p > max) max = p } }
+        END { printf "%d thread%s: %d majors, max %.3f ms, mean %.3f ms\n", t, t == 1 ? "" : "s", n, max, n ? sum / n : 0 }'
+    t=$((t + 1))
+done
@@ -0,0 +1,81 @@
+// Throughput of the string hash and key equality by string length, against the byte at a time
+// FNV-1a the interpreter used before. usage: `make bench-hash && ./build/hash_bench`
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "hash.h"
+
+#define BUFFER_SIZE (64 * 1024)
+#define BYTES_PER_RUN (256u * 1024 * 1024)
+
+static uint32_t fnv1a(const char* chars, int length) {
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < length; i++) {
+        hash ^= (uint8_t)chars[i];
+        hash *= 16777619;
+    }
+    return hash;
+}
+
+static bool memcmp_equal(const char* a, const char* b, int length) {
+    return memcmp(a, b, length) == 0;
+}
+
+static uint32_t hash_kernel(const char* chars, int length) {
+    return hash_chars(chars, length);
+}
+
+static double now_s() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static volatile uint32_t sink;
+
+// @Note: the start moves through the buffer so every call sees different bytes
+static double hash_rate(uint32_t (*hash)(const char*, int), const char* buffer, int length) {
+    long calls = BYTES_PER_RUN / length;
+    uint32_t acc = 0;
+    double start = now_s();
+    for (long i = 0; i < calls; i++) {
+        acc += hash(buffer + (i * 64) % (BUFFER_SIZE - length), length);
+    }
+    double elapsed = now_s() - start;
+    sink = acc;
+    return (double)calls * length / elapsed / (1024 * 1024);
+}
+
+static double equal_rate(bool (*equal)(const char*, const char*, int), const char* a, const char* b, int length) {
+    long calls = BYTES_PER_RUN / length;
+    uint32_t acc = 0;
+    double start = now_s();
+    for (long i = 0; i < calls; i++) {
+        int offset = (i * 64) % (BUFFER_SIZE - length);
+        acc += equal(a + offset, b + offset, length);
+    }
+    double elapsed = now_s() - start;
+    sink = acc;
+    return (double)calls * length / elapsed / (1024 * 1024);
+}
+
+int main() {
+    static const int lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096};
+    char* a = malloc(BUFFER_SIZE);
+    char* b = malloc(BUFFER_SIZE);
+    if (a == NULL || b == NULL) return 1;
+    srand(1);
+    for (int i = 0; i < BUFFER_SIZE; i++) a[i] = b[i] = (char)('a' + rand() % 26);
+
+    printf("%8s %12s %12s %12s %12s   (MB/s)\n", "length", "fnv1a", "hash_chars", "memcmp", "chars_equal");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        int length = lengths[i];
+        printf("%8d %12.0f %12.0f %12.0f %12.0f\n", length,
+            hash_rate(fnv1a, a, length), hash_rate(hash_kernel, a, length),
+            equal_rate(memcmp_equal, a, b, length), equal_rate(chars_equal, a, b, length));
+    }
+    free(a);
+    free(b);
+    return 0;
+}
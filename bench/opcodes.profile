@@ -0,0 +1,62 @@
+# straight-line opcode sequences and how often each ran, written by --profile-ops
+32193038 OP_GET_GLOBAL OP_GET_LOCAL OP_CONSTANT OP_SUBSTRACT OP_CALL
+14930352 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_LOCAL OP_RETURN
+14930351 OP_ADD OP_RETURN
+14930351 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_LESS
+1284673 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ
+1155073 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_NIL OP_RETURN
+1154668 OP_CLOSURE OP_GET_LOCAL OP_RETURN
+100000 OP_GET_GLOBAL OP_GET_LOCAL OP_CONSTANT OP_SUBSTRACT OP_GET_LOCAL OP_GET_LOCAL OP_ADD OP_TAIL_CALL
+20000 OP_GET_LOCAL OP_CONSTANT OP_ADD OP_RETURN
+19999 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_POP OP_LOOP
+10001 OP_GET_GLOBAL OP_GET_LOCAL OP_CONSTANT OP_SUBSTRACT OP_TAIL_CALL
+3000 OP_GET_LOCAL OP_RETURN
+3000 OP_GET_LOCAL OP_CLOSURE OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ
+500 OP_GET_UPVALUE OP_GET_LOCAL OP_CONSTANT OP_SUBSTRACT OP_TAIL_CALL
+500 OP_GET_UPVALUE OP_CONSTANT OP_ADD OP_SET_UPVALUE OP_POP OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ
+242 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+200 OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+200 OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_CALL
+199 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_CALL
+23 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_GET_GLOBAL OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+6 OP_POP OP_NIL OP_RETURN
+5 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS
+4 OP_GET_LOCAL OP_PRINT OP_GET_GLOBAL OP_GET_LOCAL OP_CONSTANT OP_SUBSTRACT OP_CALL
+3 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL
+3 OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL
+2 OP_PRINT OP_NIL OP_RETURN
+2 OP_CONSTANT OP_CLOSURE OP_GET_LOCAL OP_RETURN
+2 OP_GET_GLOBAL OP_PRINT OP_NIL OP_RETURN
+1 OP_CONSTANT OP_CALL
+1 OP_GET_UPVALUE OP_RETURN
+1 OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL
+1 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_GREATER
+1 OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL
+1 OP_GET_UPVALUE OP_PRINT OP_NIL OP_RETURN
+1 OP_PRINT OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL
+1 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_CONSTANT OP_RETURN
+1 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_FALSE OP_RETURN
+1 OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_GET_LOCAL OP_RETURN
+1 OP_PRINT OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL
+1 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_GET_GLOBAL OP_ADD
+1 OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL
+1 OP_GET_LOCAL OP_CLOSURE OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_GET_LOCAL OP_RETURN
+1 OP_PRINT OP_GET_GLOBAL OP_CALL OP_GET_GLOBAL OP_SUBSTRACT OP_PRINT OP_NIL OP_RETURN
+1 OP_PRINT OP_CLOSURE OP_DEFINE_GLOBAL OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL
+1 OP_CLOSURE OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CALL OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL
+1 OP_GET_UPVALUE OP_CONSTANT OP_ADD OP_SET_UPVALUE OP_POP OP_GET_LOCAL OP_CONSTANT OP_JUMP_IF_NOT_EQ OP_GET_UPVALUE OP_RETURN
+1 OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_GREATER OP_GET_GLOBAL OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_SUBSTRACT OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_GREATER OP_GET_GLOBAL OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_SUBSTRACT OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_NIL OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_CALL
+1 OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_GET_GLOBAL OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_GET_GLOBAL OP_NEGATE OP_CALL OP_PRINT OP_NIL OP_RETURN
+1 OP_CONSTANT OP_ADD OP_EQ OP_PRINT OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_GET_GLOBAL OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_EQ OP_PRINT OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CONSTANT OP_CALL OP_CONSTANT OP_EQ OP_PRINT OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_LOOP
+1 OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_DEFINE_GLOBAL OP_NIL OP_SET_GLOBAL OP_POP OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_SET_GLOBAL OP_POP OP_POP OP_LOOP
+1 OP_CONSTANT OP_CONSTANT OP_CALL OP_CONSTANT OP_EQ OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_EQ OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CONSTANT OP_CALL OP_CONSTANT OP_EQ OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_CALL OP_CONSTANT OP_EQ OP_PRINT
+1 OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL
+1 OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_DEFINE_GLOBAL OP_CONSTANT OP_GET_GLOBAL OP_ADD OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_EQ OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_CONSTANT OP_EQ OP_PRINT OP_CONSTANT OP_GET_GLOBAL OP_ADD OP_GET_GLOBAL OP_EQ OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL
+1 OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_CALL OP_DEFINE_GLOBAL OP_CONSTANT OP_GET_GLOBAL OP_ADD OP_CONSTANT OP_ADD OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL
+1 OP_GET_GLOBAL OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_EQ OP_PRINT OP_GET_GLOBAL OP_CONSTANT OP_ADD OP_CONSTANT OP_EQ OP_PRINT OP_CONSTANT OP_GET_GLOBAL OP_ADD OP_CONSTANT OP_ADD OP_PRINT OP_CONSTANT OP_DEFINE_GLOBAL OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_JUMP_IF_NOT_LESS OP_GET_GLOBAL OP_GET_GLOBAL OP_ADD OP_SET_GLOBAL OP_POP OP_GET_GLOBAL OP_CONSTANT
+1 OP_GET_GLOBAL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_CONSTANT OP_CALL OP_PRINT OP_CONSTANT OP_DEFINE_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_NEGATE OP_CONSTANT OP_CALL OP_PRINT OP_GET_GLOBAL OP_GET_GLOBAL OP_GET_GLOBAL OP_CALL OP_PRINT
@@ -0,0 +1,36 @@
+#!/bin/sh
+# Runs every script on the stack and on the register tier and compares what they print and how they exit.
+# fib.mop prints how long it took last, that line is left out of the comparison.
+# A script named *_compile_err.mop must not compile, it has to exit with 65 on both tiers.
+# usage: bench/tiers.sh [scripts], run from the repository root after `make`, test/*.mop by default
+[ $# -eq 0 ] && set -- test/*.mop
+out=$(mktemp)
+trap 'rm -f "$out" "$out.stack" "$out.register"' EXIT
+failed=0
+for script in "$@"; do
+    case "$script" in
+        */fib.mop) drop='$d' ;;
+        *) drop='' ;;
+    esac
+    case "$script" in
+        *_compile_err.mop) expect=65 ;;
+        *) expect='' ;;
+    esac
+    for tier in stack register; do
+        ./build/a.out --tier=$tier "$script" > "$out" 2>&1
+        status=$?
+        if [ -n "$expect" ] && [ $status -ne $expect ]; then
+            echo "exit $status, expected $expect: $script on the $tier tier"
+            failed=1
+        fi
+        { sed "$drop" "$out"; echo "exit $status"; } > "$out.$tier"
+    done
+    if diff "$out.stack" "$out.register" > "$out"; then
+        echo "same: $script"
+    else
+        echo "differs: $script"
+        cat "$out"
+        failed=1
+    fi
+done
+exit $failed
@@ -1 +1,67 @@
+#include <stdlib.h>
+#include <string.h>
+
 #include "ast.h"
+
+#define ARENA_BLOCK_SIZE (64 * 1024)
+
+typedef struct ArenaBlock {
+    struct ArenaBlock* next;
+    size_t used;
+    size_t size;
+    _Alignas(max_align_t) char data[];
+} ArenaBlock;
+
+static ArenaBlock* arena = NULL;
+
+void* ast_alloc(size_t size) {
+    size = (size + _Alignof(max_align_t) - 1) & ~(_Alignof(max_align_t) - 1);
+    if (arena == NULL || arena->used + size > arena->size) {
+        size_t blockSize = size > ARENA_BLOCK_SIZE ? size : ARENA_BLOCK_SIZE;
+        ArenaBlock* block = (ArenaBlock*)malloc(sizeof(ArenaBlock) + blockSize);
+        if (block == NULL) exit(1);
+        block->next = arena;
+        block->used = 0;
+        block->size = blockSize;
+        arena = block;
+    }
+    void* result = arena->data + arena->used;
+    arena->used += size;
+    return result;
+}
+
+void ast_free() {
+    while (arena != NULL) {
+        ArenaBlock* next = arena->next;
+        free(arena);
+        arena = next;
+    }
+}
+
+Expr* new_expr(size_t size, ExprType type, Token token) {
+    Expr* expr = (Expr*)ast_alloc(size);
+    memset(expr, 0, size);
+    expr->type = type;
+    expr->token = token;
+    return expr;
+}
+
+Stmt* new_stmt(size_t size, StmtType type, Token token) {
+    Stmt* stmt = (Stmt*)ast_alloc(size);
+    memset(stmt, 0, size);
+    stmt->type = type;
+    stmt->token = token;
+    return stmt;
+}
+
+// @Note: the old array stays in the arena, a list at most doubles what it needs
+void stmt_list_add(StmtList* list, Stmt* stmt) {
+    if (list->capacity < list->count + 1) {
+        int capacity = list->capacity < 8 ? 8 : list->capacity * 2;
+        Stmt** items = (Stmt**)ast_alloc(sizeof(Stmt*) * capacity);
+        if (list->count > 0) memcpy(items, list->items, sizeof(Stmt*) * list->count);
+        list->items = items;
+        list->capacity = capacity;
+    }
+    list->items[list->count++] = stmt;
+}
@@ -1,19 +1,149 @@
 #ifndef comp_ast_h
 #define comp_ast_h
 
+#include "common.h"
+#include "scanner.h"
+
+// @Note: compile() parses the whole program into this tree and checks all of it, optimize() folds and
+// prunes it and only then is bytecode emitted. The nodes hold no heap objects, strings point into the
+// source or into the arena, so the collector never has to know about them. Everything goes when
+// compiling is done.
+
 typedef enum {
-	AstAdd,
+	EXPR_NUMBER,
+	EXPR_STRING,
+	EXPR_LITERAL, // @Note: true, false or nil, told apart by token.type
+	EXPR_UNARY,
+	EXPR_BINARY,
+	EXPR_LOGICAL,
+	EXPR_VARIABLE,
+	EXPR_ASSIGN,
+	EXPR_CALL,
 } ExprType;
 
 typedef struct {
 	ExprType type;
-	int line;
+	Token token; // @Note: the operator, name or literal, its line goes with the instruction
 } Expr;
 
 typedef struct {
 	Expr base;
-	char op;
+	double value;
+} NumberExpr;
+
+typedef struct {
+	Expr base;
+	const char* chars;
+	int length;
+} StringExpr;
+
+typedef struct {
+	Expr base;
+	Expr* operand;
+} UnaryExpr;
+
+// @Note: also `and` and `or`, as EXPR_LOGICAL
+typedef struct {
+	Expr base;
 	Expr *left, *right;
 } BinaryExpr;
 
+typedef struct {
+	Expr base;
+	Expr* value;
+} AssignExpr;
+
+typedef struct {
+	Expr base; // @Note: the token is the closing paren
+	Expr* callee;
+	Expr** args;
+	int argCount;
+} CallExpr;
+
+typedef enum {
+	STMT_EXPRESSION,
+	STMT_PRINT,
+	STMT_LET,
+	STMT_FUN,
+	STMT_BLOCK,
+	STMT_IF,
+	STMT_WHILE,
+	STMT_FOR,
+	STMT_RETURN,
+} StmtType;
+
+typedef struct {
+	StmtType type;
+	Token token;
+} Stmt;
+
+typedef struct {
+	int count;
+	int capacity;
+	Stmt** items;
+} StmtList;
+
+// @Note: STMT_EXPRESSION and STMT_PRINT
+typedef struct {
+	Stmt base;
+	Expr* expr;
+} ExprStmt;
+
+typedef struct {
+	Stmt base; // @Note: the token is the name
+	Expr* init; // @Note: NULL for nil
+} LetStmt;
+
+typedef struct {
+	Stmt base; // @Note: the token is the name
+	Token* params;
+	int arity;
+	StmtList body;
+	Token end;
+} FunStmt;
+
+typedef struct {
+	Stmt base; // @Note: the token is the closing brace
+	StmtList body;
+} BlockStmt;
+
+// @Note: a branch or body is NULL once the optimizer found nothing left in it
+typedef struct {
+	Stmt base;
+	Expr* condition;
+	Stmt* thenBranch;
+	Stmt* elseBranch;
+} IfStmt;
+
+// @Note: a NULL condition loops until a return
+typedef struct {
+	Stmt base;
+	Expr* condition;
+	Stmt* body;
+} WhileStmt;
+
+typedef struct {
+	Stmt base;
+	Stmt* init;
+	Expr* condition;
+	Expr* increment;
+	Stmt* body;
+} ForStmt;
+
+typedef struct {
+	Stmt base;
+	Expr* value; // @Note: NULL for nil
+} ReturnStmt;
+
+void* ast_alloc(size_t size);
+void ast_free();
+
+Expr* new_expr(size_t size, ExprType type, Token token);
+Stmt* new_stmt(size_t size, StmtType type, Token token);
+
+#define NEW_EXPR(type, exprType, token) ((type*)new_expr(sizeof(type), exprType, token))
+#define NEW_STMT(type, stmtType, token) ((type*)new_stmt(sizeof(type), stmtType, token))
+
+void stmt_list_add(StmtList* list, Stmt* stmt);
+
 #endif // comp_ast_h
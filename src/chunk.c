@@ -1,6 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 #include "chunk.h"
+#include "hash.h"
 #include "memory.h"
+#include "object.h"
 #include "value.h"
 #include "vm.h"
 
@@ -38,6 +41,78 @@ int add_constant(Chunk *chunk, Value value) {
     return chunk->constants.count - 1;
 }
 
+void init_constant_index(ConstantIndex* index) {
+    index->count = 0;
+    index->capacity = 0;
+    index->slots = NULL;
+}
+
+void free_constant_index(ConstantIndex* index) {
+    FREE_ARRAY(int, index->slots, index->capacity);
+    init_constant_index(index);
+}
+
+// @Note: numbers are the same constant when their bits are, so 0 and -0 stay apart. Strings made by
+// the compiler are interned, the same text is the same object. Anything else is never shared.
+static bool constant_key(Value value, uint64_t* key) {
+    if (IS_NUMBER(value)) {
+        double number = AS_NUMBER(value);
+        memcpy(key, &number, sizeof(*key));
+        return true;
+    }
+    if (IS_STRING(value)) {
+        *key = (uint64_t)(uintptr_t)AS_OBJ(value);
+        return true;
+    }
+    return false;
+}
+
+static int* find_slot(int* slots, int capacity, Value* pool, uint64_t key) {
+    size_t i = hash_mix(key ^ HASH_SEED, HASH_K1) & (capacity - 1);
+    for (;;) {
+        uint64_t other;
+        if (slots[i] == -1 || (constant_key(pool[slots[i]], &other) && other == key)) {
+            return &slots[i];
+        }
+        i = (i + 1) & (capacity - 1);
+    }
+}
+
+static void grow_index(ConstantIndex* index, Value* pool) {
+    int capacity = GROW_CAPACITY(index->capacity);
+    int* slots = ALLOCATE(int, capacity);
+    for (int i = 0; i < capacity; i++) slots[i] = -1;
+    for (int i = 0; i < index->capacity; i++) {
+        if (index->slots[i] == -1) continue;
+        uint64_t key;
+        // @Note: only constants that have a key are ever put in the index
+        if (!constant_key(pool[index->slots[i]], &key)) continue;
+        *find_slot(slots, capacity, pool, key) = index->slots[i];
+    }
+    FREE_ARRAY(int, index->slots, index->capacity);
+    index->slots = slots;
+    index->capacity = capacity;
+}
+
+// @Note: the pool slot of an equal constant when the chunk has one already, a new slot otherwise
+int add_constant_unique(Chunk* chunk, ConstantIndex* index, Value value) {
+    uint64_t key;
+    if (!constant_key(value, &key)) return add_constant(chunk, value);
+
+    push(value);
+    if ((index->count + 1) * 4 > index->capacity * 3) {
+        grow_index(index, chunk->constants.values);
+    }
+    int* slot = find_slot(index->slots, index->capacity, chunk->constants.values, key);
+    if (*slot == -1) {
+        // @Note: growing the pool does not move the index, the slot stays valid
+        *slot = add_constant(chunk, value);
+        index->count++;
+    }
+    pop();
+    return *slot;
+}
+
 int add_constant_generic(Chunk *chunk, Value value) {
     int idx = add_constant(chunk, value);
     if (idx < 256) {
@@ -46,10 +121,104 @@ int add_constant_generic(Chunk *chunk, Value value) {
     return idx;
 }
 
+// @Note: the one byte form when the operand fits, OP_WIDE and three bytes when it does not
+void write_operand(Chunk *chunk, uint8_t instruction, int operand, int line) {
+    if (operand < UINT8_COUNT) {
+        write_chunk(chunk, instruction, line);
+        write_chunk(chunk, (uint8_t) operand, line);
+        return;
+    }
+    write_chunk(chunk, OP_WIDE, line);
+    write_chunk(chunk, instruction, line);
+    write_chunk(chunk, (uint8_t) (operand & 0xff), line);
+    write_chunk(chunk, (uint8_t) ((operand >> 8) & 0xff), line);
+    write_chunk(chunk, (uint8_t) ((operand >> 16) & 0xff), line);
+}
+
 void write_constant(Chunk *chunk, Value value, int line) {
-    int idx = add_constant(chunk, value);
-    write_chunk(chunk, OP_CONSTANT_LONG, line);
-    write_chunk(chunk, (uint8_t) (idx & 0xff), line);
-    write_chunk(chunk, (uint8_t) ((idx >> 8) & 0xff), line);
-    write_chunk(chunk, (uint8_t) ((idx >> 16) & 0xff), line);
+    write_operand(chunk, OP_CONSTANT, add_constant(chunk, value), line);
+}
+
+int instruction_length(Chunk *chunk, int offset) {
+    bool wide = chunk->code[offset] == OP_WIDE;
+    if (wide) offset++;
+    int size = wide ? 3 : 1;
+    switch (chunk->code[offset]) {
+        case OP_CONSTANT:
+        case OP_DEFINE_GLOBAL:
+        case OP_GET_GLOBAL:
+        case OP_SET_GLOBAL:
+        case OP_GET_LOCAL:
+        case OP_SET_LOCAL:
+        case OP_GET_UPVALUE:
+        case OP_SET_UPVALUE:
+        case OP_CALL:
+        case OP_TAIL_CALL:
+        // @Note: the run behind a superinstruction starts with one of the above
+        #define SUPER_CASE(name, ...) case name:
+        SUPERINSTRUCTIONS(SUPER_CASE)
+        #undef SUPER_CASE
+            return (wide ? 2 : 1) + size;
+        case OP_JUMP:
+        case OP_LOOP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_NOT_EQ:
+        case OP_JUMP_IF_NOT_NEQ:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GEQ:
+        case OP_JUMP_IF_NOT_LEQ:
+            return wide ? 5 : 3;
+        case OP_CLOSURE: {
+            uint32_t constant = chunk->code[offset + 1];
+            if (wide) constant |= (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+            ObjFunction* func = AS_FUNCTION(chunk->constants.values[constant]);
+            return (wide ? 2 : 1) + size + func->upvalueCount * (1 + size);
+        }
+        case OP_R_NIL:
+        case OP_R_TRUE:
+        case OP_R_FALSE:
+        case OP_R_PRINT:
+        case OP_R_RETURN:
+        case OP_R_CLOSE_UPVALUE:
+            return 2;
+        case OP_R_CONSTANT:
+        case OP_R_MOVE:
+        case OP_R_DEFINE_GLOBAL:
+        case OP_R_GET_GLOBAL:
+        case OP_R_SET_GLOBAL:
+        case OP_R_GET_UPVALUE:
+        case OP_R_SET_UPVALUE:
+        case OP_R_NEGATE:
+        case OP_R_NOT:
+        case OP_R_CALL:
+        case OP_R_TAIL_CALL:
+            return 3;
+        case OP_R_ADD:
+        case OP_R_SUBSTRACT:
+        case OP_R_MULTIPLY:
+        case OP_R_DIVIDE:
+        case OP_R_EQ:
+        case OP_R_NEQ:
+        case OP_R_LESS:
+        case OP_R_GREATER:
+        case OP_R_GEQ:
+        case OP_R_LEQ:
+        case OP_R_JUMP_IF_FALSE:
+        case OP_R_JUMP_IF_TRUE:
+            return 4;
+        case OP_R_JUMP_IF_NOT_EQ:
+        case OP_R_JUMP_IF_NOT_NEQ:
+        case OP_R_JUMP_IF_NOT_LESS:
+        case OP_R_JUMP_IF_NOT_GREATER:
+        case OP_R_JUMP_IF_NOT_GEQ:
+        case OP_R_JUMP_IF_NOT_LEQ:
+            return 5;
+        case OP_R_CLOSURE: {
+            ObjFunction* func = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 2]]);
+            return 3 + func->upvalueCount * 2;
+        }
+        default:
+            return wide ? 2 : 1;
+    }
 }
@@ -5,9 +5,19 @@
 #include "value.h"
 #include <stdint.h>
 
+// @Generated: superinstructions, by `make superinstructions` from bench/opcodes.profile
+// @Note: the superinstruction, how many opcodes it stands for and those opcodes
+#define SUPERINSTRUCTIONS(X) \
+	X(OP_GET_LOCAL_CONSTANT_SUBSTRACT, 3, OP_GET_LOCAL, OP_CONSTANT, OP_SUBSTRACT) \
+	X(OP_GET_LOCAL_CONSTANT_JUMP_IF_NOT_LESS, 3, OP_GET_LOCAL, OP_CONSTANT, OP_JUMP_IF_NOT_LESS) \
+	X(OP_GET_LOCAL_CONSTANT, 2, OP_GET_LOCAL, OP_CONSTANT, 0)
+// @End generated
+
+// @Note: an operand is one byte, jumps take two. Behind OP_WIDE the same instruction takes a
+// three byte operand instead, low byte first, for the constants, globals, locals, upvalues and
+// jumps a big function runs out of. OP_CLOSURE widens its upvalue indexes along with the constant.
 typedef enum {
-	// OP_CONSTANT,
-	OP_CONSTANT_LONG,
+	OP_CONSTANT,
 	OP_NIL,
 	OP_TRUE,
 	OP_FALSE,
@@ -15,8 +25,11 @@ typedef enum {
 	OP_GREATER,
 	OP_LESS,
 	OP_EQ,
+	// @Note: the compiler writes OP_LESS, OP_NOT for >= and so on, the peephole pass turns
+	// that into these. OP_GEQ is !(a < b) and OP_LEQ is !(a > b), which differ from >= and <= for NaN.
 	OP_GEQ,
 	OP_LEQ,
+	OP_NEQ,
 	OP_NEGATE,
 	OP_ADD,
 	OP_SUBSTRACT,
@@ -34,12 +47,79 @@ typedef enum {
 	OP_JUMP,
 	OP_LOOP,
 	OP_CALL,
+	OP_TAIL_CALL,
 	OP_CLOSURE,
 	OP_SET_UPVALUE,
 	OP_GET_UPVALUE,
 	OP_CLOSE_UPVALUE,
+	OP_WIDE,
+	// @Note: a comparison, OP_JUMP_IF_FALSE and the OP_POP on both of its paths fused by the peephole
+	// pass. They pop both operands and jump when the comparison is false.
+	OP_JUMP_IF_NOT_EQ,
+	OP_JUMP_IF_NOT_NEQ,
+	OP_JUMP_IF_NOT_LESS,
+	OP_JUMP_IF_NOT_GREATER,
+	OP_JUMP_IF_NOT_GEQ,
+	OP_JUMP_IF_NOT_LEQ,
+	// @Note: quickened variants, never emitted by the compiler. run() rewrites the generic
+	// opcode into one of these after its first execution and back again if the guard fails.
+	OP_ADD_NUM,
+	OP_ADD_STR,
+	OP_SUBSTRACT_NUM,
+	OP_MULTIPLY_NUM,
+	OP_DIVIDE_NUM,
+	OP_GREATER_NUM,
+	OP_LESS_NUM,
+	// @Note: the register tier, see --tier. Its instructions name slots of the frame instead of going
+	// through the stack: A is the register written, B and C the ones read. Where an operand can be
+	// RK it is a constant when RK_CONSTANT is set. It shares OP_JUMP and OP_LOOP with the stack tier.
+	OP_R_CONSTANT, // A K
+	OP_R_NIL, // A
+	OP_R_TRUE, // A
+	OP_R_FALSE, // A
+	OP_R_MOVE, // A B
+	OP_R_DEFINE_GLOBAL, // A G, from A
+	OP_R_GET_GLOBAL, // A G
+	OP_R_SET_GLOBAL, // A G, from A
+	OP_R_GET_UPVALUE, // A U
+	OP_R_SET_UPVALUE, // A U, from A
+	OP_R_ADD, // A RK RK
+	OP_R_SUBSTRACT,
+	OP_R_MULTIPLY,
+	OP_R_DIVIDE,
+	OP_R_EQ,
+	OP_R_NEQ,
+	OP_R_LESS,
+	OP_R_GREATER,
+	OP_R_GEQ,
+	OP_R_LEQ,
+	OP_R_NEGATE, // A B
+	OP_R_NOT, // A B
+	OP_R_JUMP_IF_FALSE, // A, then a two byte jump
+	OP_R_JUMP_IF_TRUE,
+	OP_R_JUMP_IF_NOT_EQ, // RK RK, then a two byte jump taken when the comparison is false
+	OP_R_JUMP_IF_NOT_NEQ,
+	OP_R_JUMP_IF_NOT_LESS,
+	OP_R_JUMP_IF_NOT_GREATER,
+	OP_R_JUMP_IF_NOT_GEQ,
+	OP_R_JUMP_IF_NOT_LEQ,
+	OP_R_PRINT, // A
+	OP_R_CALL, // A argCount, the callee in A and the arguments after it, the result back in A
+	OP_R_TAIL_CALL, // A argCount
+	OP_R_RETURN, // A
+	OP_R_CLOSURE, // A K, then isLocal and index for each upvalue
+	OP_R_CLOSE_UPVALUE, // A, closes the upvalues of A and every register above it
+	// @Note: runs of opcodes that come up most in bench/opcodes.profile, picked by tools/superinstructions.c.
+	// The compiler writes one over the first opcode of its run and leaves the other bytes alone.
+	#define SUPER_OPCODE(name, ...) name,
+	SUPERINSTRUCTIONS(SUPER_OPCODE)
+	#undef SUPER_OPCODE
 } OpCode;
 
+// @Note: an RK operand of the register tier with this bit set is a constant, otherwise a register.
+// Both have to be below it to be used that way, the compiler loads anything else into a register first.
+#define RK_CONSTANT 0x80
+
 typedef struct {
 	OpCode opcode;
 	int idx;
@@ -53,6 +133,14 @@ typedef struct {
 	int* lines; //@Improve: Currently saves all lines. Use RunLengthEncoding to compress it a bit
 } Chunk;
 
+// @Note: open addressing from a number's bits or a string's address to its slot in the pool, -1 when
+// unused. Only the compiler keeps one, for the chunk it is writing, the VM never sees it.
+typedef struct {
+	int count;
+	int capacity;
+	int* slots;
+} ConstantIndex;
+
 void init_chunk(Chunk* chunk);
 
 void write_chunk(Chunk* chunk, uint8_t byte, int line);
@@ -61,8 +149,19 @@ void free_chunk(Chunk* chunk);
 
 int add_constant(Chunk* chunk, Value value);
 
+void init_constant_index(ConstantIndex* index);
+
+void free_constant_index(ConstantIndex* index);
+
+int add_constant_unique(Chunk* chunk, ConstantIndex* index, Value value);
+
 int add_constant_generic(Chunk* chunk, Value value);
 
+void write_operand(Chunk* chunk, uint8_t instruction, int operand, int line);
+
 void write_constant(Chunk* chunk, Value value, int line);
 
+// @Note: the bytes the instruction at offset takes, OP_WIDE and all
+int instruction_length(Chunk* chunk, int offset);
+
 #endif
@@ -5,13 +5,18 @@
 #include <stddef.h>
 #include <stdint.h>
 
-#define DEBUG_TRACE_EXECUTION
-#define DEBUG_PRINT_CODE
+// @Note: execution, bytecode and collection tracing are switched on at run time with --trace.
+// `make debug` adds DEBUG_STRESS_GC, a collection on every allocation, and DEBUG_LOG_GC,
+// which has --trace=gc log every object the collector touches.
 
-#define DEBUG_STRESS_GC
-
-#define DEBUG_LOG_GC
+// Threaded dispatch in run() needs the "labels as values" extension of GCC and clang.
+// Build with -DNO_COMPUTED_GOTO to get the portable switch loop instead.
+#if defined(__GNUC__) && !defined(NO_COMPUTED_GOTO)
+#define COMPUTED_GOTO
+#endif
 
 #define UINT8_COUNT (UINT8_MAX + 1)
+// @Note: the most an OP_WIDE operand can address
+#define UINT24_COUNT (1 << 24)
 
 #endif
@@ -2,13 +2,14 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "ast.h"
 #include "chunk.h"
 #include "common.h"
 #include "memory.h"
 #include "compiler.h"
-#ifdef DEBUG_PRINT_CODE
 #include "debug.h"
-#endif
+#include "optimize.h"
+#include "peephole.h"
 #include "scanner.h"
 #include "object.h"
 
@@ -33,11 +34,12 @@ typedef enum {
     PREC_PRIMARY,
 } Precedence;
 
-typedef void (*ParseFn)(bool canAssign);
+typedef Expr* (*PrefixFn)(bool canAssign);
+typedef Expr* (*InfixFn)(Expr* left, bool canAssign);
 
 typedef struct {
-    ParseFn prefix;
-    ParseFn infix;
+    PrefixFn prefix;
+    InfixFn infix;
     Precedence precedence;
 } ParseRule;
 
@@ -48,7 +50,7 @@ typedef struct {
 } Local;
 
 typedef struct {
-    uint8_t index;
+    int index;
     bool isLocal;
 } Upvalue;
 
@@ -61,10 +63,21 @@ typedef struct Compiler {
     struct Compiler* enclosing;
     ObjFunction* function;
     FunctionType type;
-    Local locals[UINT8_COUNT];
+    Local* locals; // @Note: grows as needed, the slots past 255 are reached through OP_WIDE
     int localCount;
+    int localCapacity;
     int scopeDepth;
-    Upvalue upvalues[UINT8_COUNT];
+    Upvalue* upvalues;
+    int upvalueCapacity;
+    int lastCall; // @Note: offset of the most recent OP_CALL, used to detect calls in tail position
+    int line; // @Note: the source line the next instruction is written with
+    ConstantIndex constants; // @Note: finds a literal already in the pool, so each is stored once
+    bool wideJumps; // @Note: forward jumps are written in the OP_WIDE form
+    bool jumpOverflow; // @Note: a short forward jump came out too far, see gen_code
+    bool registers; // @Note: generating for the register tier, see reg_stmt
+    int regTop; // @Note: the first free register, the locals sit below it and the temporaries from it up
+    bool registerOverflow; // @Note: an operand did not fit in its byte, see gen_code
+    int temps; // @Note: values the stack tier has pushed above the locals, see note_stack
 } Compiler;
 
 Parser parser;
@@ -83,7 +96,7 @@ static void error_at(Token* token, const char* message) {
     if (token->type == TOKEN_EOF) {
         fprintf(stderr, " at end");
     } else if (token->type == TOKEN_ERROR) {
-        
+
     } else {
         fprintf(stderr, " at '%.*s'", token->length, token->start);
     }
@@ -129,438 +142,319 @@ static bool match(TokenType type) {
     return true;
 }
 
-static void emit_byte(uint8_t byte) {
-    write_chunk(current_chunk(), byte, parser.previous.line);
-}
-
-static void emit_constant_bytes(int idx) {
-    // if (idx < 256) {
-    //     emit_byte(OP_CONSTANT);
-    //     emit_byte((uint8_t) idx);
-    // } else {
-    emit_byte(OP_CONSTANT_LONG);
-    emit_byte((uint8_t) (idx & 0xff));
-    emit_byte((uint8_t) ((idx >> 8) & 0xff));
-    emit_byte((uint8_t) ((idx >> 16) & 0xff));
-    // }
-}
-
-static void emit_bytes_by_opcode(OpCode operation, int content) {
-    emit_byte(operation);
-    emit_byte((uint8_t) (content & 0xff));
-    emit_byte((uint8_t) ((content >> 8) & 0xff));
-    emit_byte((uint8_t) ((content >> 16) & 0xff));
-}
-
-static void emit_bytes(uint8_t b1, uint8_t b2) {
-    emit_byte(b1);
-    emit_byte(b2);
-}
+// Parsing, builds the tree and reports syntax errors
 
-static void emit_long_bytes(uint8_t b1, uint8_t b2, uint8_t b3, uint8_t b4) {
-    emit_byte(b1);
-    emit_byte(b2);
-    emit_byte(b3);
-    emit_byte(b4);
+static bool identifiers_equal(Token* n1, Token* n2) {
+    if (n1->length != n2->length) return false;
+    return memcmp(n1->start, n2->start, n1->length) == 0;
 }
 
-static void emit_loop(int loopStart) {
-    emit_byte(OP_LOOP);
-
-    int offset = current_chunk()->count - loopStart + 2;
-    if (offset > UINT16_MAX) error("Loop body to long.");
-    emit_byte((offset >> 8) & 0xff);
-    emit_byte(offset & 0xff);
-}
+// @Note: the rules about names and returns are checked while the tree is built, before optimize()
+// can drop any of it, so code that never runs is held to them too. The generator relies on them
+// and only works out the slots. These are the scopes it opens, with the locals of a function from
+// its base on in one shared array.
+typedef struct {
+    FunctionType type;
+    int base;
+    int depth;
+    Local* locals;
+    int localCount;
+    int localCapacity;
+} Scopes;
 
-static void emit_return() {
-    emit_byte(OP_NIL);
-    emit_byte(OP_RETURN);
-}
+Scopes scopes;
 
-static void init_compiler(Compiler* compiler, FunctionType type) {
-    compiler->enclosing = current;
-    compiler->function = NULL; // @Note: dont generate garbage
-    compiler->type = type;
-    compiler->localCount = 0;
-    compiler->scopeDepth = 0;
-    compiler->function = new_function();
-    current = compiler;
-    if (type != TYPE_SCRIPT) {
-        current->function->name = copy_string(parser.previous.start, parser.previous.length);
+static void scope_declare(Token* name) {
+    if (scopes.depth == 0) return;
+    for (int i = scopes.localCount - 1; i >= scopes.base; i--) {
+        Local* local = &scopes.locals[i];
+        if (local->depth != -1 && local->depth < scopes.depth) {
+            break;
+        }
+        if (identifiers_equal(name, &local->name)) {
+            error_at(name, "There already exists a variable with the same name in this scope");
+        }
     }
-    Local* local = &current->locals[current->localCount++];
-    local->depth = 0;
-    local->name.start = "";
-    local->name.length = 0;
+    if (scopes.localCapacity < scopes.localCount + 1) {
+        int oldCapacity = scopes.localCapacity;
+        scopes.localCapacity = GROW_CAPACITY(oldCapacity);
+        scopes.locals = GROW_ARRAY(Local, scopes.locals, oldCapacity, scopes.localCapacity);
+    }
+    Local* local = &scopes.locals[scopes.localCount++];
+    local->name = *name;
+    local->depth = -1;
     local->isCaptured = false;
 }
 
-static ObjFunction* end_compiler() {
-    emit_return();
-    ObjFunction* func = current->function;
-    #ifdef DEBUG_PRINT_CODE
-        if (!parser.hadError) {
-            disassemble_chunk(current_chunk(), func->name != NULL ? func->name->chars : "<script>");
-        }
-    #endif
-    current = current->enclosing;
-    return func;
+static void scope_define() {
+    if (scopes.depth == 0) return;
+    scopes.locals[scopes.localCount - 1].depth = scopes.depth;
 }
 
-static void begin_scope() {
-    current->scopeDepth++;
+static void scope_end() {
+    scopes.depth--;
+    while (scopes.localCount > scopes.base && scopes.locals[scopes.localCount - 1].depth > scopes.depth) {
+        scopes.localCount--;
+    }
 }
 
-static void end_scope() {
-    current->scopeDepth--;
-    while (current->localCount > 0 && current->locals[current->localCount -1].depth > current->scopeDepth) {
-        if (current->locals[current->localCount - 1].isCaptured) {
-            emit_byte(OP_CLOSE_UPVALUE);
-        } else {
-            emit_byte(OP_POP);
+// @Note: only the function's own locals can still be in their initializer, there are no function expressions
+static void scope_read(Token* name) {
+    for (int i = scopes.localCount - 1; i >= scopes.base; i--) {
+        if (identifiers_equal(name, &scopes.locals[i].name)) {
+            if (scopes.locals[i].depth == -1) {
+                error_at(name, "Cannot read local variable in its own initializer.");
+            }
+            return;
         }
-        current->localCount--;
     }
 }
 
-static void expression();
-static void statement();
-static void declaration();
-static int make_constant(Value value);
+static Expr* expression();
+static Stmt* statement();
+static Stmt* declaration();
 static ParseRule* get_rule(TokenType type);
-static void parse_precedence(Precedence precedence);
-static int emit_jump(uint8_t instruction);
-
-static void patch_jump(int offset) {
-    // @Adjustment: Long bytecodes need more than -2
-    int jump = current_chunk()->count - offset - 2;
 
-    if (jump > UINT16_MAX) {
-        error("Too much code to jump over.");
-    }
-
-    current_chunk()->code[offset] = (jump >> 8) & 0xff;
-    current_chunk()->code[offset + 1] = jump & 0xff;
-}
-
-
-static void parse_precedence(Precedence precedence) {
+static Expr* parse_precedence(Precedence precedence) {
     advance();
-    ParseFn prefix_rule = get_rule(parser.previous.type)->prefix;
+    PrefixFn prefix_rule = get_rule(parser.previous.type)->prefix;
     if (prefix_rule == NULL) {
         error("Expect expression.");
-        return;
+        return NULL;
     }
     bool canAssign = precedence <= PREC_ASSIGN;
 
-    prefix_rule(canAssign);
+    Expr* expr = prefix_rule(canAssign);
 
     while (precedence <= get_rule(parser.current.type)->precedence) {
         advance();
-        ParseFn infix_rule = get_rule(parser.previous.type)->infix;
-        infix_rule(canAssign);
+        InfixFn infix_rule = get_rule(parser.previous.type)->infix;
+        expr = infix_rule(expr, canAssign);
     }
 
     if (canAssign && match(TOKEN_EQ)) {
         error("Invalid assignment target.");
     }
+    return expr;
 }
 
-static int identifier_constant(Token* name) {
-    return make_constant(OBJ_VAL(copy_string(name->start, name->length)));
-}
-
-static void add_local(Token name) {
-    if (current->localCount == UINT8_COUNT) {
-        error("Too many local variables in function.");
-        return;
-    }
-    Local* local = &current->locals[current->localCount++];
-    local->name = name;
-    local->depth = -1;
-    local->isCaptured = false;
-    // local->depth = current->scopeDepth;
-}
-
-static bool identifiers_equal(Token* n1, Token* n2) {
-    if (n1->length != n2->length) return false;
-    return memcmp(n1->start, n2->start, n1->length) == 0;
+static Expr* expression() {
+    return parse_precedence(PREC_ASSIGN);
 }
 
-static int resolve_local(Compiler* comp, Token* name) {
-    for (int i = comp->localCount - 1; i >= 0; i--) {
-        Local* l = &comp->locals[i];
-        if (identifiers_equal(name, &l->name)) {
-            if (l->depth == -1) {
-                error("Cannot read local variable in its own initializer.");
-            }
-            return i;
-        }
-    }
-
-    return -1;
+static Expr* and_(Expr* left, bool canAssign) {
+    BinaryExpr* expr = NEW_EXPR(BinaryExpr, EXPR_LOGICAL, parser.previous);
+    expr->left = left;
+    expr->right = parse_precedence(PREC_AND);
+    return (Expr*)expr;
 }
 
-static int add_upvalue(Compiler* comp, uint8_t index, bool isLocal) {
-    int upvalueCount = comp->function->upvalueCount;
-    for (int i = 0; i < upvalueCount; i++) {
-        Upvalue* uv = &comp->upvalues[i];
-        if (uv->index == index && uv->isLocal == isLocal) {
-            return i;
-        }
-    }
-
-    if (upvalueCount == UINT8_COUNT) {
-        error("Too many closure variables in function.");
-        return 0;
-    }
-    comp->upvalues[upvalueCount].isLocal = isLocal;
-    comp->upvalues[upvalueCount].index = index;
-    return comp->function->upvalueCount++;
+static Expr* or_(Expr* left, bool canAssign) {
+    BinaryExpr* expr = NEW_EXPR(BinaryExpr, EXPR_LOGICAL, parser.previous);
+    expr->left = left;
+    expr->right = parse_precedence(PREC_OR);
+    return (Expr*)expr;
 }
 
-static int resolve_upvalue(Compiler* comp, Token* name) {
-    if (comp->enclosing == NULL) return -1;
-
-    int local = resolve_local(comp->enclosing, name);
-    if (local != -1) {
-        comp->enclosing->locals[local].isCaptured = true;
-        return add_upvalue(comp, (uint8_t) local, true);
-    }
-
-    int uv = resolve_upvalue(comp->enclosing, name);
-    if (uv != -1) {
-        return add_upvalue(comp, (uint8_t) uv, false);
-    }
-
-    return -1;
+static Expr* grouping(bool canAssign) {
+    Expr* expr = expression();
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+    return expr;
 }
 
-static void declare_variable() {
-    if (current->scopeDepth == 0) return;
-    Token* name = &parser.previous;
-    for (int i = current->localCount - 1; i >= 0; i--) {
-        Local* local = &current->locals[i];
-        if (local->depth != -1 && local->depth < current->scopeDepth) {
-            break;
-        }
-        if (identifiers_equal(name, &local->name)) {
-            error("There already exists a variable with the same name in this scope");
-        }
-    }
-    add_local(*name);
+static Expr* unary(bool canAssign) {
+    UnaryExpr* expr = NEW_EXPR(UnaryExpr, EXPR_UNARY, parser.previous);
+    expr->operand = parse_precedence(PREC_UNARY);
+    return (Expr*)expr;
 }
 
-static int parse_variable(const char* errorMsg) {
-    consume(TOKEN_IDENTIFIER, errorMsg);
-    declare_variable();
-    if (current->scopeDepth > 0) return 0;
-    return identifier_constant(&parser.previous);
+static Expr* binary(Expr* left, bool canAssign) {
+    BinaryExpr* expr = NEW_EXPR(BinaryExpr, EXPR_BINARY, parser.previous);
+    ParseRule* rule = get_rule(parser.previous.type);
+    expr->left = left;
+    expr->right = parse_precedence((Precedence) (rule->precedence + 1));
+    return (Expr*)expr;
 }
 
-static void mark_initialized() {
-    if (current->scopeDepth == 0) {
-        return;
+static Expr* call(Expr* callee, bool canAssign) {
+    Expr* args[UINT8_COUNT];
+    int argCount = 0;
+    if (!check(TOKEN_RIGHT_PAREN)) {
+        do {
+            Expr* arg = expression();
+            if (argCount == 255) {
+                error("Cannot have more than 255 arguments.");
+            } else {
+                args[argCount] = arg;
+            }
+            argCount++;
+        } while (match(TOKEN_COMMA));
     }
-    current->locals[current->localCount - 1].depth = current->scopeDepth;
+    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
+    CallExpr* expr = NEW_EXPR(CallExpr, EXPR_CALL, parser.previous);
+    expr->callee = callee;
+    expr->argCount = argCount > 255 ? 255 : argCount;
+    expr->args = (Expr**)ast_alloc(sizeof(Expr*) * expr->argCount);
+    memcpy(expr->args, args, sizeof(Expr*) * expr->argCount);
+    return (Expr*)expr;
 }
 
-static void define_variable(uint8_t global) {
-    if (current->scopeDepth > 0){
-        mark_initialized();
-        return;
-    } 
-    emit_long_bytes(OP_DEFINE_GLOBAL,(uint8_t) (global & 0xff), (uint8_t) ((global >> 8) & 0xff), (uint8_t) ((global >> 16) & 0xff)); 
-    // emit_long_bytes(OP_DEFINE_GLOBAL,(uint8_t) ((global >> 16) & 0xff), (uint8_t) ((global >> 8) & 0xff), (uint8_t) (global & 0xff)); 
+static Expr* number(bool canAssign) {
+    NumberExpr* expr = NEW_EXPR(NumberExpr, EXPR_NUMBER, parser.previous);
+    expr->value = strtod(parser.previous.start, NULL);
+    return (Expr*)expr;
 }
 
-static void and_(bool canAssign) {
-    int endJump = emit_jump(OP_JUMP_IF_FALSE); // If the left side is false, we know that we can ignore the rest
-    emit_byte(OP_POP);
-    parse_precedence(PREC_AND);
-    patch_jump(endJump);
+static Expr* literal(bool canAssign) {
+    return new_expr(sizeof(Expr), EXPR_LITERAL, parser.previous);
 }
 
-static void or_(bool canAssign) {
-    int elseJump = emit_jump(OP_JUMP_IF_FALSE);
-    int endJump = emit_jump(OP_JUMP);
-
-    patch_jump(elseJump);
-    emit_byte(OP_POP);
-
-    parse_precedence(PREC_OR);
-    patch_jump(endJump);
+static Expr* string(bool canAssign) {
+    StringExpr* expr = NEW_EXPR(StringExpr, EXPR_STRING, parser.previous);
+    expr->chars = parser.previous.start + 1;
+    expr->length = parser.previous.length - 2;
+    return (Expr*)expr;
 }
 
-static void expression() {
-    parse_precedence(PREC_ASSIGN);
+static Expr* variable(bool canAssign) {
+    Token name = parser.previous;
+    scope_read(&name);
+    if (canAssign && match(TOKEN_EQ)) {
+        AssignExpr* expr = NEW_EXPR(AssignExpr, EXPR_ASSIGN, name);
+        expr->value = expression();
+        return (Expr*)expr;
+    }
+    return new_expr(sizeof(Expr), EXPR_VARIABLE, name);
 }
 
-static void block() {
+static void block(StmtList* body) {
     while (!check(TOKEN_RIGHT_BRACE) && !check(TOKEN_EOF)) {
-        declaration(); 
+        stmt_list_add(body, declaration());
     }
     consume(TOKEN_RIGHT_BRACE, "Expect '}' after block.");
 }
 
-static void function(FunctionType type) {
-    Compiler compiler;
-    init_compiler(&compiler, type);
-    begin_scope(); // No need to end this, since the compiler just "ends" itself.
+static Stmt* function(Token name) {
+    FunStmt* stmt = NEW_STMT(FunStmt, STMT_FUN, name);
+    Token params[UINT8_COUNT];
+    Scopes enclosing = scopes;
+    scopes.type = TYPE_FUNCTION;
+    scopes.base = scopes.localCount;
+    scopes.depth = 1;
 
     consume(TOKEN_LEFT_PAREN, "Expect '(' after function name.");
     if (!check(TOKEN_RIGHT_PAREN)) {
         do {
-            current->function->arity++;
-            if (current->function->arity > 255) {
+            if (stmt->arity == 255) {
                 error_at_current("Cannot have more than 255 parameters.");
             }
-            uint8_t constant = parse_variable("Expect parameter name.");
-            define_variable(constant);
+            consume(TOKEN_IDENTIFIER, "Expect parameter name.");
+            scope_declare(&parser.previous);
+            scope_define();
+            if (stmt->arity < 255) params[stmt->arity++] = parser.previous;
         } while (match(TOKEN_COMMA));
     }
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after function parameters.");
     consume(TOKEN_LEFT_BRACE, "Expect '{' before function body.");
-    block();
-
-    ObjFunction* func = end_compiler();
-    emit_bytes_by_opcode(OP_CLOSURE, make_constant(OBJ_VAL(func)));
-
-    for (int i = 0; i < func->upvalueCount; i++) {
-        emit_byte(compiler.upvalues[i].isLocal ? 1 : 0);
-        emit_byte(compiler.upvalues[i].index); // @Improvement: This will need to be done in 3 bytes for LONG UVs
-    }
+    block(&stmt->body);
+    stmt->end = parser.previous;
+    // @Note: the body may have moved the locals while it grew them
+    enclosing.locals = scopes.locals;
+    enclosing.localCapacity = scopes.localCapacity;
+    scopes = enclosing;
+    stmt->params = (Token*)ast_alloc(sizeof(Token) * stmt->arity);
+    memcpy(stmt->params, params, sizeof(Token) * stmt->arity);
+    return (Stmt*)stmt;
 }
 
-static void let_declaration() {
-    uint8_t global = parse_variable("Expect variable name.");
-    printf("Global: %d\n", global);
-
+static Stmt* let_declaration() {
+    consume(TOKEN_IDENTIFIER, "Expect variable name.");
+    LetStmt* stmt = NEW_STMT(LetStmt, STMT_LET, parser.previous);
+    scope_declare(&parser.previous);
     if (match(TOKEN_EQ)) {
-        expression();
-    } else {
-        emit_byte(OP_NIL);
+        stmt->init = expression();
     }
+    scope_define();
     consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    define_variable(global);
+    return (Stmt*)stmt;
 }
 
-static void fun_declaration() {
-    uint8_t global = parse_variable("Expect function name.");
-    mark_initialized();
-    function(TYPE_FUNCTION);
-    define_variable(global);
+static Stmt* fun_declaration() {
+    consume(TOKEN_IDENTIFIER, "Expect function name.");
+    scope_declare(&parser.previous);
+    scope_define();
+    return function(parser.previous);
 }
 
-static void print_statement() {
-    expression();
+static Stmt* expr_statement(StmtType type) {
+    Expr* expr = expression();
     consume(TOKEN_SEMICOLON, "Expect ';' after value.");
-    emit_byte(OP_PRINT);
+    ExprStmt* stmt = NEW_STMT(ExprStmt, type, parser.previous);
+    stmt->expr = expr;
+    return (Stmt*)stmt;
 }
 
-static void expression_statement() {
-    expression();
-    consume(TOKEN_SEMICOLON,  "Expect ';' after value.");
-    emit_byte(OP_POP);
-}
-
-static int emit_jump(uint8_t instruction) {
-    emit_byte(instruction);
-    emit_byte(0xff);
-    emit_byte(0xff); // @Improvement: Use LONG jump instruction
-    return current_chunk()->count - 2;
-}
-
-static void if_statement() {
+static Stmt* if_statement() {
+    IfStmt* stmt = NEW_STMT(IfStmt, STMT_IF, parser.previous);
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'if'.");
-    expression();
+    stmt->condition = expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-
-
-    int thenJump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
-    statement();
-    int elseJump = emit_jump(OP_JUMP);
-    patch_jump(thenJump); // We need to set the location of the jump, which was set to a default val
-    emit_byte(OP_POP);
-    if (match(TOKEN_ELSE)){
-        statement(); 
-    } 
-    patch_jump(elseJump); // We need to set the location of the jump, which was set to a default val
+    stmt->thenBranch = statement();
+    if (match(TOKEN_ELSE)) {
+        stmt->elseBranch = statement();
+    }
+    return (Stmt*)stmt;
 }
 
-static void while_statement() {
-    int loopStart = current_chunk()->count;
+static Stmt* while_statement() {
+    WhileStmt* stmt = NEW_STMT(WhileStmt, STMT_WHILE, parser.previous);
     consume(TOKEN_LEFT_PAREN, "Expect '(' after 'while'.");
-    expression();
+    stmt->condition = expression();
     consume(TOKEN_RIGHT_PAREN, "Expect ')' after condition.");
-    
-    int exitJump = emit_jump(OP_JUMP_IF_FALSE);
-    emit_byte(OP_POP);
-    statement();
-    emit_loop(loopStart);
-
-    patch_jump(exitJump);
-    emit_byte(OP_POP);
+    stmt->body = statement();
+    return (Stmt*)stmt;
 }
 
-static void for_statement() {
-    begin_scope();
+// @Note: the clauses are separated by two semicolons, `for (let i = 0;; i < 3;; i = i + 1)`
+static Stmt* for_statement() {
+    ForStmt* stmt = NEW_STMT(ForStmt, STMT_FOR, parser.previous);
     consume(TOKEN_LEFT_PAREN,  "Expect '(' after 'for'.");
-    if (match(TOKEN_SEMICOLON)){ 
+    scopes.depth++;
+    if (match(TOKEN_SEMICOLON)){
 
     } else if (match(TOKEN_LET)) {
-        let_declaration();
+        stmt->init = let_declaration();
     } else {
-        expression_statement();
+        stmt->init = expr_statement(STMT_EXPRESSION);
     }
     consume(TOKEN_SEMICOLON, "Expect ';'.");
 
-    int loopStart = current_chunk()->count;
-    int exitJump = -1;
     if (!match(TOKEN_SEMICOLON)) {
-        expression();
+        stmt->condition = expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after loop condition.");
-
-        exitJump = emit_jump(OP_JUMP_IF_FALSE);
-        emit_byte(OP_POP);
     }
     consume(TOKEN_SEMICOLON, "Expect ';'.");
-    // consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clause.");
 
     if (!match(TOKEN_RIGHT_PAREN)) {
-        int bodyJump = emit_jump(OP_JUMP);
-        int incrementStart = current_chunk()->count;
-        expression();
-        emit_byte(OP_POP);
+        stmt->increment = expression();
         consume(TOKEN_RIGHT_PAREN, "Expect ')' after for clause.");
-
-        emit_loop(loopStart);
-        loopStart = incrementStart;
-        patch_jump(bodyJump);
     }
 
-    statement();
-    emit_loop(loopStart);
-    if (exitJump != -1) {
-        patch_jump(exitJump);
-        emit_byte(OP_POP);
-    }
-    end_scope();
+    stmt->body = statement();
+    scope_end();
+    return (Stmt*)stmt;
 }
 
-static void return_statement() {
-    if (current->type == TYPE_SCRIPT) {
+static Stmt* return_statement() {
+    ReturnStmt* stmt = NEW_STMT(ReturnStmt, STMT_RETURN, parser.previous);
+    if (scopes.type == TYPE_SCRIPT) {
         error("Cannot return from global scope.");
     }
-    if (match(TOKEN_SEMICOLON)) {
-        emit_return();
-    } else {
-        expression();
+    if (!match(TOKEN_SEMICOLON)) {
+        stmt->value = expression();
         consume(TOKEN_SEMICOLON, "Expect ';' after return value.");
-        emit_byte(OP_RETURN);
     }
+    return (Stmt*)stmt;
 }
 
 static void synchronize() {
@@ -586,99 +480,375 @@ static void synchronize() {
     }
 }
 
-static void statement() {
+static Stmt* statement() {
     if (match(TOKEN_PRINT)) {
-        print_statement();
+        return expr_statement(STMT_PRINT);
     } else if (match(TOKEN_IF)) {
-        if_statement();
+        return if_statement();
     }  else if (match(TOKEN_LEFT_BRACE)) {
-        begin_scope();
-        block();
-        end_scope();
+        BlockStmt* stmt = NEW_STMT(BlockStmt, STMT_BLOCK, parser.previous);
+        scopes.depth++;
+        block(&stmt->body);
+        scope_end();
+        stmt->base.token = parser.previous;
+        return (Stmt*)stmt;
     } else if (match(TOKEN_WHILE)){
-        while_statement();
+        return while_statement();
     } else if (match(TOKEN_FOR)){
-        for_statement();
+        return for_statement();
     } else if (match(TOKEN_RETURN)) {
-        return_statement();
-    }
-    else {
-        expression_statement();
+        return return_statement();
     }
+    return expr_statement(STMT_EXPRESSION);
 }
 
-static void declaration() {
+static Stmt* declaration() {
+    Stmt* stmt;
     if (match(TOKEN_FUN)) {
-        fun_declaration();
+        stmt = fun_declaration();
     } else if (match(TOKEN_LET)) {
-        let_declaration();
+        stmt = let_declaration();
     } else {
-        statement();
+        stmt = statement();
     }
     if (parser.panicMode) synchronize();
+    return stmt;
 }
 
-static void grouping(bool canAssign) {
-    expression();
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after expression.");
+ParseRule rules[] = {
+    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
+    [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
+    [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_MINUS] = {unary, binary, PREC_TERM},
+    [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
+    [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
+    [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
+    [TOKEN_BANG] = {unary, NULL, PREC_NONE},
+    [TOKEN_BANG_EQ] = {NULL, binary, PREC_EQ},
+    [TOKEN_EQ] = {NULL, NULL, PREC_NONE},
+    [TOKEN_EQ_EQ] = {NULL, binary, PREC_EQ},
+    [TOKEN_GREATER] = {NULL, binary, PREC_COMPARE},
+    [TOKEN_GEQ] = {NULL, binary, PREC_COMPARE},
+    [TOKEN_LESS] = {NULL, binary, PREC_COMPARE},
+    [TOKEN_LEQ] = {NULL, binary, PREC_COMPARE},
+    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
+    [TOKEN_STRING] = {string, NULL, PREC_NONE},
+    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
+    [TOKEN_AND] = {NULL, and_, PREC_AND},
+    [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
+    [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_IF] = {NULL, NULL, PREC_NONE},
+    [TOKEN_NIL] = {literal, NULL, PREC_NONE},
+    [TOKEN_OR] = {NULL, or_, PREC_OR},
+    [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
+    [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
+    [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
+    [TOKEN_THIS] = {NULL, NULL, PREC_NONE},
+    [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
+    [TOKEN_LET] = {NULL, NULL, PREC_NONE},
+    [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
+    [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
+    [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
+};
+
+static ParseRule* get_rule(TokenType type) {
+    return &rules[type];
 }
 
-static void unary(bool canAssign) {
-    TokenType operatorType = parser.previous.type;
-    parse_precedence(PREC_UNARY);
+// Code generation, resolves the names and reports the errors that need scopes
 
-    switch (operatorType) {
-        case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
-        case TOKEN_BANG: emit_byte(OP_NOT); break;
-        default: return;
-    }
+static void emit_byte(uint8_t byte) {
+    write_chunk(current_chunk(), byte, current->line);
 }
 
-static void binary(bool canAssign) {
-    TokenType operatorType = parser.previous.type;
-    ParseRule* rule = get_rule(operatorType);
-    parse_precedence((Precedence) (rule->precedence + 1));
+static void emit_operand(uint8_t instruction, int operand) {
+    write_operand(current_chunk(), instruction, operand, current->line);
+}
 
-    switch (operatorType) {
-        case TOKEN_PLUS: emit_byte(OP_ADD); break;
-        case TOKEN_MINUS: emit_byte(OP_SUBSTRACT); break;
-        case TOKEN_STAR: emit_byte(OP_MULTIPLY); break;
-        case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
-        case TOKEN_BANG_EQ: emit_bytes(OP_EQ, OP_NOT); break;
-        case TOKEN_EQ_EQ: emit_byte(OP_EQ); break;
-        case TOKEN_GREATER: emit_byte(OP_GREATER); break;
-        case TOKEN_GEQ: emit_bytes(OP_LESS, OP_NOT); break;
-        case TOKEN_LESS: emit_byte(OP_LESS); break;
-        case TOKEN_LEQ: emit_bytes(OP_GREATER, OP_NOT); break;
-        default: return;
+static void emit_bytes(uint8_t b1, uint8_t b2) {
+    emit_byte(b1);
+    emit_byte(b2);
+}
+
+static void emit_long(int operand) {
+    emit_byte((uint8_t) (operand & 0xff));
+    emit_byte((uint8_t) ((operand >> 8) & 0xff));
+    emit_byte((uint8_t) ((operand >> 16) & 0xff));
+}
+
+// @Note: the distance is known here already, so a loop only takes the wide form when it needs it
+static void emit_loop(int loopStart, Token* token) {
+    int offset = current_chunk()->count - loopStart + 3;
+    if (offset <= UINT16_MAX) {
+        emit_byte(OP_LOOP);
+        emit_byte((offset >> 8) & 0xff);
+        emit_byte(offset & 0xff);
+        return;
     }
+    offset += 2;
+    if (offset >= UINT24_COUNT) error_at(token, "Loop body to long.");
+    emit_bytes(OP_WIDE, OP_LOOP);
+    emit_long(offset);
 }
 
-static uint8_t argument_list() {
-    uint8_t argCount = 0;
-    if (!check(TOKEN_RIGHT_PAREN)) {
-        do {
-            expression();
-            if (argCount == 255) error("Cannot have more than 255 arguments.");
-            argCount++;
-        } while (match(TOKEN_COMMA));
+// @Note: a frame of the stack tier holds its locals and the temporaries above them. The most of
+// that at once is the function's maxStack, which a call makes room for before it runs the function.
+static void note_stack(int temps) {
+    int depth = current->localCount + temps;
+    if (depth > current->function->maxStack) current->function->maxStack = depth;
+}
+
+static void emit_return() {
+    if (current->registers) {
+        // @Note: slot 0 holds the callee, which nothing needs once the frame returns
+        emit_bytes(OP_R_NIL, 0);
+        emit_bytes(OP_R_RETURN, 0);
+        return;
     }
-    consume(TOKEN_RIGHT_PAREN, "Expect ')' after arguments.");
-    return argCount;
+    note_stack(current->temps + 1);
+    emit_byte(OP_NIL);
+    emit_byte(OP_RETURN);
+}
+
+static int emit_jump(uint8_t instruction) {
+    if (current->wideJumps) {
+        emit_bytes(OP_WIDE, instruction);
+        emit_long(0xffffff);
+        return current_chunk()->count - 3;
+    }
+    emit_byte(instruction);
+    emit_byte(0xff);
+    emit_byte(0xff);
+    return current_chunk()->count - 2;
+}
+
+static void patch_jump(int offset, Token* token) {
+    uint8_t* code = current_chunk()->code;
+    if (current->wideJumps) {
+        int jump = current_chunk()->count - offset - 3;
+        if (jump >= UINT24_COUNT) {
+            error_at(token, "Too much code to jump over.");
+        }
+        code[offset] = jump & 0xff;
+        code[offset + 1] = (jump >> 8) & 0xff;
+        code[offset + 2] = (jump >> 16) & 0xff;
+        return;
+    }
+
+    int jump = current_chunk()->count - offset - 2;
+    if (jump > UINT16_MAX) {
+        current->jumpOverflow = true;
+    }
+    code[offset] = (jump >> 8) & 0xff;
+    code[offset + 1] = jump & 0xff;
+}
+
+// @Note: the register tier has one byte per operand, a function that needs more goes back to the stack tier
+static uint8_t reg_byte(int operand) {
+    if (operand >= UINT8_COUNT) current->registerOverflow = true;
+    return (uint8_t)operand;
+}
+
+static Local* push_local() {
+    if (current->localCapacity < current->localCount + 1) {
+        int oldCapacity = current->localCapacity;
+        current->localCapacity = GROW_CAPACITY(oldCapacity);
+        current->locals = GROW_ARRAY(Local, current->locals, oldCapacity, current->localCapacity);
+    }
+    return &current->locals[current->localCount++];
+}
+
+static void init_compiler(Compiler* compiler, FunctionType type, Token* name) {
+    compiler->enclosing = current;
+    compiler->function = NULL; // @Note: dont generate garbage
+    compiler->type = type;
+    compiler->locals = NULL;
+    compiler->localCount = 0;
+    compiler->localCapacity = 0;
+    compiler->scopeDepth = 0;
+    compiler->upvalues = NULL;
+    compiler->upvalueCapacity = 0;
+    compiler->lastCall = -1;
+    compiler->line = name != NULL ? name->line : 1;
+    compiler->wideJumps = false;
+    compiler->jumpOverflow = false;
+    compiler->registers = false;
+    compiler->regTop = 0;
+    compiler->registerOverflow = false;
+    compiler->temps = 0;
+    init_constant_index(&compiler->constants);
+    compiler->function = new_function();
+    current = compiler;
+    if (type != TYPE_SCRIPT) {
+        current->function->name = copy_string(name->start, name->length);
+        gc_write_barrier((Obj*)current->function, OBJ_VAL(current->function->name));
+    }
+    Local* local = push_local();
+    local->depth = 0;
+    local->name.start = "";
+    local->name.length = 0;
+    local->isCaptured = false;
+}
+
+static ObjFunction* end_compiler() {
+    emit_return();
+    ObjFunction* func = current->function;
+    if (!parser.hadError && !current->registers) {
+        peephole(current_chunk());
+        // @Note: a profile counts the plain opcodes, the superinstructions would hide their runs
+        if (vm.opProfile.path == NULL) select_superinstructions(current_chunk());
+    }
+    if ((vm.traceFlags & TRACE_CODE) && !parser.hadError) {
+        disassemble_chunk(current_chunk(), func->name != NULL ? func->name->chars : "<script>");
+    }
+    current = current->enclosing;
+    return func;
+}
+
+// @Note: after end_compiler, the upvalues are still needed to write the closure
+static void free_compiler(Compiler* compiler) {
+    FREE_ARRAY(Local, compiler->locals, compiler->localCapacity);
+    FREE_ARRAY(Upvalue, compiler->upvalues, compiler->upvalueCapacity);
+    free_constant_index(&compiler->constants);
+}
+
+static void begin_scope() {
+    current->scopeDepth++;
+}
+
+static void end_scope() {
+    current->scopeDepth--;
+    int closeFrom = -1;
+    while (current->localCount > 0 && current->locals[current->localCount -1].depth > current->scopeDepth) {
+        if (current->registers) {
+            if (current->locals[current->localCount - 1].isCaptured) closeFrom = current->localCount - 1;
+        } else if (current->locals[current->localCount - 1].isCaptured) {
+            emit_byte(OP_CLOSE_UPVALUE);
+        } else {
+            emit_byte(OP_POP);
+        }
+        current->localCount--;
+    }
+    // @Note: the register tier has nothing to pop, one instruction closes the captured locals of the scope
+    if (closeFrom != -1) emit_bytes(OP_R_CLOSE_UPVALUE, reg_byte(closeFrom));
+    if (current->registers) current->regTop = current->localCount;
+}
+
+static void gen_expr(Expr* expr);
+static void gen_stmt(Stmt* stmt);
+static int make_constant(Value value);
+
+static int identifier_global(Token* name) {
+    // @Note: globals are resolved to a slot in vm.globalValues at compile time, the VM never hashes the name
+    return global_slot(copy_string(name->start, name->length));
+}
+
+static void add_local(Token name) {
+    if (current->localCount == UINT24_COUNT) {
+        error_at(&name, "Too many local variables in function.");
+        return;
+    }
+    Local* local = push_local();
+    local->name = name;
+    local->depth = -1;
+    local->isCaptured = false;
+    // local->depth = current->scopeDepth;
+}
+
+static int resolve_local(Compiler* comp, Token* name) {
+    for (int i = comp->localCount - 1; i >= 0; i--) {
+        Local* l = &comp->locals[i];
+        if (identifiers_equal(name, &l->name)) {
+            return i;
+        }
+    }
+
+    return -1;
 }
 
-static void call(bool canAssign) {
-    uint8_t argCount = argument_list();
-    emit_bytes(OP_CALL, argCount);
+static int add_upvalue(Compiler* comp, int index, bool isLocal, Token* name) {
+    int upvalueCount = comp->function->upvalueCount;
+    for (int i = 0; i < upvalueCount; i++) {
+        Upvalue* uv = &comp->upvalues[i];
+        if (uv->index == index && uv->isLocal == isLocal) {
+            return i;
+        }
+    }
+
+    if (upvalueCount == UINT24_COUNT) {
+        error_at(name, "Too many closure variables in function.");
+        return 0;
+    }
+    if (comp->upvalueCapacity < upvalueCount + 1) {
+        int oldCapacity = comp->upvalueCapacity;
+        comp->upvalueCapacity = GROW_CAPACITY(oldCapacity);
+        comp->upvalues = GROW_ARRAY(Upvalue, comp->upvalues, oldCapacity, comp->upvalueCapacity);
+    }
+    comp->upvalues[upvalueCount].isLocal = isLocal;
+    comp->upvalues[upvalueCount].index = index;
+    return comp->function->upvalueCount++;
+}
+
+static int resolve_upvalue(Compiler* comp, Token* name) {
+    if (comp->enclosing == NULL) return -1;
+
+    int local = resolve_local(comp->enclosing, name);
+    if (local != -1) {
+        comp->enclosing->locals[local].isCaptured = true;
+        return add_upvalue(comp, local, true, name);
+    }
+
+    int uv = resolve_upvalue(comp->enclosing, name);
+    if (uv != -1) {
+        return add_upvalue(comp, uv, false, name);
+    }
+
+    return -1;
+}
+
+// @Note: the parser has already rejected a name declared twice in one scope
+static void declare_variable(Token* name) {
+    if (current->scopeDepth == 0) return;
+    add_local(*name);
+}
+
+static int parse_variable(Token* name) {
+    declare_variable(name);
+    if (current->scopeDepth > 0) return 0;
+    return identifier_global(name);
+}
+
+static void mark_initialized() {
+    if (current->scopeDepth == 0) {
+        return;
+    }
+    current->locals[current->localCount - 1].depth = current->scopeDepth;
+}
+
+static void define_variable(int global) {
+    if (current->scopeDepth > 0){
+        mark_initialized();
+        return;
+    }
+    emit_operand(OP_DEFINE_GLOBAL, global);
 }
 
 static int make_constant(Value value) {
-    return add_constant(current_chunk(), value);
+    int idx = add_constant_unique(current_chunk(), &current->constants, value);
+    gc_write_barrier((Obj*)current->function, value);
+    return idx;
     // return (uint8_t)constant.pos;
 }
 
 static void emit_constant(Value value) {
-    emit_constant_bytes(make_constant(value));
+    emit_operand(OP_CONSTANT, make_constant(value));
 }
 
 // Old implementation:
@@ -686,136 +856,739 @@ static void emit_constant(Value value) {
 //   emitBytes(OP_CONSTANT, makeConstant(value)); // @Closed: differentiate between constant, constant_long
 // }
 
-static void number(bool canAssign) {
-    double value = strtod(parser.previous.start, NULL);
-    emit_constant(NUMBER_VAL(value));
+static void gen_logical(BinaryExpr* expr) {
+    gen_expr(expr->left);
+    current->line = expr->base.token.line;
+    if (expr->base.token.type == TOKEN_AND) {
+        int endJump = emit_jump(OP_JUMP_IF_FALSE); // If the left side is false, we know that we can ignore the rest
+        emit_byte(OP_POP);
+        gen_expr(expr->right);
+        patch_jump(endJump, &expr->base.token);
+    } else {
+        int elseJump = emit_jump(OP_JUMP_IF_FALSE);
+        int endJump = emit_jump(OP_JUMP);
+
+        patch_jump(elseJump, &expr->base.token);
+        emit_byte(OP_POP);
+
+        gen_expr(expr->right);
+        patch_jump(endJump, &expr->base.token);
+    }
 }
 
-static void literal(bool canAssign) {
-    switch (parser.previous.type) {
-        case TOKEN_FALSE: emit_byte(OP_FALSE); return;
-        case TOKEN_TRUE: emit_byte(OP_TRUE); return;
-        case TOKEN_NIL: emit_byte(OP_NIL); return;
+static void gen_binary(BinaryExpr* expr) {
+    gen_expr(expr->left);
+    gen_expr(expr->right);
+    current->line = expr->base.token.line;
+
+    switch (expr->base.token.type) {
+        case TOKEN_PLUS: emit_byte(OP_ADD); break;
+        case TOKEN_MINUS: emit_byte(OP_SUBSTRACT); break;
+        case TOKEN_STAR: emit_byte(OP_MULTIPLY); break;
+        case TOKEN_SLASH: emit_byte(OP_DIVIDE); break;
+        case TOKEN_BANG_EQ: emit_bytes(OP_EQ, OP_NOT); break;
+        case TOKEN_EQ_EQ: emit_byte(OP_EQ); break;
+        case TOKEN_GREATER: emit_byte(OP_GREATER); break;
+        case TOKEN_GEQ: emit_bytes(OP_LESS, OP_NOT); break;
+        case TOKEN_LESS: emit_byte(OP_LESS); break;
+        case TOKEN_LEQ: emit_bytes(OP_GREATER, OP_NOT); break;
         default: return;
     }
 }
 
-static void string(bool canAssign) {
-    emit_constant(OBJ_VAL(copy_string(parser.previous.start + 1, parser.previous.length - 2)));
+static void gen_call(CallExpr* expr) {
+    gen_expr(expr->callee);
+    for (int i = 0; i < expr->argCount; i++) {
+        gen_expr(expr->args[i]);
+    }
+    current->line = expr->base.token.line;
+    emit_bytes(OP_CALL, (uint8_t)expr->argCount);
+    current->lastCall = current_chunk()->count - 2;
 }
 
-static void named_variable(Token name, bool canAssign) {
+// @Note: reads the variable, or stores `value` into it when there is one
+static void gen_variable(Token* name, Expr* value) {
     uint8_t getOp, setOp;
-    int arg = resolve_local(current, &name);
+    int arg = resolve_local(current, name);
     if (arg != -1) {
-        // @Cleanup. This is a mess because of 8 Bit local variables. Maybe just make them LONG
         getOp = OP_GET_LOCAL;
         setOp = OP_SET_LOCAL;
-        if (canAssign && match(TOKEN_EQ)) {
-            expression();
-            emit_bytes(setOp, arg);
-        } else {
-            emit_bytes(getOp, arg);
-        }
-    } else if ((arg = resolve_upvalue(current, &name)) != -1) {
-        // @Cleanup. This is a mess because of 8 Bit local variables. Not AS important
+    } else if ((arg = resolve_upvalue(current, name)) != -1) {
         getOp = OP_GET_UPVALUE;
         setOp = OP_SET_UPVALUE;
-        if (canAssign && match(TOKEN_EQ)) {
-            expression();
-            emit_bytes(setOp, arg);
+    } else {
+        arg = identifier_global(name);
+        getOp = OP_GET_GLOBAL;
+        setOp = OP_SET_GLOBAL;
+    }
+    if (value != NULL) {
+        gen_expr(value);
+        current->line = name->line;
+        emit_operand(setOp, arg);
+    } else {
+        emit_operand(getOp, arg);
+    }
+}
+
+// @Note: an expression leaves one value on top of what was there, its operands are pushed above that first
+static void gen_expr(Expr* expr) {
+    int temps = current->temps;
+    current->line = expr->token.line;
+    switch (expr->type) {
+        case EXPR_NUMBER: emit_constant(NUMBER_VAL(((NumberExpr*)expr)->value)); break;
+        case EXPR_STRING: {
+            StringExpr* string = (StringExpr*)expr;
+            emit_constant(OBJ_VAL(copy_string(string->chars, string->length)));
+            break;
+        }
+        case EXPR_LITERAL:
+            switch (expr->token.type) {
+                case TOKEN_FALSE: emit_byte(OP_FALSE); break;
+                case TOKEN_TRUE: emit_byte(OP_TRUE); break;
+                case TOKEN_NIL: emit_byte(OP_NIL); break;
+                default: break;
+            }
+            break;
+        case EXPR_UNARY: {
+            gen_expr(((UnaryExpr*)expr)->operand);
+            current->line = expr->token.line;
+            switch (expr->token.type) {
+                case TOKEN_MINUS: emit_byte(OP_NEGATE); break;
+                case TOKEN_BANG: emit_byte(OP_NOT); break;
+                default: break;
+            }
+            break;
+        }
+        case EXPR_BINARY: gen_binary((BinaryExpr*)expr); break;
+        case EXPR_LOGICAL: gen_logical((BinaryExpr*)expr); break;
+        case EXPR_VARIABLE: gen_variable(&expr->token, NULL); break;
+        case EXPR_ASSIGN: gen_variable(&expr->token, ((AssignExpr*)expr)->value); break;
+        case EXPR_CALL: gen_call((CallExpr*)expr); break;
+    }
+    current->temps = temps + 1;
+    note_stack(current->temps);
+}
+
+static void gen_body(StmtList* body) {
+    for (int i = 0; i < body->count; i++) {
+        gen_stmt(body->items[i]);
+    }
+}
+
+// @Note: forward jumps are written short before their distance is known. When one of them
+// comes out too far the function is thrown away and generated again from the tree with all of
+// them wide, which only functions of more than 64K of bytecode ever pay for. The register tier
+// has no wide forms at all, a function that outgrows it is generated again for the stack tier.
+// A second try says nothing the first one has not said already.
+static ObjFunction* gen_code(Compiler* compiler, FunctionType type, FunStmt* stmt, StmtList* body, int endLine) {
+    bool hadError = parser.hadError;
+    bool registers = vm.tier == TIER_REGISTER;
+    bool wideJumps = false;
+    for (;;) {
+        init_compiler(compiler, type, stmt != NULL ? &stmt->base.token : NULL);
+        compiler->wideJumps = wideJumps;
+        compiler->registers = registers;
+        if (stmt != NULL) {
+            begin_scope(); // No need to end this, since the compiler just "ends" itself.
+            for (int i = 0; i < stmt->arity; i++) {
+                current->function->arity++;
+                define_variable(parse_variable(&stmt->params[i]));
+            }
+        }
+        if (registers) {
+            compiler->regTop = compiler->localCount;
+            compiler->function->registers = compiler->localCount;
+        }
+        gen_body(body);
+        current->line = endLine;
+
+        bool overflow = compiler->jumpOverflow || compiler->registerOverflow;
+        if (!overflow || parser.hadError != hadError) {
+            return end_compiler();
+        }
+        current = compiler->enclosing;
+        free_compiler(compiler);
+        if (registers) {
+            registers = false;
         } else {
-            emit_bytes(getOp, arg);
+            wideJumps = true;
         }
     }
-    else {
-        int arg = identifier_constant(&name);
-        getOp = OP_GET_GLOBAL;
-        setOp = OP_SET_GLOBAL;
-        if (canAssign && match(TOKEN_EQ)) {
-            expression();
-            emit_long_bytes(setOp, (uint8_t) (arg & 0xff), (uint8_t) ((arg >> 8) & 0xff), ((arg >> 16) & 0xff));
+}
+
+// @Note: the register tier writes the closure to reg, the stack tier pushes it
+static void gen_function(FunStmt* stmt, FunctionType type, int reg) {
+    Compiler compiler;
+    ObjFunction* func = gen_code(&compiler, type, stmt, &stmt->body, stmt->end.line);
+    current->line = stmt->end.line;
+
+    int constant = make_constant(OBJ_VAL(func));
+    if (current->registers) {
+        emit_bytes(OP_R_CLOSURE, reg_byte(reg));
+        emit_byte(reg_byte(constant));
+        for (int i = 0; i < func->upvalueCount; i++) {
+            emit_byte(compiler.upvalues[i].isLocal ? 1 : 0);
+            emit_byte(reg_byte(compiler.upvalues[i].index));
+        }
+        free_compiler(&compiler);
+        return;
+    }
+    note_stack(current->temps + 1);
+    bool wide = constant >= UINT8_COUNT;
+    for (int i = 0; i < func->upvalueCount; i++) {
+        if (compiler.upvalues[i].index >= UINT8_COUNT) wide = true;
+    }
+    if (wide) {
+        emit_bytes(OP_WIDE, OP_CLOSURE);
+        emit_long(constant);
+    } else {
+        emit_bytes(OP_CLOSURE, constant);
+    }
+    for (int i = 0; i < func->upvalueCount; i++) {
+        emit_byte(compiler.upvalues[i].isLocal ? 1 : 0);
+        if (wide) {
+            emit_long(compiler.upvalues[i].index);
         } else {
-            emit_long_bytes(getOp, (uint8_t) (arg & 0xff), (uint8_t) ((arg >> 8) & 0xff), ((arg >> 16) & 0xff));
+            emit_byte(compiler.upvalues[i].index);
         }
     }
+    free_compiler(&compiler);
 }
 
-static void variable(bool canAssign) {
-    named_variable(parser.previous, canAssign);
+static void gen_let(LetStmt* stmt) {
+    int global = parse_variable(&stmt->base.token);
+    if (stmt->init != NULL) {
+        gen_expr(stmt->init);
+    } else {
+        emit_byte(OP_NIL);
+    }
+    define_variable(global);
 }
 
-ParseRule rules[] = {
-    [TOKEN_LEFT_PAREN] = {grouping, call, PREC_CALL},
-    [TOKEN_RIGHT_PAREN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_LEFT_BRACE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_RIGHT_BRACE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_COMMA] = {NULL, NULL, PREC_NONE},
-    [TOKEN_DOT] = {NULL, NULL, PREC_NONE},
-    [TOKEN_MINUS] = {unary, binary, PREC_TERM},
-    [TOKEN_PLUS] = {NULL, binary, PREC_TERM},
-    [TOKEN_SEMICOLON] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SLASH] = {NULL, binary, PREC_FACTOR},
-    [TOKEN_STAR] = {NULL, binary, PREC_FACTOR},
-    [TOKEN_BANG] = {unary, NULL, PREC_NONE},
-    [TOKEN_BANG_EQ] = {NULL, binary, PREC_EQ},
-    [TOKEN_EQ] = {NULL, NULL, PREC_NONE},
-    [TOKEN_EQ_EQ] = {NULL, binary, PREC_EQ},
-    [TOKEN_GREATER] = {NULL, binary, PREC_COMPARE},
-    [TOKEN_GEQ] = {NULL, binary, PREC_COMPARE},
-    [TOKEN_LESS] = {NULL, binary, PREC_COMPARE},
-    [TOKEN_LEQ] = {NULL, binary, PREC_COMPARE},
-    [TOKEN_IDENTIFIER] = {variable, NULL, PREC_NONE},
-    [TOKEN_STRING] = {string, NULL, PREC_NONE},
-    [TOKEN_NUMBER] = {number, NULL, PREC_NONE},
-    [TOKEN_AND] = {NULL, and_, PREC_AND},
-    [TOKEN_CLASS] = {NULL, NULL, PREC_NONE},
-    [TOKEN_ELSE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_FALSE] = {literal, NULL, PREC_NONE},
-    [TOKEN_FOR] = {NULL, NULL, PREC_NONE},
-    [TOKEN_FUN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_IF] = {NULL, NULL, PREC_NONE},
-    [TOKEN_NIL] = {literal, NULL, PREC_NONE},
-    [TOKEN_OR] = {NULL, or_, PREC_OR},
-    [TOKEN_PRINT] = {NULL, NULL, PREC_NONE},
-    [TOKEN_RETURN] = {NULL, NULL, PREC_NONE},
-    [TOKEN_SUPER] = {NULL, NULL, PREC_NONE},
-    [TOKEN_THIS] = {NULL, NULL, PREC_NONE},
-    [TOKEN_TRUE] = {literal, NULL, PREC_NONE},
-    [TOKEN_LET] = {NULL, NULL, PREC_NONE},
-    [TOKEN_WHILE] = {NULL, NULL, PREC_NONE},
-    [TOKEN_ERROR] = {NULL, NULL, PREC_NONE},
-    [TOKEN_EOF] = {NULL, NULL, PREC_NONE},
-};
+static void gen_if(IfStmt* stmt) {
+    gen_expr(stmt->condition);
+    current->line = stmt->base.token.line;
 
-static ParseRule* get_rule(TokenType type) {
-    return &rules[type];
+    int thenJump = emit_jump(OP_JUMP_IF_FALSE);
+    emit_byte(OP_POP);
+    if (stmt->thenBranch != NULL) gen_stmt(stmt->thenBranch);
+    int elseJump = emit_jump(OP_JUMP);
+    patch_jump(thenJump, &stmt->base.token); // We need to set the location of the jump, which was set to a default val
+    emit_byte(OP_POP);
+    if (stmt->elseBranch != NULL) gen_stmt(stmt->elseBranch);
+    patch_jump(elseJump, &stmt->base.token); // We need to set the location of the jump, which was set to a default val
+}
+
+static void gen_while(WhileStmt* stmt) {
+    int loopStart = current_chunk()->count;
+    int exitJump = -1;
+    if (stmt->condition != NULL) {
+        gen_expr(stmt->condition);
+        exitJump = emit_jump(OP_JUMP_IF_FALSE);
+        emit_byte(OP_POP);
+    }
+    if (stmt->body != NULL) gen_stmt(stmt->body);
+    current->line = stmt->base.token.line;
+    emit_loop(loopStart, &stmt->base.token);
+
+    if (exitJump != -1) {
+        patch_jump(exitJump, &stmt->base.token);
+        emit_byte(OP_POP);
+    }
+}
+
+static void gen_for(ForStmt* stmt) {
+    begin_scope();
+    if (stmt->init != NULL) gen_stmt(stmt->init);
+
+    int loopStart = current_chunk()->count;
+    int exitJump = -1;
+    if (stmt->condition != NULL) {
+        gen_expr(stmt->condition);
+        exitJump = emit_jump(OP_JUMP_IF_FALSE);
+        emit_byte(OP_POP);
+    }
+
+    if (stmt->increment != NULL) {
+        int bodyJump = emit_jump(OP_JUMP);
+        int incrementStart = current_chunk()->count;
+        gen_expr(stmt->increment);
+        emit_byte(OP_POP);
+
+        emit_loop(loopStart, &stmt->base.token);
+        loopStart = incrementStart;
+        patch_jump(bodyJump, &stmt->base.token);
+    }
+
+    if (stmt->body != NULL) gen_stmt(stmt->body);
+    current->line = stmt->base.token.line;
+    emit_loop(loopStart, &stmt->base.token);
+    if (exitJump != -1) {
+        patch_jump(exitJump, &stmt->base.token);
+        emit_byte(OP_POP);
+    }
+    end_scope();
+}
+
+static void gen_return(ReturnStmt* stmt) {
+    if (stmt->value == NULL) {
+        emit_return();
+        return;
+    }
+    gen_expr(stmt->value);
+    if (current->lastCall != -1 && current->lastCall == current_chunk()->count - 2) {
+        // @Note: the call is the last thing the return value does, so it can reuse our frame.
+        // OP_RETURN stays behind it for callees that are not closures (natives).
+        current_chunk()->code[current->lastCall] = OP_TAIL_CALL;
+    }
+    emit_byte(OP_RETURN);
+}
+
+// Register tier, the same tree for instructions that name the slots of the frame
+
+// @Note: the locals keep the slots the stack tier gives them, so upvalues and calls work the same
+// in both tiers. Temporaries are taken from regTop up and given back once the expression that
+// needed them is done. An expression writes its destination with its last instruction only, so
+// `x = x + 1` can read and write x in the same ADD.
+
+static void reg_expr(Expr* expr, int dst);
+
+static int use_register(int reg) {
+    reg_byte(reg);
+    if (reg >= current->function->registers) current->function->registers = reg + 1;
+    return reg;
+}
+
+static int reg_alloc() {
+    return use_register(current->regTop++);
+}
+
+// @Note: nothing reads these before they are written, a temporary or a local still in its initializer
+static bool reg_scratch(int reg) {
+    return reg >= current->localCount || current->locals[reg].depth == -1;
+}
+
+// @Note: whether evaluating expr could change a local, by assigning it or through a closure it calls
+static bool has_effects(Expr* expr) {
+    switch (expr->type) {
+        case EXPR_ASSIGN:
+        case EXPR_CALL: return true;
+        case EXPR_UNARY: return has_effects(((UnaryExpr*)expr)->operand);
+        case EXPR_BINARY:
+        case EXPR_LOGICAL: {
+            BinaryExpr* binary = (BinaryExpr*)expr;
+            return has_effects(binary->left) || has_effects(binary->right);
+        }
+        default: return false;
+    }
+}
+
+static int emit_jump_offset() {
+    emit_bytes(0xff, 0xff);
+    return current_chunk()->count - 2;
+}
+
+static void emit_move(int dst, int src) {
+    if (dst == src) return;
+    emit_bytes(OP_R_MOVE, reg_byte(dst));
+    emit_byte(reg_byte(src));
+}
+
+static uint8_t reg_binary_op(TokenType type) {
+    switch (type) {
+        case TOKEN_PLUS: return OP_R_ADD;
+        case TOKEN_MINUS: return OP_R_SUBSTRACT;
+        case TOKEN_STAR: return OP_R_MULTIPLY;
+        case TOKEN_SLASH: return OP_R_DIVIDE;
+        case TOKEN_EQ_EQ: return OP_R_EQ;
+        case TOKEN_BANG_EQ: return OP_R_NEQ;
+        case TOKEN_LESS: return OP_R_LESS;
+        case TOKEN_GREATER: return OP_R_GREATER;
+        case TOKEN_GEQ: return OP_R_GEQ;
+        default: return OP_R_LEQ;
+    }
+}
+
+// @Note: -1 for the operators that are not comparisons
+static int reg_compare_jump(TokenType type) {
+    switch (type) {
+        case TOKEN_EQ_EQ: return OP_R_JUMP_IF_NOT_EQ;
+        case TOKEN_BANG_EQ: return OP_R_JUMP_IF_NOT_NEQ;
+        case TOKEN_LESS: return OP_R_JUMP_IF_NOT_LESS;
+        case TOKEN_GREATER: return OP_R_JUMP_IF_NOT_GREATER;
+        case TOKEN_GEQ: return OP_R_JUMP_IF_NOT_GEQ;
+        case TOKEN_LEQ: return OP_R_JUMP_IF_NOT_LEQ;
+        default: return -1;
+    }
+}
+
+// @Note: the value goes into the pool before any byte is written, growing the chunk can collect
+static void reg_constant(int dst, Value value) {
+    int constant = make_constant(value);
+    emit_bytes(OP_R_CONSTANT, reg_byte(dst));
+    emit_byte(reg_byte(constant));
+}
+
+// @Note: a register holding the value of expr, the local's own when expr just reads one
+static int reg_register(Expr* expr) {
+    if (expr->type == EXPR_VARIABLE) {
+        int local = resolve_local(current, &expr->token);
+        if (local != -1) return use_register(local);
+    }
+    int reg = reg_alloc();
+    reg_expr(expr, reg);
+    return reg;
+}
+
+// @Note: an RK operand for expr. Literals and locals are named in place when their index fits,
+// except a local that `later`, evaluated before the instruction runs, could still change.
+static int reg_operand(Expr* expr, Expr* later) {
+    int constant = -1;
+    if (expr->type == EXPR_NUMBER) {
+        constant = make_constant(NUMBER_VAL(((NumberExpr*)expr)->value));
+    } else if (expr->type == EXPR_STRING) {
+        StringExpr* string = (StringExpr*)expr;
+        constant = make_constant(OBJ_VAL(copy_string(string->chars, string->length)));
+    }
+    if (constant != -1 && constant < RK_CONSTANT) return constant | RK_CONSTANT;
+
+    if (expr->type == EXPR_VARIABLE && (later == NULL || !has_effects(later))) {
+        int local = resolve_local(current, &expr->token);
+        if (local != -1 && local < RK_CONSTANT) return local;
+    }
+    int reg = reg_alloc();
+    if (reg >= RK_CONSTANT) current->registerOverflow = true;
+    reg_expr(expr, reg);
+    return reg;
+}
+
+static void reg_binary(BinaryExpr* expr, int dst) {
+    int top = current->regTop;
+    int b = reg_operand(expr->left, expr->right);
+    int c = reg_operand(expr->right, NULL);
+    current->line = expr->base.token.line;
+    emit_bytes(reg_binary_op(expr->base.token.type), reg_byte(dst));
+    emit_bytes(b, c);
+    current->regTop = top;
+}
+
+static void reg_logical(BinaryExpr* expr, int dst) {
+    // @Note: the left side lands in dst before the right one runs, which may still read a live local
+    if (!reg_scratch(dst)) {
+        int top = current->regTop;
+        int reg = reg_alloc();
+        reg_logical(expr, reg);
+        emit_move(dst, reg);
+        current->regTop = top;
+        return;
+    }
+    reg_expr(expr->left, dst);
+    current->line = expr->base.token.line;
+    uint8_t jump = expr->base.token.type == TOKEN_AND ? OP_R_JUMP_IF_FALSE : OP_R_JUMP_IF_TRUE;
+    emit_bytes(jump, reg_byte(dst));
+    int endJump = emit_jump_offset();
+    reg_expr(expr->right, dst);
+    patch_jump(endJump, &expr->base.token);
+}
+
+// @Note: the callee and the arguments go to consecutive registers from the returned base, where
+// the result is left. dst is -1 when nothing wants the result.
+static int reg_call(CallExpr* expr, int dst, bool tail) {
+    int top = current->regTop;
+    int base = dst != -1 && dst == top - 1 && reg_scratch(dst) ? dst : reg_alloc();
+    reg_expr(expr->callee, base);
+    for (int i = 0; i < expr->argCount; i++) {
+        reg_expr(expr->args[i], reg_alloc());
+    }
+    current->line = expr->base.token.line;
+    emit_bytes(tail ? OP_R_TAIL_CALL : OP_R_CALL, reg_byte(base));
+    emit_byte((uint8_t)expr->argCount);
+    if (dst != -1) emit_move(dst, base);
+    current->regTop = top;
+    return base;
+}
+
+// @Note: reads the variable into dst, or stores `value` into it and copies that to dst unless it is -1
+static void reg_variable(Token* name, Expr* value, int dst) {
+    int arg = resolve_local(current, name);
+    if (arg != -1) {
+        if (value != NULL) reg_expr(value, use_register(arg));
+        if (dst != -1) emit_move(dst, arg);
+        return;
+    }
+
+    uint8_t getOp, setOp;
+    if ((arg = resolve_upvalue(current, name)) != -1) {
+        getOp = OP_R_GET_UPVALUE;
+        setOp = OP_R_SET_UPVALUE;
+    } else {
+        arg = identifier_global(name);
+        getOp = OP_R_GET_GLOBAL;
+        setOp = OP_R_SET_GLOBAL;
+    }
+    if (value == NULL) {
+        emit_bytes(getOp, reg_byte(dst));
+        emit_byte(reg_byte(arg));
+        return;
+    }
+    int top = current->regTop;
+    int src = reg_register(value);
+    current->line = name->line;
+    emit_bytes(setOp, reg_byte(src));
+    emit_byte(reg_byte(arg));
+    if (dst != -1) emit_move(dst, src);
+    current->regTop = top;
+}
+
+static void reg_expr(Expr* expr, int dst) {
+    current->line = expr->token.line;
+    switch (expr->type) {
+        case EXPR_NUMBER: reg_constant(dst, NUMBER_VAL(((NumberExpr*)expr)->value)); break;
+        case EXPR_STRING: {
+            StringExpr* string = (StringExpr*)expr;
+            reg_constant(dst, OBJ_VAL(copy_string(string->chars, string->length)));
+            break;
+        }
+        case EXPR_LITERAL:
+            switch (expr->token.type) {
+                case TOKEN_FALSE: emit_bytes(OP_R_FALSE, reg_byte(dst)); break;
+                case TOKEN_TRUE: emit_bytes(OP_R_TRUE, reg_byte(dst)); break;
+                case TOKEN_NIL: emit_bytes(OP_R_NIL, reg_byte(dst)); break;
+                default: break;
+            }
+            break;
+        case EXPR_UNARY: {
+            int top = current->regTop;
+            int operand = reg_register(((UnaryExpr*)expr)->operand);
+            current->line = expr->token.line;
+            emit_bytes(expr->token.type == TOKEN_MINUS ? OP_R_NEGATE : OP_R_NOT, reg_byte(dst));
+            emit_byte(reg_byte(operand));
+            current->regTop = top;
+            break;
+        }
+        case EXPR_BINARY: reg_binary((BinaryExpr*)expr, dst); break;
+        case EXPR_LOGICAL: reg_logical((BinaryExpr*)expr, dst); break;
+        case EXPR_VARIABLE: reg_variable(&expr->token, NULL, dst); break;
+        case EXPR_ASSIGN: reg_variable(&expr->token, ((AssignExpr*)expr)->value, dst); break;
+        case EXPR_CALL: reg_call((CallExpr*)expr, dst, false); break;
+    }
+}
+
+// @Note: an expression statement, assignments and calls leave their result where it is
+static void reg_discard(Expr* expr) {
+    int top = current->regTop;
+    current->line = expr->token.line;
+    switch (expr->type) {
+        case EXPR_ASSIGN: reg_variable(&expr->token, ((AssignExpr*)expr)->value, -1); break;
+        case EXPR_CALL: reg_call((CallExpr*)expr, -1, false); break;
+        default: reg_register(expr); break;
+    }
+    current->regTop = top;
+}
+
+// @Note: returns the jump to patch, taken when the condition is false. A comparison jumps on its
+// operands instead of writing a boolean to test.
+static int reg_condition(Expr* condition) {
+    int top = current->regTop;
+    int jump = condition->type == EXPR_BINARY ? reg_compare_jump(condition->token.type) : -1;
+    if (jump != -1) {
+        BinaryExpr* compare = (BinaryExpr*)condition;
+        int b = reg_operand(compare->left, compare->right);
+        int c = reg_operand(compare->right, NULL);
+        current->line = condition->token.line;
+        emit_byte((uint8_t)jump);
+        emit_bytes(b, c);
+    } else {
+        emit_bytes(OP_R_JUMP_IF_FALSE, reg_byte(reg_register(condition)));
+    }
+    current->regTop = top;
+    return emit_jump_offset();
+}
+
+static void reg_define_global(int reg, int global) {
+    emit_bytes(OP_R_DEFINE_GLOBAL, reg_byte(reg));
+    emit_byte(reg_byte(global));
+}
+
+static void reg_let(LetStmt* stmt) {
+    int global = parse_variable(&stmt->base.token);
+    bool local = current->scopeDepth > 0;
+    int reg = local ? use_register(current->localCount - 1) : reg_alloc();
+    if (local) current->regTop = current->localCount;
+    if (stmt->init != NULL) {
+        reg_expr(stmt->init, reg);
+    } else {
+        emit_bytes(OP_R_NIL, reg_byte(reg));
+    }
+    if (local) {
+        mark_initialized();
+    } else {
+        reg_define_global(reg, global);
+    }
+}
+
+static void reg_if(IfStmt* stmt) {
+    int thenJump = reg_condition(stmt->condition);
+    if (stmt->thenBranch != NULL) gen_stmt(stmt->thenBranch);
+    if (stmt->elseBranch == NULL) {
+        patch_jump(thenJump, &stmt->base.token);
+        return;
+    }
+    current->line = stmt->base.token.line;
+    int elseJump = emit_jump(OP_JUMP);
+    patch_jump(thenJump, &stmt->base.token);
+    gen_stmt(stmt->elseBranch);
+    patch_jump(elseJump, &stmt->base.token);
+}
+
+static void reg_while(WhileStmt* stmt) {
+    int loopStart = current_chunk()->count;
+    int exitJump = stmt->condition != NULL ? reg_condition(stmt->condition) : -1;
+    if (stmt->body != NULL) gen_stmt(stmt->body);
+    current->line = stmt->base.token.line;
+    emit_loop(loopStart, &stmt->base.token);
+    if (exitJump != -1) patch_jump(exitJump, &stmt->base.token);
+}
+
+static void reg_for(ForStmt* stmt) {
+    begin_scope();
+    if (stmt->init != NULL) gen_stmt(stmt->init);
+
+    int loopStart = current_chunk()->count;
+    int exitJump = stmt->condition != NULL ? reg_condition(stmt->condition) : -1;
+    if (stmt->increment != NULL) {
+        int bodyJump = emit_jump(OP_JUMP);
+        int incrementStart = current_chunk()->count;
+        reg_discard(stmt->increment);
+        emit_loop(loopStart, &stmt->base.token);
+        loopStart = incrementStart;
+        patch_jump(bodyJump, &stmt->base.token);
+    }
+
+    if (stmt->body != NULL) gen_stmt(stmt->body);
+    current->line = stmt->base.token.line;
+    emit_loop(loopStart, &stmt->base.token);
+    if (exitJump != -1) patch_jump(exitJump, &stmt->base.token);
+    end_scope();
+}
+
+static void reg_return(ReturnStmt* stmt) {
+    if (stmt->value == NULL) {
+        emit_return();
+        return;
+    }
+    // @Note: R_RETURN stays behind a tail call for callees that are not closures (natives)
+    int reg;
+    if (stmt->value->type == EXPR_CALL) {
+        reg = reg_call((CallExpr*)stmt->value, -1, true);
+    } else {
+        reg = reg_register(stmt->value);
+    }
+    emit_bytes(OP_R_RETURN, reg_byte(reg));
+}
+
+static void reg_stmt(Stmt* stmt) {
+    current->regTop = current->localCount;
+    switch (stmt->type) {
+        case STMT_EXPRESSION: reg_discard(((ExprStmt*)stmt)->expr); break;
+        case STMT_PRINT: {
+            int reg = reg_register(((ExprStmt*)stmt)->expr);
+            current->line = stmt->token.line;
+            emit_bytes(OP_R_PRINT, reg_byte(reg));
+            break;
+        }
+        case STMT_LET: reg_let((LetStmt*)stmt); break;
+        case STMT_FUN: {
+            int global = parse_variable(&stmt->token);
+            mark_initialized();
+            bool local = current->scopeDepth > 0;
+            int reg = local ? use_register(current->localCount - 1) : reg_alloc();
+            gen_function((FunStmt*)stmt, TYPE_FUNCTION, reg);
+            if (!local) reg_define_global(reg, global);
+            break;
+        }
+        case STMT_BLOCK:
+            begin_scope();
+            gen_body(&((BlockStmt*)stmt)->body);
+            current->line = stmt->token.line;
+            end_scope();
+            break;
+        case STMT_IF: reg_if((IfStmt*)stmt); break;
+        case STMT_WHILE: reg_while((WhileStmt*)stmt); break;
+        case STMT_FOR: reg_for((ForStmt*)stmt); break;
+        case STMT_RETURN: reg_return((ReturnStmt*)stmt); break;
+    }
+    current->regTop = current->localCount;
+}
+
+static void gen_stmt(Stmt* stmt) {
+    // @Note: one error per statement, like the parser reports one per declaration
+    parser.panicMode = false;
+    current->line = stmt->token.line;
+    current->temps = 0;
+    if (current->registers) {
+        reg_stmt(stmt);
+        return;
+    }
+    switch (stmt->type) {
+        case STMT_EXPRESSION:
+            gen_expr(((ExprStmt*)stmt)->expr);
+            current->line = stmt->token.line;
+            emit_byte(OP_POP);
+            break;
+        case STMT_PRINT:
+            gen_expr(((ExprStmt*)stmt)->expr);
+            current->line = stmt->token.line;
+            emit_byte(OP_PRINT);
+            break;
+        case STMT_LET: gen_let((LetStmt*)stmt); break;
+        case STMT_FUN: {
+            int global = parse_variable(&stmt->token);
+            mark_initialized();
+            gen_function((FunStmt*)stmt, TYPE_FUNCTION, 0);
+            define_variable(global);
+            break;
+        }
+        case STMT_BLOCK:
+            begin_scope();
+            gen_body(&((BlockStmt*)stmt)->body);
+            current->line = stmt->token.line;
+            end_scope();
+            break;
+        case STMT_IF: gen_if((IfStmt*)stmt); break;
+        case STMT_WHILE: gen_while((WhileStmt*)stmt); break;
+        case STMT_FOR: gen_for((ForStmt*)stmt); break;
+        case STMT_RETURN: gen_return((ReturnStmt*)stmt); break;
+    }
 }
 
 ObjFunction* compile(const char *source) {
     init_scanner(source);
-    Compiler compiler;
-    init_compiler(&compiler, TYPE_SCRIPT);
     parser.hadError = false;
     parser.panicMode = false;
+    scopes.type = TYPE_SCRIPT;
+    scopes.base = 0;
+    scopes.depth = 0;
+    scopes.localCount = 0;
+    StmtList program = {0, 0, NULL};
     advance();
     while (!match(TOKEN_EOF)) {
-        declaration();
+        stmt_list_add(&program, declaration());
     }
-    ObjFunction* func = end_compiler();
+    FREE_ARRAY(Local, scopes.locals, scopes.localCapacity);
+    scopes.locals = NULL;
+    scopes.localCapacity = 0;
+    if (parser.hadError) {
+        ast_free();
+        return NULL;
+    }
+
+    optimize(&program);
+    Compiler compiler;
+    ObjFunction* func = gen_code(&compiler, TYPE_SCRIPT, NULL, &program, parser.previous.line);
+    free_compiler(&compiler);
+    ast_free();
     return !parser.hadError ? func : NULL;
-    // int line = -1;
-    // for (;;) {
-    //     Token token = scan_token();
-    //     if (token.line != line) {
-    //         printf("%4d ", token.line);
-    //         line = token.line;
-    //     } else {
-    //         printf("   | ");
-    //     }
-    //     printf("%2d '%.*s'\n", token.type, token.length, token.start);
-    //     if (token.type == TOKEN_EOF) break;
-    // }
 }
 
 void mark_compiler_roots() {
@@ -4,41 +4,220 @@
 #include "debug.h"
 #include "object.h"
 #include "value.h"
+#include "vm.h"
 
 static int simple_instruction(const char* name, int offset) {
     printf("%s\n", name);
     return offset + 1;
 }
 
-static int constant_instruction(const char* name, Chunk* chunk, int offset) {
-    uint8_t constant = chunk->code[offset + 1];
+// @Note: offset is the opcode, after OP_WIDE when there is one. A wide operand is three bytes, low byte first.
+static uint32_t read_operand(Chunk* chunk, int offset, bool wide) {
+    if (!wide) return chunk->code[offset + 1];
+    return chunk->code[offset + 1] |
+        (chunk->code[offset + 2] << 8) |
+        (chunk->code[offset + 3] << 16);
+}
+
+static int operand_end(int offset, bool wide) {
+    return offset + (wide ? 4 : 2);
+}
+
+static int constant_instruction(const char* name, Chunk* chunk, int offset, bool wide) {
+    uint32_t constant = read_operand(chunk, offset, wide);
     printf("%-16s %4d '", name, constant);
     print_value(chunk->constants.values[constant]);
     printf("'\n");
-    return offset + 2;
+    return operand_end(offset, wide);
 }
 
-static int long_constant_instruction(const char* name, Chunk* chunk, int offset) {
-    uint32_t constant = chunk->code[offset + 1] | 
-        (chunk->code[offset + 2] << 8) |
-        (chunk->code[offset + 3] << 16);
-    printf("%-16s %4d '", name, constant);
-    print_value(chunk->constants.values[constant]);
+static int global_instruction(const char* name, Chunk* chunk, int offset, bool wide) {
+    uint32_t slot = read_operand(chunk, offset, wide);
+    printf("%-16s %4d '", name, slot);
+    print_value(vm.globalNames.values[slot]);
     printf("'\n");
-    return offset + 4;
+    return operand_end(offset, wide);
 }
 
-static int byte_instruction(const char* name, Chunk* chunk, int offset) {
-    uint8_t slot = chunk->code[offset + 1];
+static int byte_instruction(const char* name, Chunk* chunk, int offset, bool wide) {
+    uint32_t slot = read_operand(chunk, offset, wide);
     printf("%-16s %4d\n", name, slot);
-    return offset + 2;
+    return operand_end(offset, wide);
 }
 
-static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset) {
-    uint16_t jump = (uint16_t) (chunk->code[offset + 1] << 8);
-    jump |= chunk->code[offset + 2];
-    printf("%-16s %4d -> %d\n", name, offset, offset + 3 + sign * jump);
-    return offset + 3;
+static int jump_instruction(const char* name, int sign, Chunk* chunk, int offset, bool wide) {
+    uint32_t jump;
+    int next;
+    if (wide) {
+        jump = read_operand(chunk, offset, true);
+        next = offset + 4;
+    } else {
+        jump = (uint16_t) (chunk->code[offset + 1] << 8);
+        jump |= chunk->code[offset + 2];
+        next = offset + 3;
+    }
+    printf("%-16s %4d -> %d\n", name, offset, next + sign * (int) jump);
+    return next;
+}
+
+static int closure_instruction(Chunk* chunk, int offset, bool wide) {
+    uint32_t constant = read_operand(chunk, offset, wide);
+    printf("%-16s %4d '", "OP_CLOSURE", constant);
+    print_value(chunk->constants.values[constant]);
+    printf("\n");
+    offset = operand_end(offset, wide);
+    ObjFunction* func = AS_FUNCTION(chunk->constants.values[constant]);
+    for (int j = 0; j < func->upvalueCount; j++) {
+        int isLocal = chunk->code[offset];
+        int idx = read_operand(chunk, offset, wide);
+        printf("%04d    |                                %s %d\n",
+               offset, isLocal ? "local" : "upvalue", idx);
+        offset = operand_end(offset, wide);
+    }
+    return offset;
+}
+
+// @Note: a register tier instruction, form has a letter per operand: r a register, x an RK operand,
+// k a constant, g a global, b a plain byte and j a two byte forward jump
+static int register_instruction(const char* name, const char* form, Chunk* chunk, int offset) {
+    printf("%-16s", name);
+    int at = offset + 1;
+    for (const char* kind = form; *kind != '\0'; kind++) {
+        uint8_t operand = chunk->code[at++];
+        switch (*kind) {
+            case 'r': printf(" r%d", operand); break;
+            case 'x':
+                if (!(operand & RK_CONSTANT)) {
+                    printf(" r%d", operand);
+                    break;
+                }
+                operand &= ~RK_CONSTANT;
+                // fallthrough
+            case 'k':
+                printf(" '");
+                print_value(chunk->constants.values[operand]);
+                printf("'");
+                break;
+            case 'g':
+                printf(" '");
+                print_value(vm.globalNames.values[operand]);
+                printf("'");
+                break;
+            case 'b': printf(" %d", operand); break;
+            case 'j': {
+                int jump = (operand << 8) | chunk->code[at++];
+                printf(" -> %d", at + jump);
+                break;
+            }
+        }
+    }
+    printf("\n");
+    return at;
+}
+
+static int register_closure_instruction(Chunk* chunk, int offset) {
+    int next = register_instruction("OP_R_CLOSURE", "rk", chunk, offset);
+    ObjFunction* func = AS_FUNCTION(chunk->constants.values[chunk->code[offset + 2]]);
+    for (int j = 0; j < func->upvalueCount; j++) {
+        printf("%04d    |                                %s %d\n",
+               next, chunk->code[next] ? "local" : "upvalue", chunk->code[next + 1]);
+        next += 2;
+    }
+    return next;
+}
+
+const char* opcode_name(uint8_t op) {
+    #define NAME(op) [op] = #op
+    static const char* names[UINT8_COUNT] = {
+        NAME(OP_CONSTANT),
+        NAME(OP_NIL),
+        NAME(OP_TRUE),
+        NAME(OP_FALSE),
+        NAME(OP_NOT),
+        NAME(OP_GREATER),
+        NAME(OP_LESS),
+        NAME(OP_EQ),
+        NAME(OP_GEQ),
+        NAME(OP_LEQ),
+        NAME(OP_NEQ),
+        NAME(OP_NEGATE),
+        NAME(OP_ADD),
+        NAME(OP_SUBSTRACT),
+        NAME(OP_MULTIPLY),
+        NAME(OP_DIVIDE),
+        NAME(OP_RETURN),
+        NAME(OP_PRINT),
+        NAME(OP_POP),
+        NAME(OP_DEFINE_GLOBAL),
+        NAME(OP_GET_GLOBAL),
+        NAME(OP_SET_GLOBAL),
+        NAME(OP_GET_LOCAL),
+        NAME(OP_SET_LOCAL),
+        NAME(OP_JUMP_IF_FALSE),
+        NAME(OP_JUMP),
+        NAME(OP_LOOP),
+        NAME(OP_CALL),
+        NAME(OP_TAIL_CALL),
+        NAME(OP_CLOSURE),
+        NAME(OP_SET_UPVALUE),
+        NAME(OP_GET_UPVALUE),
+        NAME(OP_CLOSE_UPVALUE),
+        NAME(OP_WIDE),
+        NAME(OP_JUMP_IF_NOT_EQ),
+        NAME(OP_JUMP_IF_NOT_NEQ),
+        NAME(OP_JUMP_IF_NOT_LESS),
+        NAME(OP_JUMP_IF_NOT_GREATER),
+        NAME(OP_JUMP_IF_NOT_GEQ),
+        NAME(OP_JUMP_IF_NOT_LEQ),
+        NAME(OP_ADD_NUM),
+        NAME(OP_ADD_STR),
+        NAME(OP_SUBSTRACT_NUM),
+        NAME(OP_MULTIPLY_NUM),
+        NAME(OP_DIVIDE_NUM),
+        NAME(OP_GREATER_NUM),
+        NAME(OP_LESS_NUM),
+        #define SUPER_NAME(name, ...) NAME(name),
+        SUPERINSTRUCTIONS(SUPER_NAME)
+        #undef SUPER_NAME
+        NAME(OP_R_CONSTANT),
+        NAME(OP_R_NIL),
+        NAME(OP_R_TRUE),
+        NAME(OP_R_FALSE),
+        NAME(OP_R_MOVE),
+        NAME(OP_R_DEFINE_GLOBAL),
+        NAME(OP_R_GET_GLOBAL),
+        NAME(OP_R_SET_GLOBAL),
+        NAME(OP_R_GET_UPVALUE),
+        NAME(OP_R_SET_UPVALUE),
+        NAME(OP_R_ADD),
+        NAME(OP_R_SUBSTRACT),
+        NAME(OP_R_MULTIPLY),
+        NAME(OP_R_DIVIDE),
+        NAME(OP_R_EQ),
+        NAME(OP_R_NEQ),
+        NAME(OP_R_LESS),
+        NAME(OP_R_GREATER),
+        NAME(OP_R_GEQ),
+        NAME(OP_R_LEQ),
+        NAME(OP_R_NEGATE),
+        NAME(OP_R_NOT),
+        NAME(OP_R_JUMP_IF_FALSE),
+        NAME(OP_R_JUMP_IF_TRUE),
+        NAME(OP_R_JUMP_IF_NOT_EQ),
+        NAME(OP_R_JUMP_IF_NOT_NEQ),
+        NAME(OP_R_JUMP_IF_NOT_LESS),
+        NAME(OP_R_JUMP_IF_NOT_GREATER),
+        NAME(OP_R_JUMP_IF_NOT_GEQ),
+        NAME(OP_R_JUMP_IF_NOT_LEQ),
+        NAME(OP_R_PRINT),
+        NAME(OP_R_CALL),
+        NAME(OP_R_TAIL_CALL),
+        NAME(OP_R_RETURN),
+        NAME(OP_R_CLOSURE),
+        NAME(OP_R_CLOSE_UPVALUE),
+    };
+    #undef NAME
+    return names[op];
 }
 
 int disassemble_instruction(Chunk *chunk, int offset) {
@@ -48,14 +227,17 @@ int disassemble_instruction(Chunk *chunk, int offset) {
     } else {
         printf("%04d ", chunk->lines[offset]);
     }
+    bool wide = chunk->code[offset] == OP_WIDE;
+    if (wide) {
+        printf("OP_WIDE ");
+        offset++;
+    }
     uint8_t instruction = chunk->code[offset];
     switch (instruction) {
     case OP_RETURN:
         return simple_instruction("OP_RETURN", offset);
-    // case OP_CONSTANT:
-    //     return constant_instruction("OP_CONSTANT", chunk, offset);
-    case OP_CONSTANT_LONG:
-        return long_constant_instruction("OP_CONSTANT_LONG", chunk, offset);
+    case OP_CONSTANT:
+        return constant_instruction("OP_CONSTANT", chunk, offset, wide);
     case OP_NEGATE:
         return simple_instruction("OP_NEGATE", offset);
     case OP_ADD:
@@ -80,6 +262,12 @@ int disassemble_instruction(Chunk *chunk, int offset) {
         return simple_instruction("OP_LESS", offset);
     case OP_EQ:
         return simple_instruction("OP_EQ", offset);
+    case OP_NEQ:
+        return simple_instruction("OP_NEQ", offset);
+    case OP_GEQ:
+        return simple_instruction("OP_GEQ", offset);
+    case OP_LEQ:
+        return simple_instruction("OP_LEQ", offset);
     case OP_PRINT:
         return simple_instruction("OP_PRINT", offset);
     case OP_POP:
@@ -87,44 +275,107 @@ int disassemble_instruction(Chunk *chunk, int offset) {
     case OP_CLOSE_UPVALUE:
         return simple_instruction("OP_CLOSE_UPVALUE", offset);
     case OP_DEFINE_GLOBAL:
-        return long_constant_instruction("OP_DEFINE_GLOBAL", chunk, offset);
+        return global_instruction("OP_DEFINE_GLOBAL", chunk, offset, wide);
     case OP_GET_GLOBAL:
-        return long_constant_instruction("OP_GET_GLOBAL", chunk, offset);
+        return global_instruction("OP_GET_GLOBAL", chunk, offset, wide);
     case OP_SET_GLOBAL:
-        return long_constant_instruction("OP_SET_GLOBAL", chunk, offset);
+        return global_instruction("OP_SET_GLOBAL", chunk, offset, wide);
     case OP_GET_LOCAL:
-        return byte_instruction("OP_GET_LOCAL", chunk, offset);
+        return byte_instruction("OP_GET_LOCAL", chunk, offset, wide);
     case OP_SET_LOCAL:
-        return byte_instruction("OP_SET_LOCAL", chunk, offset);
+        return byte_instruction("OP_SET_LOCAL", chunk, offset, wide);
     case OP_JUMP:
-        return jump_instruction("OP_JUMP", 1, chunk, offset);
+        return jump_instruction("OP_JUMP", 1, chunk, offset, wide);
     case OP_JUMP_IF_FALSE:
-        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset);
+        return jump_instruction("OP_JUMP_IF_FALSE", 1, chunk, offset, wide);
     case OP_LOOP:
-        return jump_instruction("OP_LOOP", -1, chunk, offset);
+        return jump_instruction("OP_LOOP", -1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_EQ:
+        return jump_instruction("OP_JUMP_IF_NOT_EQ", 1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_NEQ:
+        return jump_instruction("OP_JUMP_IF_NOT_NEQ", 1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_LESS:
+        return jump_instruction("OP_JUMP_IF_NOT_LESS", 1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_GREATER:
+        return jump_instruction("OP_JUMP_IF_NOT_GREATER", 1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_GEQ:
+        return jump_instruction("OP_JUMP_IF_NOT_GEQ", 1, chunk, offset, wide);
+    case OP_JUMP_IF_NOT_LEQ:
+        return jump_instruction("OP_JUMP_IF_NOT_LEQ", 1, chunk, offset, wide);
     case OP_CALL:
-        return byte_instruction("OP_CALL", chunk, offset);
+        return byte_instruction("OP_CALL", chunk, offset, wide);
+    case OP_TAIL_CALL:
+        return byte_instruction("OP_TAIL_CALL", chunk, offset, wide);
     case OP_GET_UPVALUE:
-        return byte_instruction("OP_GET_UPVALUE", chunk, offset);
+        return byte_instruction("OP_GET_UPVALUE", chunk, offset, wide);
     case OP_SET_UPVALUE:
-        return byte_instruction("OP_SET_UPVALUE", chunk, offset);
-    case OP_CLOSURE: {
-            // offset++;
-            uint32_t constant = chunk->code[offset + 1] | 
-                (chunk->code[offset + 2] << 8) |
-                (chunk->code[offset + 3] << 16);
-            printf("%-16s %4d '", "OP_CLOSURE", constant);
-            print_value(chunk->constants.values[constant]);
-            printf("\n");
-            ObjFunction* func = AS_FUNCTION(chunk->constants.values[constant]);
-            for (int j = 0; j < func->upvalueCount; j++) {
-                int isLocal = chunk->code[offset++];
-                int idx = chunk ->code[offset++];
-                printf("%04d    |                                %s %d\n",
-                       offset - 2, isLocal ? "local" : "upvalue", idx);
-            }
-            return offset+4; // + 2
-        }
+        return byte_instruction("OP_SET_UPVALUE", chunk, offset, wide);
+    case OP_ADD_NUM:
+        return simple_instruction("OP_ADD_NUM", offset);
+    case OP_ADD_STR:
+        return simple_instruction("OP_ADD_STR", offset);
+    case OP_SUBSTRACT_NUM:
+        return simple_instruction("OP_SUBSTRACT_NUM", offset);
+    case OP_MULTIPLY_NUM:
+        return simple_instruction("OP_MULTIPLY_NUM", offset);
+    case OP_DIVIDE_NUM:
+        return simple_instruction("OP_DIVIDE_NUM", offset);
+    case OP_GREATER_NUM:
+        return simple_instruction("OP_GREATER_NUM", offset);
+    case OP_LESS_NUM:
+        return simple_instruction("OP_LESS_NUM", offset);
+    case OP_CLOSURE:
+        return closure_instruction(chunk, offset, wide);
+    // @Note: only the first operand is the superinstruction's, the rest of its run follows as it was
+    #define SUPER_CASE(name, ...) case name:
+    SUPERINSTRUCTIONS(SUPER_CASE)
+    #undef SUPER_CASE
+        return byte_instruction(opcode_name(instruction), chunk, offset, wide);
+    case OP_R_NIL:
+    case OP_R_TRUE:
+    case OP_R_FALSE:
+    case OP_R_PRINT:
+    case OP_R_RETURN:
+    case OP_R_CLOSE_UPVALUE:
+        return register_instruction(opcode_name(instruction), "r", chunk, offset);
+    case OP_R_CONSTANT:
+        return register_instruction(opcode_name(instruction), "rk", chunk, offset);
+    case OP_R_MOVE:
+    case OP_R_NEGATE:
+    case OP_R_NOT:
+        return register_instruction(opcode_name(instruction), "rr", chunk, offset);
+    case OP_R_DEFINE_GLOBAL:
+    case OP_R_GET_GLOBAL:
+    case OP_R_SET_GLOBAL:
+        return register_instruction(opcode_name(instruction), "rg", chunk, offset);
+    case OP_R_GET_UPVALUE:
+    case OP_R_SET_UPVALUE:
+    case OP_R_CALL:
+    case OP_R_TAIL_CALL:
+        return register_instruction(opcode_name(instruction), "rb", chunk, offset);
+    case OP_R_ADD:
+    case OP_R_SUBSTRACT:
+    case OP_R_MULTIPLY:
+    case OP_R_DIVIDE:
+    case OP_R_EQ:
+    case OP_R_NEQ:
+    case OP_R_LESS:
+    case OP_R_GREATER:
+    case OP_R_GEQ:
+    case OP_R_LEQ:
+        return register_instruction(opcode_name(instruction), "rxx", chunk, offset);
+    case OP_R_JUMP_IF_FALSE:
+    case OP_R_JUMP_IF_TRUE:
+        return register_instruction(opcode_name(instruction), "rj", chunk, offset);
+    case OP_R_JUMP_IF_NOT_EQ:
+    case OP_R_JUMP_IF_NOT_NEQ:
+    case OP_R_JUMP_IF_NOT_LESS:
+    case OP_R_JUMP_IF_NOT_GREATER:
+    case OP_R_JUMP_IF_NOT_GEQ:
+    case OP_R_JUMP_IF_NOT_LEQ:
+        return register_instruction(opcode_name(instruction), "xxj", chunk, offset);
+    case OP_R_CLOSURE:
+        return register_closure_instruction(chunk, offset);
     default:
         printf("Unknown opcode %d\n", instruction);
         return offset + 1;
@@ -4,5 +4,7 @@
 #include "chunk.h"
 void disassemble_chunk(Chunk* chunk, const char* name);
 int disassemble_instruction(Chunk* chunk, int offset);
+// @Note: NULL for a byte that is no opcode
+const char* opcode_name(uint8_t op);
 
 #endif
@@ -0,0 +1,75 @@
+#ifndef comp_hash_h
+#define comp_hash_h
+
+#include <string.h>
+
+#include "common.h"
+
+// @Note: the string hash reads 16 bytes per round and folds each pair of words with a 64x64->128 bit
+// multiply, in the way of wyhash. Every string is hashed by hash_chars, whether the scanner or the
+// running program made it, so equal strings always get equal hashes. Both halves of the product end
+// up in the low bits, the table masks those.
+#define HASH_SEED 0x9e3779b97f4a7c15ull
+#define HASH_K1 0xa0761d6478bd642full
+#define HASH_K2 0xe7037ed1a0b428dbull
+
+// @Note: below this equality compares words inline, longer keys go to memcmp which is vectorised already
+#define CHARS_INLINE_LENGTH 16
+
+static inline uint64_t hash_mix(uint64_t a, uint64_t b) {
+	__uint128_t product = (__uint128_t)a * b;
+	return (uint64_t)product ^ (uint64_t)(product >> 64);
+}
+
+static inline uint64_t load_u64(const char* chars) {
+	uint64_t word;
+	memcpy(&word, chars, sizeof(word));
+	return word;
+}
+
+static inline uint64_t load_u32(const char* chars) {
+	uint32_t word;
+	memcpy(&word, chars, sizeof(word));
+	return word;
+}
+
+static inline uint32_t hash_chars(const char* chars, int length) {
+	uint64_t hash = HASH_SEED ^ (uint64_t)length;
+	int i = 0;
+	for (; i + 16 < length; i += 16) {
+		hash = hash_mix(load_u64(chars + i) ^ HASH_K1, load_u64(chars + i + 8) ^ hash);
+	}
+	// @Note: the last 1 to 16 bytes, read as two words that may overlap instead of byte by byte
+	int rest = length - i;
+	const char* tail = chars + i;
+	uint64_t a = 0;
+	uint64_t b = 0;
+	if (rest >= 8) {
+		a = load_u64(tail);
+		b = load_u64(tail + rest - 8);
+	} else if (rest >= 4) {
+		a = load_u32(tail);
+		b = load_u32(tail + rest - 4);
+	} else if (rest > 0) {
+		a = ((uint64_t)(uint8_t)tail[0] << 16) | ((uint64_t)(uint8_t)tail[rest / 2] << 8) | (uint8_t)tail[rest - 1];
+	}
+	hash = hash_mix(a ^ HASH_K1, b ^ hash);
+	hash = hash_mix(hash ^ HASH_K2, (uint64_t)length ^ HASH_K1);
+	return (uint32_t)(hash ^ (hash >> 32));
+}
+
+static inline bool chars_equal(const char* a, const char* b, int length) {
+	if (length > CHARS_INLINE_LENGTH) return memcmp(a, b, length) == 0;
+	if (length >= 8) {
+		return load_u64(a) == load_u64(b) && load_u64(a + length - 8) == load_u64(b + length - 8);
+	}
+	if (length >= 4) {
+		return load_u32(a) == load_u32(b) && load_u32(a + length - 4) == load_u32(b + length - 4);
+	}
+	for (int i = 0; i < length; i++) {
+		if (a[i] != b[i]) return false;
+	}
+	return true;
+}
+
+#endif // !comp_hash_h
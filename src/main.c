@@ -55,15 +55,148 @@ static void run_file(const char* path) {
     if (result == INTERPRET_RUNTIME_ERR) exit(70);
 }
 
+static void usage() {
+    fprintf(stderr, "Usage: comp [--trace=exec,gc,code] [--gc-incremental] [--gc-pause-budget=<microseconds>]\n"
+                    "            [--gc-threads=<count>] [--gc-report] [--gc-initial-heap=<bytes>]\n"
+                    "            [--gc-grow-factor=<factor>] [--gc-heap-limit=<bytes>] [--profile-ops=<path>]\n"
+                    "            [--tier=stack|register] [path]\n"
+                    "Sizes take a k, m or g suffix. The last three can also be set through COMP_GC_INITIAL_HEAP,\n"
+                    "COMP_GC_GROW_FACTOR and COMP_GC_HEAP_LIMIT, the command line wins.\n"
+                    "--profile-ops adds the straight-line opcode sequences the program ran to the counts in path.\n"
+                    "--tier picks the instruction set, the stack tier by default.\n");
+    exit(64);
+}
+
+static bool parse_size(const char* text, size_t* size) {
+    char* end;
+    unsigned long long value = strtoull(text, &end, 10);
+    if (end == text) return false;
+    switch (*end) {
+        case 'k': case 'K': value *= 1024; end++; break;
+        case 'm': case 'M': value *= 1024 * 1024; end++; break;
+        case 'g': case 'G': value *= 1024 * 1024 * 1024; end++; break;
+    }
+    if (*end != '\0') return false;
+    *size = (size_t)value;
+    return true;
+}
+
+// @Note: the heap settings shared by the options and the environment, false on a bad value
+static bool set_heap_option(const char* name, const char* value) {
+    if (strcmp(name, "initial-heap") == 0) {
+        return parse_size(value, &vm.nextgc) && vm.nextgc > 0;
+    }
+    if (strcmp(name, "grow-factor") == 0) {
+        char* end;
+        double factor = strtod(value, &end);
+        if (*end != '\0' || end == value || factor <= 1.0) return false;
+        vm.gcGrowFactor = factor;
+        return true;
+    }
+    if (strcmp(name, "heap-limit") == 0) {
+        return parse_size(value, &vm.gcHeapLimit);
+    }
+    return false;
+}
+
+static void read_environment() {
+    static const struct {
+        const char* variable;
+        const char* name;
+    } settings[] = {
+        {"COMP_GC_INITIAL_HEAP", "initial-heap"},
+        {"COMP_GC_GROW_FACTOR", "grow-factor"},
+        {"COMP_GC_HEAP_LIMIT", "heap-limit"},
+    };
+    for (size_t i = 0; i < sizeof(settings) / sizeof(settings[0]); i++) {
+        const char* value = getenv(settings[i].variable);
+        if (value != NULL && !set_heap_option(settings[i].name, value)) {
+            fprintf(stderr, "Bad value \"%s\" for %s.\n", value, settings[i].variable);
+            exit(64);
+        }
+    }
+}
+
+// @Note: a comma separated list out of exec, gc and code
+static bool parse_trace(const char* list) {
+    static const struct {
+        const char* name;
+        TraceFlag flag;
+    } traces[] = {
+        {"exec", TRACE_EXEC},
+        {"gc", TRACE_GC},
+        {"code", TRACE_CODE},
+    };
+    const char* name = list;
+    for (;;) {
+        size_t length = strcspn(name, ",");
+        bool known = false;
+        for (size_t i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+            if (strlen(traces[i].name) == length && strncmp(name, traces[i].name, length) == 0) {
+                vm.traceFlags |= traces[i].flag;
+                known = true;
+            }
+        }
+        if (!known) return false;
+        if (name[length] == '\0') return true;
+        name += length + 1;
+    }
+}
+
+static void parse_option(const char* option) {
+    if (strncmp(option, "--trace=", 8) == 0) {
+        if (!parse_trace(option + 8)) usage();
+    } else if (strcmp(option, "--gc-incremental") == 0) {
+        vm.gcIncremental = true;
+    } else if (strncmp(option, "--gc-pause-budget=", 18) == 0) {
+        char* end;
+        long budget = strtol(option + 18, &end, 10);
+        if (*end != '\0' || end == option + 18 || budget <= 0) usage();
+        vm.gcPauseBudget = (uint64_t)budget * 1000;
+    } else if (strncmp(option, "--gc-threads=", 13) == 0) {
+        char* end;
+        long threads = strtol(option + 13, &end, 10);
+        if (*end != '\0' || end == option + 13 || threads < 1 || threads > GC_THREADS_MAX) usage();
+        vm.gcThreads = (int)threads;
+    } else if (strcmp(option, "--gc-report") == 0) {
+        atexit(gc_report);
+    } else if (strncmp(option, "--profile-ops=", 14) == 0) {
+        if (option[14] == '\0' || vm.opProfile.path != NULL) usage();
+        start_op_profile(option + 14);
+        atexit(write_op_profile);
+    } else if (strcmp(option, "--tier=stack") == 0) {
+        vm.tier = TIER_STACK;
+    } else if (strcmp(option, "--tier=register") == 0) {
+        vm.tier = TIER_REGISTER;
+    } else {
+        const char* value = strchr(option, '=');
+        if (strncmp(option, "--gc-", 5) != 0 || value == NULL) usage();
+        char name[32];
+        size_t length = value - (option + 5);
+        if (length >= sizeof(name)) usage();
+        memcpy(name, option + 5, length);
+        name[length] = '\0';
+        if (!set_heap_option(name, value + 1)) usage();
+    }
+}
+
 int main(int argc, const char* argv[]) {
     initVM();
-    if (argc == 1) {
+    read_environment();
+    const char* path = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "--", 2) == 0) {
+            parse_option(argv[i]);
+        } else if (path == NULL) {
+            path = argv[i];
+        } else {
+            usage();
+        }
+    }
+    if (path == NULL) {
         repl();
-    } else if (argc == 2) {
-        run_file(argv[1]);
     } else {
-        fprintf(stderr, "Usage: comp [path]\n");
-        exit(64);
+        run_file(path);
     }
     freeVM();
     return 0;
@@ -73,9 +206,7 @@ void test_stack() {
     Chunk chunk;
     init_chunk(&chunk);
     for (int idx = 1; idx < 10; idx++) {
-        Value val;
-        val.type = VAL_NUMBER;
-        val.as.number = (double) idx;
+        Value val = NUMBER_VAL((double) idx);
         write_constant(&chunk, val, idx + 90);
     }
     write_chunk(&chunk, OP_ADD, 111);
@@ -1,5 +1,10 @@
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 #include "chunk.h"
 #include "memory.h"
 #include "value.h"
@@ -7,70 +12,275 @@
 #include "object.h"
 #include "compiler.h"
 
-#ifdef DEBUG_LOG_GC
-#include <stdio.h>
-#include "debug.h"
+#if defined(__SANITIZE_ADDRESS__)
+#include <sanitizer/asan_interface.h>
+#define POISON_CELL(cell, size) ASAN_POISON_MEMORY_REGION(cell, size)
+#define UNPOISON_CELL(cell, size) ASAN_UNPOISON_MEMORY_REGION(cell, size)
+#else
+#define POISON_CELL(cell, size) ((void)(cell), (void)(size))
+#define UNPOISON_CELL(cell, size) ((void)(cell), (void)(size))
 #endif
-#define GC_HEAP_GROW_FACTOR 2
 
-static void free_object(Obj* obj) {
-#ifdef DEBUG_LOG_GC
-    printf("%p free type %d\n", (void*)obj, obj->type);
-#endif
+#define GC_STRESS_MAJOR_EVERY 16
+#define GC_STRESS_SLICE_WORK 8
+#define GC_SLICE_CHECK 64 // @Note: units of work between two looks at the clock
+#define LAZY_SWEEP_LIMIT 4 // @Note: blocks swept at most before the nursery grows instead
+#define SWEEP_CHUNK 8 // @Note: blocks a worker takes off the shared sweep list at a time
+
+#define CELL_ALIGN(size) (((size) + 7) & ~(size_t)7)
+#define BLOCK_HEADER_SIZE ((sizeof(HeapBlock) + MARK_GRANULE - 1) & ~(size_t)(MARK_GRANULE - 1))
+#define BLOCK_PAYLOAD (HEAP_BLOCK_SIZE - BLOCK_HEADER_SIZE)
+#define BLOCK_START(block) ((uint8_t*)(block) + BLOCK_HEADER_SIZE)
+#define BLOCK_END(block) ((uint8_t*)(block) + HEAP_BLOCK_SIZE)
+
+// @Note: with --gc-threads=N a stop-the-world major collection marks and sweeps on N threads,
+// the thread that runs the program being one of them. Every worker has its own gray stack and steals
+// half of another one's when it runs dry, the sweep hands the blocks out a few at a time. What the
+// workers free goes on their own free lists and counters, merged once they are all done.
+typedef enum {
+    GC_JOB_MARK,
+    GC_JOB_SWEEP,
+} GcJob;
+
+typedef struct {
+    int id;
+    pthread_t thread;
+    pthread_spinlock_t lock; // @Note: guards the gray stack against thieves
+    int grayCapacity;
+    int grayCount;
+    Obj** grayStack;
+    size_t markedBytes;
+    FreeCell* freeCells[SIZE_CLASS_COUNT];
+    FreeCell* freeTails[SIZE_CLASS_COUNT];
+    size_t freedBytes; // @Note: arrays freed through reallocate
+    size_t freedCells;
+    size_t freedObjects[OBJ_FREE];
+    size_t slack;
+    HeapBlock* emptyBlocks;
+} GcWorker;
+
+typedef struct {
+    int count;
+    GcWorker* workers;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_cond_t done;
+    uint64_t generation;
+    GcJob job;
+    int running;
+    bool stopping;
+    int idle;
+    HeapBlock** sweepList;
+    int sweepCount;
+    int sweepCapacity;
+    int sweepNext;
+} GcPool;
+
+static GcPool pool;
+static _Thread_local GcWorker* gcWorker; // @Note: set while the thread does a worker's share of a collection
+
+static int size_class(size_t size) {
+    if (size <= SIZE_CLASS_SMALL_MAX) {
+        return size <= 2 * SIZE_CLASS_STEP ? 0 : (int)((size - 1) / SIZE_CLASS_STEP) - 1;
+    }
+    int sizeClass = SIZE_CLASS_SMALL_MAX / SIZE_CLASS_STEP - 1;
+    for (size_t classSize = 2 * SIZE_CLASS_SMALL_MAX; classSize < size; classSize *= 2) {
+        sizeClass++;
+    }
+    return sizeClass;
+}
+
+static size_t class_size(int sizeClass) {
+    if (sizeClass < SIZE_CLASS_SMALL_MAX / SIZE_CLASS_STEP - 1) {
+        return (size_t)(sizeClass + 2) * SIZE_CLASS_STEP;
+    }
+    return (size_t)2 * SIZE_CLASS_SMALL_MAX << (sizeClass - (SIZE_CLASS_SMALL_MAX / SIZE_CLASS_STEP - 1));
+}
+
+// @Note: the size a cell really takes, bytesallocated is counted in these
+static size_t cell_size(size_t size) {
+    if (size > LARGE_OBJECT_SIZE) return CELL_ALIGN(size);
+    return class_size(size_class(size));
+}
+
+static size_t object_size(Obj* obj) {
+    switch (obj->type) {
+        case OBJ_STRING: return STRING_SIZE(((ObjString*)obj)->length);
+        case OBJ_FUNCTION: return sizeof(ObjFunction);
+        case OBJ_NATIVE: return sizeof(ObjNative);
+        case OBJ_CLOSURE: return CLOSURE_SIZE(((ObjClosure*)obj)->upvalueCount);
+        case OBJ_UPVALUE: return sizeof(ObjUpvalue);
+        case OBJ_ROPE: return sizeof(ObjRope);
+        case OBJ_SLICE: return sizeof(ObjSlice);
+        case OBJ_FREE: return ((FreeCell*)obj)->size;
+    }
+    return 0;
+}
+
+static void link_free_cell(FreeCell* cell) {
+    int sizeClass = size_class(cell->size);
+    cell->prev = NULL;
+    cell->next = vm.freeCells[sizeClass];
+    if (cell->next != NULL) cell->next->prev = cell;
+    vm.freeCells[sizeClass] = cell;
+}
+
+static void unlink_free_cell(FreeCell* cell) {
+    if (cell->prev != NULL) {
+        cell->prev->next = cell->next;
+    } else {
+        vm.freeCells[size_class(cell->size)] = cell->next;
+    }
+    if (cell->next != NULL) cell->next->prev = cell->prev;
+}
+
+static HeapBlock* new_block(size_t size, bool isLarge) {
+    HeapBlock* block = NULL;
+    if (!isLarge && vm.freeBlocks != NULL) {
+        block = vm.freeBlocks;
+        vm.freeBlocks = block->next;
+        vm.freeBlockCount--;
+    } else {
+        // @Note: blocks are aligned to HEAP_BLOCK_SIZE, so the block of a cell is found by masking its address
+        block = (HeapBlock*)aligned_alloc(HEAP_BLOCK_SIZE, size);
+        if (block == NULL) return NULL;
+        POISON_CELL(BLOCK_START(block), size - BLOCK_HEADER_SIZE);
+    }
+    block->prev = NULL;
+    block->next = vm.blocks;
+    if (vm.blocks != NULL) vm.blocks->prev = block;
+    vm.blocks = block;
+    block->youngNext = vm.youngBlocks;
+    vm.youngBlocks = block;
+    block->sweepNext = NULL;
+    block->top = BLOCK_START(block);
+    block->swept = BLOCK_START(block);
+    block->liveCount = 0;
+    // @Note: not derived from size, a large object just over LARGE_OBJECT_SIZE still fits in HEAP_BLOCK_SIZE
+    block->isLarge = isLarge;
+    block->isYoung = true;
+    block->needsSweep = false;
+    memset(block->marks, 0, sizeof(block->marks));
+    return block;
+}
+
+static void release_block(HeapBlock* block) {
+    if (block->prev != NULL) {
+        block->prev->next = block->next;
+    } else {
+        vm.blocks = block->next;
+    }
+    if (block->next != NULL) block->next->prev = block->prev;
+    if (block->isLarge) {
+        free(block);
+        return;
+    }
+    // @Note: every cell of an empty block is on a free list, take them off before the block goes
+    uint8_t* cell = BLOCK_START(block);
+    while (cell < block->top) {
+        unlink_free_cell((FreeCell*)cell);
+        cell += ((FreeCell*)cell)->size;
+    }
+    vm.blockSlack -= BLOCK_PAYLOAD;
+    // keep a nursery worth of empty blocks around, anything beyond goes back to the system
+    if (vm.freeBlockCount < NURSERY_SIZE / HEAP_BLOCK_SIZE) {
+        block->next = vm.freeBlocks;
+        vm.freeBlocks = block;
+        vm.freeBlockCount++;
+        return;
+    }
+    free(block);
+}
+
+// @Note: a large cell goes with its block, which the sweep releases
+static void free_cell(Obj* obj, size_t size) {
+    HeapBlock* block = BLOCK_OF(obj);
+    size = cell_size(size);
+    vm.bytesallocated -= size;
+    vm.cellBytes -= size;
+    block->liveCount--;
+    if (block->isLarge) return;
+
+    FreeCell* cell = (FreeCell*)obj;
+    cell->type = OBJ_FREE;
+    cell->size = (uint32_t)size;
+    link_free_cell(cell);
+    POISON_CELL((uint8_t*)cell + sizeof(FreeCell), size - sizeof(FreeCell));
+    vm.blockSlack += size;
+}
+
+// @Note: frees what the object owns outside of its cell
+static void free_payload(Obj* obj) {
+    if (GC_LOG_OBJECTS()) printf("%p free type %d\n", (void*)obj, obj->type);
     switch (obj->type) {
-        case OBJ_STRING: {
-            ObjString* str = (ObjString*)obj;
-            FREE_ARRAY(char, str->chars, str->length + 1);
-            FREE(ObjString, obj);
-            break;
-        }
         case OBJ_FUNCTION: {
             ObjFunction* func = (ObjFunction*)obj;
             free_chunk(&func->chunk);
-            FREE(ObjFunction, func);
             break;
         }
-        case OBJ_NATIVE: {
-            FREE(ObjNative, obj);
+        case OBJ_SLICE: {
+            ObjSlice* slice = (ObjSlice*)obj;
+            if (slice->parent == NULL) FREE_ARRAY(char, (char*)slice->chars, slice->length);
             break;
         }
-        case OBJ_CLOSURE: {
-            FREE(ObjClosure, obj);
-            break;
-        }
-        case OBJ_UPVALUE: {
-            FREE(ObjUpvalue, obj);
+        case OBJ_STRING:
+        case OBJ_NATIVE:
+        case OBJ_CLOSURE:
+        case OBJ_UPVALUE:
+        case OBJ_ROPE:
+        case OBJ_FREE:
             break;
-        }
     }
 }
 
-static void mark_roots() {
-    for (Value *slot = vm.stack; slot < vm.stackTop; slot++) {
-        mark_value(*slot);
+static void free_object(Obj* obj) {
+    size_t size = object_size(obj);
+    free_payload(obj);
+    free_cell(obj, size);
+}
+
+static void mark_array(ValueArray *array) {
+    for (int i = 0; i < array->count; i++) {
+        mark_value(array->values[i]);
     }
+}
+
+static void mark_roots(bool young) {
+    // @Note: a register tier frame keeps its whole window alive, stackTop is below its end while it
+    // calls. So whatever a register holds stays valid until it is written, even when it is dead.
+    Value* top = vm.stackTop;
     for (int i = 0; i < vm.frameCount; i++) {
         mark_object((Obj*)vm.frames[i].closure);
+        Value* end = vm.frames[i].slots + vm.frames[i].closure->fn->registers;
+        if (end > top) top = end;
+    }
+    for (Value *slot = vm.stack; slot < top; slot++) {
+        mark_value(*slot);
     }
     for (ObjUpvalue* uv = vm.openUpvalues; uv != NULL; uv = uv->next) {
         mark_object((Obj*)uv);
     }
-    mark_table(&vm.globals);
+    // @Note: the globals are not behind a barrier, a minor collection scans their slots too.
+    // Remembering every stored value instead kept whatever a global held since the last one alive.
+    if (!young) mark_table(&vm.globals);
+    mark_array(&vm.globalValues);
+    mark_array(&vm.globalNames);
     mark_compiler_roots();
 }
 
-static void mark_array(ValueArray *array) {
-    for (int i = 0; i < array->count; i++) {
-        mark_value(array->values[i]);
+// @Note: a rope is logged by its length, printing a deep one would allocate in the middle of the collection
+static void log_object(const char* action, Obj* object) {
+    printf("%p %s ", (void*)object, action);
+    if (object->type == OBJ_ROPE) {
+        printf("<rope of %d>", ((ObjRope*)object)->length);
+    } else {
+        print_value(OBJ_VAL(object));
     }
+    printf("\n");
 }
 
 static void blacken_object(Obj *object) {
-#ifdef DEBUG_LOG_GC
-    printf("%p blacken ", (void*)object);
-    print_value(OBJ_VAL(object));
-    printf("\n");
-#endif
+    if (GC_LOG_OBJECTS()) log_object("blacken", object);
     switch (object->type) {
         case OBJ_UPVALUE: {
             mark_value(((ObjUpvalue*)object)->closed);
@@ -90,12 +300,39 @@ static void blacken_object(Obj *object) {
             }
             break;
         }
+        case OBJ_ROPE: {
+            ObjRope* rope = (ObjRope*)object;
+            mark_object(rope->left);
+            mark_object(rope->right);
+            mark_object((Obj*)rope->flat);
+            break;
+        }
+        case OBJ_SLICE: {
+            // @Note: left to detach_slices, so a small slice alone does not keep a big parent alive
+            ObjSlice* slice = (ObjSlice*)object;
+            if (slice->parent != NULL && !slice_may_detach(slice)) mark_object(slice->parent);
+            break;
+        }
         case OBJ_NATIVE:
         case OBJ_STRING:
+        case OBJ_FREE:
             break;
     }
 }
 
+static void mark_remembered() {
+    for (int i = 0; i < vm.rememberedCount; i++) {
+        blacken_object(vm.remembered[i]);
+    }
+}
+
+static void forget_remembered() {
+    for (int i = 0; i < vm.rememberedCount; i++) {
+        vm.remembered[i]->isRemembered = false;
+    }
+    vm.rememberedCount = 0;
+}
+
 static void trace_references() {
     while (vm.grayCount > 0) {
         Obj *object = vm.grayStack[--vm.grayCount];
@@ -103,66 +340,722 @@ static void trace_references() {
     }
 }
 
-static void sweep() {
-    Obj *previous = NULL;
-    Obj *obj = vm.objects;
-    while (obj != NULL) {
-        if (obj->isMarked) {
-            obj->isMarked = false;
-            previous = obj;
-            obj = obj->next;
+// @Note: runs once marking is done and before anything is swept. A live slice whose parent was not
+// marked gets a copy of its characters if it may detach, otherwise the parent is marked after all.
+// That is also how slices allocated black during an incremental cycle keep their parent.
+static void detach_slices() {
+    int count = 0;
+    for (int i = 0; i < vm.sliceCount; i++) {
+        ObjSlice* slice = vm.slices[i];
+        if (!is_marked((Obj*)slice)) continue;
+        if (!is_marked(slice->parent)) {
+            if (slice_may_detach(slice)) {
+                char* chars = (char*)gc_reallocate(NULL, 0, slice->length);
+                memcpy(chars, slice->chars, slice->length);
+                slice->chars = chars;
+                slice->parent = NULL;
+                continue;
+            }
+            mark_object(slice->parent);
+        }
+        vm.slices[count++] = slice;
+    }
+    vm.sliceCount = count;
+    trace_references();
+}
+
+static void clear_marks() {
+    for (HeapBlock* block = vm.blocks; block != NULL; block = block->next) {
+        memset(block->marks, 0, sizeof(block->marks));
+    }
+    vm.markedBytes = 0;
+}
+
+static size_t heap_bytes() {
+    return vm.bytesallocated - vm.garbageBytes;
+}
+
+// @Note: NULL once the record fell out of the history
+static GcCycle* cycle_at(int number) {
+    if (number < 0 || number >= vm.gcCycleCount || vm.gcCycleCount - number > GC_CYCLE_HISTORY) return NULL;
+    return &vm.gcCycles[number % GC_CYCLE_HISTORY];
+}
+
+static int begin_record(bool isMajor) {
+    int number = vm.gcCycleCount++;
+    GcCycle* cycle = &vm.gcCycles[number % GC_CYCLE_HISTORY];
+    memset(cycle, 0, sizeof(GcCycle));
+    cycle->isMajor = isMajor;
+    cycle->bytesBefore = heap_bytes();
+    if (isMajor) vm.gcMajorCycle = number;
+    return number;
+}
+
+static void end_record(int number) {
+    GcCycle* cycle = cycle_at(number);
+    if (cycle != NULL) cycle->bytesAfter = heap_bytes();
+}
+
+// @Note: frees the unmarked objects from `from` to the top of the block and returns their size.
+// The free cells met on the way are threaded onto the free lists again, which a major collection emptied.
+static size_t sweep_cells(HeapBlock* block, uint8_t* from, GcCycle* cycle) {
+    size_t freed = 0;
+    uint8_t* cell = from;
+    while (cell < block->top) {
+        Obj* obj = (Obj*)cell;
+        size_t size = cell_size(object_size(obj));
+        if (obj->type == OBJ_FREE) {
+            link_free_cell((FreeCell*)obj);
+        } else if (!is_marked(obj)) {
+            freed += size;
+            if (cycle != NULL) cycle->freed[obj->type]++;
+            free_object(obj);
+        }
+        cell += size;
+    }
+    block->swept = block->top;
+    return freed;
+}
+
+static void queue_sweep(HeapBlock* block) {
+    if (block->needsSweep) return;
+    block->needsSweep = true;
+    block->sweepNext = vm.sweepBlocks;
+    vm.sweepBlocks = block;
+}
+
+// @Note: nobody allocates into a block while it waits to be swept, so its unmarked objects are exactly the dead ones
+static void sweep_blocks(int count) {
+    GcCycle* cycle = cycle_at(vm.gcMajorCycle);
+    for (int i = 0; i < count && vm.sweepBlocks != NULL; i++) {
+        HeapBlock* block = vm.sweepBlocks;
+        vm.sweepBlocks = block->sweepNext;
+        block->needsSweep = false;
+        vm.garbageBytes -= sweep_cells(block, BLOCK_START(block), cycle);
+        if (block->liveCount == 0) release_block(block);
+    }
+}
+
+// @Note: a minor collection sweeps what was allocated since the last collection, the cells below
+// a block's swept mark are old except for the young objects that went into free cells
+static void sweep_young(GcCycle* cycle) {
+    for (int i = 0; i < vm.youngCellCount; i++) {
+        Obj* obj = vm.youngCells[i];
+        if (is_marked(obj)) continue;
+        HeapBlock* block = BLOCK_OF(obj);
+        if (cycle != NULL) cycle->freed[obj->type]++;
+        free_object(obj);
+        if (block->liveCount == 0 && !block->isYoung) release_block(block);
+    }
+    vm.youngCellCount = 0;
+
+    HeapBlock* block = vm.youngBlocks;
+    vm.youngBlocks = NULL;
+    while (block != NULL) {
+        HeapBlock* next = block->youngNext;
+        sweep_cells(block, block->swept, cycle);
+        if (block == vm.bumpBlock) {
+            block->youngNext = vm.youngBlocks;
+            vm.youngBlocks = block;
         } else {
-            Obj *unreached = obj;
-            obj = obj->next;
-            if (previous != NULL) {
-                previous->next = obj;
-            } else {
-                vm.objects = obj;
+            block->isYoung = false;
+            block->youngNext = NULL;
+            if (block->liveCount == 0) release_block(block);
+        }
+        block = next;
+    }
+    vm.youngBytes = 0;
+}
+
+// @Note: after a major collection every block may hold garbage, the free lists start over
+// and fill up again as the blocks get swept
+static void finish_major() {
+    if (vm.bumpBlock != NULL) {
+        vm.blockSlack += BLOCK_END(vm.bumpBlock) - vm.bumpBlock->top;
+        vm.bumpBlock = NULL;
+    }
+    for (HeapBlock* block = vm.youngBlocks; block != NULL; block = block->youngNext) {
+        block->isYoung = false;
+    }
+    vm.youngBlocks = NULL;
+    vm.youngBytes = 0;
+    vm.youngCellCount = 0;
+    for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+        vm.freeCells[i] = NULL;
+    }
+    for (HeapBlock* block = vm.blocks; block != NULL; block = block->next) {
+        queue_sweep(block);
+    }
+    vm.garbageBytes = vm.cellBytes - vm.markedBytes;
+    vm.nextgc = (size_t)((vm.bytesallocated - vm.garbageBytes + vm.blockSlack) * vm.gcGrowFactor);
+    // @Note: the last collection before the limit is hit should not be the one that finds the heap full
+    if (vm.gcHeapLimit != 0 && vm.nextgc > vm.gcHeapLimit) vm.nextgc = vm.gcHeapLimit;
+}
+
+static void push_gray(GcWorker* worker, Obj* object) {
+    pthread_spin_lock(&worker->lock);
+    if (worker->grayCapacity < worker->grayCount + 1) {
+        worker->grayCapacity = GROW_CAPACITY(worker->grayCapacity);
+        worker->grayStack = (Obj**)realloc(worker->grayStack, sizeof(Obj*) * worker->grayCapacity);
+        if (worker->grayStack == NULL) exit(1);
+    }
+    worker->grayStack[worker->grayCount] = object;
+    // @Note: thieves peek at the count without the lock
+    __atomic_store_n(&worker->grayCount, worker->grayCount + 1, __ATOMIC_RELAXED);
+    pthread_spin_unlock(&worker->lock);
+}
+
+static Obj* pop_gray(GcWorker* worker) {
+    Obj* object = NULL;
+    pthread_spin_lock(&worker->lock);
+    if (worker->grayCount > 0) {
+        object = worker->grayStack[worker->grayCount - 1];
+        __atomic_store_n(&worker->grayCount, worker->grayCount - 1, __ATOMIC_RELAXED);
+    }
+    pthread_spin_unlock(&worker->lock);
+    return object;
+}
+
+// @Note: the bit is set with an atomic or, whichever worker flips it owns the object
+static void worker_mark(GcWorker* worker, Obj* object) {
+    HeapBlock* block = BLOCK_OF(object);
+    size_t bit = ((uintptr_t)object - (uintptr_t)block) / MARK_GRANULE;
+    uint64_t* word = &block->marks[bit / 64];
+    uint64_t mask = (uint64_t)1 << (bit % 64);
+    if (__atomic_load_n(word, __ATOMIC_RELAXED) & mask) return;
+    if (__atomic_fetch_or(word, mask, __ATOMIC_RELAXED) & mask) return;
+    worker->markedBytes += cell_size(object_size(object));
+    push_gray(worker, object);
+}
+
+static bool steal_gray(GcWorker* thief) {
+    for (int i = 1; i < pool.count; i++) {
+        GcWorker* victim = &pool.workers[(thief->id + i) % pool.count];
+        if (__atomic_load_n(&victim->grayCount, __ATOMIC_RELAXED) == 0) continue;
+        pthread_spin_lock(&victim->lock);
+        if (victim->grayCount == 0) {
+            pthread_spin_unlock(&victim->lock);
+            continue;
+        }
+        int take = (victim->grayCount + 1) / 2;
+        __atomic_store_n(&victim->grayCount, victim->grayCount - take, __ATOMIC_RELAXED);
+        // @Note: the thief's stack is empty, nobody else looks at its array until the count says otherwise
+        if (thief->grayCapacity < take) {
+            thief->grayCapacity = take < 8 ? 8 : take;
+            thief->grayStack = (Obj**)realloc(thief->grayStack, sizeof(Obj*) * thief->grayCapacity);
+            if (thief->grayStack == NULL) exit(1);
+        }
+        memcpy(thief->grayStack, victim->grayStack + victim->grayCount, sizeof(Obj*) * take);
+        pthread_spin_unlock(&victim->lock);
+        pthread_spin_lock(&thief->lock);
+        __atomic_store_n(&thief->grayCount, take, __ATOMIC_RELAXED);
+        pthread_spin_unlock(&thief->lock);
+        return true;
+    }
+    return false;
+}
+
+static bool gray_left() {
+    for (int i = 0; i < pool.count; i++) {
+        if (__atomic_load_n(&pool.workers[i].grayCount, __ATOMIC_RELAXED) > 0) return true;
+    }
+    return false;
+}
+
+// @Note: a worker only counts itself idle with an empty stack, and an idle worker's stack stays empty.
+// Once all of them are idle there is no gray object left anywhere.
+static void mark_parallel(GcWorker* worker) {
+    for (;;) {
+        Obj* object;
+        while ((object = pop_gray(worker)) != NULL) {
+            blacken_object(object);
+        }
+        if (steal_gray(worker)) continue;
+        __atomic_add_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+        for (;;) {
+            if (__atomic_load_n(&pool.idle, __ATOMIC_SEQ_CST) == pool.count) return;
+            if (gray_left()) {
+                __atomic_sub_fetch(&pool.idle, 1, __ATOMIC_SEQ_CST);
+                break;
             }
-            free_object(unreached);
+            sched_yield();
         }
     }
 }
 
-void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
-    vm.bytesallocated += newSize - oldSize;
-    if (newSize > oldSize) {
-#ifdef DEBUG_STRESS_GC
+static void worker_link_cell(GcWorker* worker, FreeCell* cell) {
+    int sizeClass = size_class(cell->size);
+    cell->prev = NULL;
+    cell->next = worker->freeCells[sizeClass];
+    if (cell->next != NULL) {
+        cell->next->prev = cell;
+    } else {
+        worker->freeTails[sizeClass] = cell;
+    }
+    worker->freeCells[sizeClass] = cell;
+}
+
+// @Note: sweep_cells for a worker, the dead cells go on the worker's free lists and an empty
+// block is left for the main thread to release
+static void sweep_block_parallel(GcWorker* worker, HeapBlock* block) {
+    uint8_t* cell = BLOCK_START(block);
+    while (cell < block->top) {
+        Obj* obj = (Obj*)cell;
+        size_t size = cell_size(object_size(obj));
+        if (obj->type == OBJ_FREE) {
+            worker_link_cell(worker, (FreeCell*)obj);
+        } else if (!is_marked(obj)) {
+            worker->freedObjects[obj->type]++;
+            free_payload(obj);
+            worker->freedCells += size;
+            block->liveCount--;
+            if (!block->isLarge) {
+                FreeCell* dead = (FreeCell*)obj;
+                dead->type = OBJ_FREE;
+                dead->size = (uint32_t)size;
+                worker_link_cell(worker, dead);
+                POISON_CELL((uint8_t*)dead + sizeof(FreeCell), size - sizeof(FreeCell));
+                worker->slack += size;
+            }
+        }
+        cell += size;
+    }
+    block->swept = block->top;
+    block->needsSweep = false;
+    if (block->liveCount == 0) {
+        block->sweepNext = worker->emptyBlocks;
+        worker->emptyBlocks = block;
+    }
+}
+
+static void sweep_parallel(GcWorker* worker) {
+    for (;;) {
+        int first = __atomic_fetch_add(&pool.sweepNext, SWEEP_CHUNK, __ATOMIC_RELAXED);
+        if (first >= pool.sweepCount) return;
+        int last = first + SWEEP_CHUNK < pool.sweepCount ? first + SWEEP_CHUNK : pool.sweepCount;
+        for (int i = first; i < last; i++) {
+            sweep_block_parallel(worker, pool.sweepList[i]);
+        }
+    }
+}
+
+static void run_job(GcWorker* worker, GcJob job) {
+    switch (job) {
+        case GC_JOB_MARK: mark_parallel(worker); break;
+        case GC_JOB_SWEEP: sweep_parallel(worker); break;
+    }
+}
+
+static void* worker_main(void* arg) {
+    gcWorker = (GcWorker*)arg;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&pool.lock);
+    for (;;) {
+        while (pool.generation == seen && !pool.stopping) {
+            pthread_cond_wait(&pool.wake, &pool.lock);
+        }
+        if (pool.stopping) break;
+        seen = pool.generation;
+        GcJob job = pool.job;
+        pthread_mutex_unlock(&pool.lock);
+        run_job(gcWorker, job);
+        pthread_mutex_lock(&pool.lock);
+        if (--pool.running == 0) pthread_cond_signal(&pool.done);
+    }
+    pthread_mutex_unlock(&pool.lock);
+    return NULL;
+}
+
+// @Note: the threads are started by the first collection that needs them, before its pause is timed
+static void start_workers() {
+    pool.count = vm.gcThreads;
+    pool.workers = (GcWorker*)calloc(pool.count, sizeof(GcWorker));
+    if (pool.workers == NULL) exit(1);
+    pthread_mutex_init(&pool.lock, NULL);
+    pthread_cond_init(&pool.wake, NULL);
+    pthread_cond_init(&pool.done, NULL);
+    for (int i = 0; i < pool.count; i++) {
+        pool.workers[i].id = i;
+        pthread_spin_init(&pool.workers[i].lock, PTHREAD_PROCESS_PRIVATE);
+    }
+    for (int i = 1; i < pool.count; i++) {
+        if (pthread_create(&pool.workers[i].thread, NULL, worker_main, &pool.workers[i]) != 0) {
+            fprintf(stderr, "Could not start gc worker thread.\n");
+            exit(1);
+        }
+    }
+}
+
+static void stop_workers() {
+    if (pool.workers == NULL) return;
+    pthread_mutex_lock(&pool.lock);
+    pool.stopping = true;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+    for (int i = 0; i < pool.count; i++) {
+        if (i > 0) pthread_join(pool.workers[i].thread, NULL);
+        pthread_spin_destroy(&pool.workers[i].lock);
+        free(pool.workers[i].grayStack);
+    }
+    pthread_mutex_destroy(&pool.lock);
+    pthread_cond_destroy(&pool.wake);
+    pthread_cond_destroy(&pool.done);
+    free(pool.workers);
+    free(pool.sweepList);
+    pool.workers = NULL;
+    pool.sweepList = NULL;
+}
+
+// @Note: the main thread takes worker 0's share and returns once every worker is done
+static void run_workers(GcJob job) {
+    pthread_mutex_lock(&pool.lock);
+    pool.job = job;
+    pool.running = pool.count - 1;
+    pool.generation++;
+    pthread_cond_broadcast(&pool.wake);
+    pthread_mutex_unlock(&pool.lock);
+
+    gcWorker = &pool.workers[0];
+    run_job(gcWorker, job);
+    gcWorker = NULL;
+
+    pthread_mutex_lock(&pool.lock);
+    while (pool.running > 0) {
+        pthread_cond_wait(&pool.done, &pool.lock);
+    }
+    pthread_mutex_unlock(&pool.lock);
+}
+
+// @Note: the roots were marked onto vm.grayStack, they are dealt out before the workers start
+static void trace_parallel() {
+    for (int i = 0; i < vm.grayCount; i++) {
+        push_gray(&pool.workers[i % pool.count], vm.grayStack[i]);
+    }
+    vm.grayCount = 0;
+    pool.idle = 0;
+    run_workers(GC_JOB_MARK);
+    for (int i = 0; i < pool.count; i++) {
+        vm.markedBytes += pool.workers[i].markedBytes;
+        pool.workers[i].markedBytes = 0;
+    }
+}
+
+// @Note: sweeps every block finish_major queued and merges what the workers freed
+static void sweep_all_parallel() {
+    pool.sweepCount = 0;
+    for (HeapBlock* block = vm.sweepBlocks; block != NULL; block = block->sweepNext) {
+        if (pool.sweepCapacity < pool.sweepCount + 1) {
+            pool.sweepCapacity = GROW_CAPACITY(pool.sweepCapacity);
+            pool.sweepList = (HeapBlock**)realloc(pool.sweepList, sizeof(HeapBlock*) * pool.sweepCapacity);
+            if (pool.sweepList == NULL) exit(1);
+        }
+        pool.sweepList[pool.sweepCount++] = block;
+    }
+    vm.sweepBlocks = NULL;
+    pool.sweepNext = 0;
+    run_workers(GC_JOB_SWEEP);
+
+    GcCycle* cycle = cycle_at(vm.gcMajorCycle);
+    for (int i = 0; i < pool.count; i++) {
+        GcWorker* worker = &pool.workers[i];
+        for (int t = 0; t < OBJ_FREE; t++) {
+            if (cycle != NULL) cycle->freed[t] += worker->freedObjects[t];
+            worker->freedObjects[t] = 0;
+        }
+        for (int c = 0; c < SIZE_CLASS_COUNT; c++) {
+            if (worker->freeCells[c] == NULL) continue;
+            worker->freeTails[c]->next = vm.freeCells[c];
+            if (vm.freeCells[c] != NULL) vm.freeCells[c]->prev = worker->freeTails[c];
+            vm.freeCells[c] = worker->freeCells[c];
+            worker->freeCells[c] = NULL;
+            worker->freeTails[c] = NULL;
+        }
+        vm.bytesallocated -= worker->freedBytes + worker->freedCells;
+        vm.cellBytes -= worker->freedCells;
+        vm.garbageBytes -= worker->freedCells;
+        vm.blockSlack += worker->slack;
+        worker->freedBytes = 0;
+        worker->freedCells = 0;
+        worker->slack = 0;
+    }
+    // @Note: the cells of an empty block are on the free lists by now, release_block takes them off again
+    for (int i = 0; i < pool.count; i++) {
+        HeapBlock* block = pool.workers[i].emptyBlocks;
+        pool.workers[i].emptyBlocks = NULL;
+        while (block != NULL) {
+            HeapBlock* next = block->sweepNext;
+            block->sweepNext = NULL;
+            release_block(block);
+            block = next;
+        }
+    }
+}
+
+// @Note: a major's sweep is lazy, so what it freed is not all in the record yet
+static void trace_cycle(int number) {
+    char line[256];
+    gc_format_cycle(number, line, sizeof(line));
+    printf("-- gc %s, next at %zu\n", line, vm.nextgc);
+}
+
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void record_pause(uint64_t start, int number) {
+    uint64_t pause = now_ns() - start;
+    GcCycle* cycle = cycle_at(number);
+    if (cycle != NULL) cycle->pause += pause;
+    if (pause > vm.gcMaxPause) vm.gcMaxPause = pause;
+    vm.gcTotalPause += pause;
+    vm.gcPauseCount++;
+}
+
+static void begin_cycle() {
+    if (vm.traceFlags & TRACE_GC) printf("-- incremental gc begin\n");
+    uint64_t start = now_ns();
+    int number = begin_record(true);
+    clear_marks();
+    mark_roots(false);
+    vm.gcPhase = GC_MARKING;
+    vm.gcDebt = 0;
+    record_pause(start, number);
+}
+
+static void finish_marking() {
+    // @Note: the stack and the globals are not behind a barrier, rescan them and drain what they still reach
+    mark_roots(false);
+    trace_references();
+    detach_slices();
+    forget_remembered();
+    table_remove_white(&vm.strings);
+    finish_major();
+    end_record(vm.gcMajorCycle);
+    vm.gcPhase = GC_IDLE;
+    if (vm.traceFlags & TRACE_GC) trace_cycle(vm.gcMajorCycle);
+}
+
+// @Note: one unit of work is blackening a single object, the atomic end of the marking
+// phase counts as one. The clock is only read every GC_SLICE_CHECK units.
+static void gc_slice(int workLimit) {
+    uint64_t start = now_ns();
+    uint64_t deadline = start + vm.gcPauseBudget;
+    int work = 0;
+    while (vm.gcPhase == GC_MARKING && work < workLimit) {
+        if (vm.grayCount == 0) {
+            finish_marking();
+        } else {
+            blacken_object(vm.grayStack[--vm.grayCount]);
+        }
+        if (++work % GC_SLICE_CHECK == 0 && now_ns() >= deadline) break;
+    }
+    record_pause(start, vm.gcMajorCycle);
+}
+
+static void collect_major() {
+    if (vm.gcIncremental) {
+        begin_cycle();
+    } else {
         collect_garbage();
+    }
+}
+
+static void collect_if_needed(size_t size) {
+    // @Note: minor collections wait for a running incremental cycle, which is paced by allocation
+    if (vm.gcPhase == GC_MARKING) {
+#ifdef DEBUG_STRESS_GC
+        gc_slice(GC_STRESS_SLICE_WORK);
+        return;
 #endif
-        if (vm.bytesallocated > vm.nextgc) {
-            collect_garbage();
+        vm.gcDebt += size;
+        if (vm.gcDebt >= GC_STEP_SIZE) {
+            vm.gcDebt = 0;
+            gc_slice(INT_MAX);
         }
+        return;
     }
+#ifdef DEBUG_STRESS_GC
+    if (++vm.stressCount % GC_STRESS_MAJOR_EVERY == 0) {
+        collect_major();
+        return;
+    }
+    collect_young();
+#endif
+    if (vm.bytesallocated - vm.garbageBytes + vm.blockSlack > vm.nextgc) {
+        collect_major();
+    } else if (vm.youngBytes > NURSERY_SIZE) {
+        collect_young();
+    } else {
+        // the sweep keeps going even when allocation never runs out of free cells
+        vm.gcDebt += size;
+        if (vm.gcDebt >= GC_STEP_SIZE) {
+            vm.gcDebt = 0;
+            sweep_blocks(1);
+        }
+    }
+}
+
+// @Note: takes back the failed allocation and unwinds to the running program as a runtime error.
+// Outside of one, e.g. while compiling, there is nothing to unwind to.
+static void out_of_memory(size_t size) {
+    vm.bytesallocated -= size;
+    vm.youngBytes -= size;
+    if (vm.errorJump != NULL) longjmp(*vm.errorJump, 1);
+    fprintf(stderr, "Out of memory.\n");
+    exit(1);
+}
+
+// @Note: one last full collection before an allocation over the heap limit fails
+static void check_heap_limit(size_t size) {
+    if (vm.gcHeapLimit == 0 || heap_bytes() <= vm.gcHeapLimit) return;
+    while (vm.gcPhase == GC_MARKING) {
+        gc_slice(INT_MAX);
+    }
+    collect_garbage();
+    if (heap_bytes() > vm.gcHeapLimit) out_of_memory(size);
+}
+
+void* reallocate(void* pointer, size_t oldSize, size_t newSize) {
     if (newSize == 0) {
+        // @Note: a sweeping worker counts what it frees on its own, bytesallocated is the mutator's
+        if (gcWorker != NULL) {
+            gcWorker->freedBytes += oldSize;
+        } else {
+            vm.bytesallocated -= oldSize;
+        }
         free(pointer);
         return NULL;
     }
+    vm.bytesallocated += newSize - oldSize;
+    if (newSize > oldSize) {
+        vm.youngBytes += newSize - oldSize;
+        collect_if_needed(newSize - oldSize);
+        check_heap_limit(newSize - oldSize);
+    }
+    void* result = realloc(pointer, newSize);
+    if (result == NULL) {
+        // @Note: a shrinking realloc does not fail, so the growth is what gets taken back
+        out_of_memory(newSize - oldSize);
+    }
+    return result;
+}
+
+// @Note: for what the collector allocates in the middle of a collection. Counted like reallocate,
+// but it can neither start another collection nor unwind.
+void* gc_reallocate(void* pointer, size_t oldSize, size_t newSize) {
+    vm.bytesallocated += newSize - oldSize;
     void* result = realloc(pointer, newSize);
     if (result == NULL) exit(1);
     return result;
 }
 
+static void remember_young_cell(Obj* obj) {
+    if (vm.youngCellCapacity < vm.youngCellCount + 1) {
+        vm.youngCellCapacity = GROW_CAPACITY(vm.youngCellCapacity);
+        vm.youngCells = (Obj**)realloc(vm.youngCells, sizeof(Obj*) * vm.youngCellCapacity);
+        if (vm.youngCells == NULL) exit(1);
+    }
+    vm.youngCells[vm.youngCellCount++] = obj;
+}
+
+Obj* allocate_cell(size_t size) {
+    size = cell_size(size);
+    vm.bytesallocated += size;
+    vm.youngBytes += size;
+    collect_if_needed(size);
+    check_heap_limit(size);
+
+    Obj* obj;
+    if (size > LARGE_OBJECT_SIZE) {
+        size_t blockSize = (BLOCK_HEADER_SIZE + size + HEAP_BLOCK_SIZE - 1) & ~(size_t)(HEAP_BLOCK_SIZE - 1);
+        HeapBlock* block = new_block(blockSize, true);
+        if (block == NULL) out_of_memory(size);
+        obj = (Obj*)block->top;
+        block->top += size;
+    } else {
+        int sizeClass = size_class(size);
+        // @Note: the marks are being rebuilt while marking, nothing can be swept until it is done
+        if (vm.gcPhase != GC_MARKING) {
+            for (int i = 0; i < LAZY_SWEEP_LIMIT && vm.freeCells[sizeClass] == NULL && vm.sweepBlocks != NULL; i++) {
+                sweep_blocks(1);
+            }
+        }
+        FreeCell* cell = vm.freeCells[sizeClass];
+        if (cell != NULL) {
+            vm.freeCells[sizeClass] = cell->next;
+            if (cell->next != NULL) cell->next->prev = NULL;
+            obj = (Obj*)cell;
+            vm.blockSlack -= size;
+            if (vm.gcPhase != GC_MARKING) remember_young_cell(obj);
+        } else {
+            HeapBlock* block = vm.bumpBlock;
+            if (block == NULL || block->top + size > BLOCK_END(block)) {
+                HeapBlock* fresh = new_block(HEAP_BLOCK_SIZE, false);
+                if (fresh == NULL) out_of_memory(size);
+                if (block != NULL) vm.blockSlack += BLOCK_END(block) - block->top;
+                block = fresh;
+                vm.bumpBlock = block;
+            }
+            obj = (Obj*)block->top;
+            block->top += size;
+        }
+    }
+    UNPOISON_CELL(obj, size);
+    BLOCK_OF(obj)->liveCount++;
+    vm.cellBytes += size;
+    obj->isRemembered = false;
+    // @Note: objects allocated while marking are born black, they cannot be reached by the tracer otherwise
+    if (vm.gcPhase == GC_MARKING) {
+        set_mark(obj);
+        vm.markedBytes += size;
+    }
+    return obj;
+}
+
 void free_objects() {
-    Obj* obj = vm.objects;
-    while (obj != NULL) {
-        Obj* next = obj->next;
-        free_object(obj);
-        obj = next;
+    stop_workers();
+    // @Note: the free lists run through every block, so no block goes before the last object
+    for (HeapBlock* block = vm.blocks; block != NULL; block = block->next) {
+        uint8_t* cell = BLOCK_START(block);
+        while (cell < block->top) {
+            Obj* obj = (Obj*)cell;
+            cell += cell_size(object_size(obj));
+            if (obj->type != OBJ_FREE) free_object(obj);
+        }
+    }
+    HeapBlock* block = vm.blocks;
+    while (block != NULL) {
+        HeapBlock* next = block->next;
+        free(block);
+        block = next;
     }
+    block = vm.freeBlocks;
+    while (block != NULL) {
+        HeapBlock* next = block->next;
+        free(block);
+        block = next;
+    }
+    vm.blocks = NULL;
+    vm.freeBlocks = NULL;
 
     free(vm.grayStack);
+    free(vm.remembered);
+    free(vm.youngCells);
+    free(vm.slices);
 }
 
 void mark_object(Obj *object) {
     if (object == NULL) return;
-    if (object->isMarked) return;
-#ifdef DEBUG_LOG_GC
-    printf("%p mark ", (void*)object);
-    print_value(OBJ_VAL(object));
-    printf("\n");
-#endif
-    object->isMarked = true;
+    if (gcWorker != NULL) {
+        worker_mark(gcWorker, object);
+        return;
+    }
+    if (is_marked(object)) return;
+    if (GC_LOG_OBJECTS()) log_object("mark", object);
+    set_mark(object);
+    vm.markedBytes += cell_size(object_size(object));
 
     if (vm.grayCapacity < vm.grayCount + 1) {
         vm.grayCapacity = GROW_CAPACITY(vm.grayCapacity);
@@ -177,19 +1070,100 @@ void mark_value(Value value) {
     if (IS_OBJ(value)) mark_object(AS_OBJ(value));
 }
 
-void collect_garbage() {
-#ifdef DEBUG_LOG_GC
-    printf("-- gc begin\n");
-    size_t before = vm.bytesallocated;
-#endif
-    mark_roots();
+void gc_track_slice(ObjSlice* slice) {
+    if (vm.sliceCapacity < vm.sliceCount + 1) {
+        vm.sliceCapacity = GROW_CAPACITY(vm.sliceCapacity);
+        vm.slices = (ObjSlice**)realloc(vm.slices, sizeof(ObjSlice*) * vm.sliceCapacity);
+        if (vm.slices == NULL) exit(1);
+    }
+    vm.slices[vm.sliceCount++] = slice;
+}
+
+void gc_barrier(Obj* owner, Obj* target) {
+    if (vm.gcPhase == GC_MARKING) {
+        mark_object(target);
+        return;
+    }
+    // @Note: an old object now points at a young one, scan it during the next minor collection
+    if (owner->isRemembered) return;
+    if (vm.rememberedCapacity < vm.rememberedCount + 1) {
+        vm.rememberedCapacity = GROW_CAPACITY(vm.rememberedCapacity);
+        vm.remembered = (Obj**)realloc(vm.remembered, sizeof(Obj*) * vm.rememberedCapacity);
+        if (vm.remembered == NULL) exit(1);
+    }
+    owner->isRemembered = true;
+    vm.remembered[vm.rememberedCount++] = owner;
+}
+
+int gc_format_cycle(int number, char* buffer, size_t size) {
+    static const char* typeNames[OBJ_FREE] = {
+        [OBJ_STRING] = "string",
+        [OBJ_FUNCTION] = "function",
+        [OBJ_NATIVE] = "native",
+        [OBJ_CLOSURE] = "closure",
+        [OBJ_UPVALUE] = "upvalue",
+        [OBJ_ROPE] = "rope",
+        [OBJ_SLICE] = "slice",
+    };
+    const GcCycle* cycle = cycle_at(number);
+    if (cycle == NULL) return 0;
+    int length = snprintf(buffer, size, "#%d %s, pause %.3f ms, %zu -> %zu bytes, freed",
+                          number, cycle->isMajor ? "major" : "minor", cycle->pause / 1e6,
+                          cycle->bytesBefore, cycle->bytesAfter);
+    for (int t = 0; t < OBJ_FREE && length >= 0 && (size_t)length < size; t++) {
+        length += snprintf(buffer + length, size - length, " %s %zu", typeNames[t], cycle->freed[t]);
+    }
+    return length;
+}
+
+// @Note: the summary and then the cycles still in the history
+void gc_report() {
+    fprintf(stderr, "gc: %s, %d thread%s, %d pauses, max %.3f ms, total %.3f ms\n",
+            vm.gcIncremental ? "incremental" : "stop-the-world", vm.gcThreads, vm.gcThreads == 1 ? "" : "s", vm.gcPauseCount,
+            vm.gcMaxPause / 1e6, vm.gcTotalPause / 1e6);
+    int first = vm.gcCycleCount > GC_CYCLE_HISTORY ? vm.gcCycleCount - GC_CYCLE_HISTORY : 0;
+    for (int number = first; number < vm.gcCycleCount; number++) {
+        char line[256];
+        gc_format_cycle(number, line, sizeof(line));
+        fprintf(stderr, "gc: %s\n", line);
+    }
+}
+
+void collect_young() {
+    if (vm.traceFlags & TRACE_GC) printf("-- minor gc begin\n");
+    uint64_t start = now_ns();
+    int number = begin_record(false);
+    mark_roots(true);
+    mark_remembered();
     trace_references();
+    detach_slices();
     table_remove_white(&vm.strings);
-    sweep();
+    forget_remembered();
+    sweep_young(cycle_at(number));
+    end_record(number);
+    record_pause(start, number);
+    if (vm.traceFlags & TRACE_GC) trace_cycle(number);
+}
 
-    vm.nextgc = vm.bytesallocated * GC_HEAP_GROW_FACTOR;
-#ifdef DEBUG_LOG_GC
-    printf("-- gc end\n");
-    printf("   collected %zu bytes (from %zu to %zu), next at %zu", before - vm.bytesallocated, before, vm.bytesallocated, vm.nextgc);
-#endif
+void collect_garbage() {
+    if (vm.traceFlags & TRACE_GC) printf("-- gc begin\n");
+    if (vm.gcThreads > 1 && pool.workers == NULL) start_workers();
+    uint64_t start = now_ns();
+    int number = begin_record(true);
+    clear_marks();
+    mark_roots(false);
+    if (vm.gcThreads > 1) {
+        trace_parallel();
+    } else {
+        trace_references();
+    }
+    detach_slices();
+    forget_remembered();
+    table_remove_white(&vm.strings);
+    finish_major();
+    // @Note: with a single thread the blocks are swept lazily, the workers would only sit idle until the next collection
+    if (vm.gcThreads > 1) sweep_all_parallel();
+    end_record(number);
+    record_pause(start, number);
+    if (vm.traceFlags & TRACE_GC) trace_cycle(number);
 }
@@ -2,6 +2,7 @@
 #define comp_memory_h
 
 #include "common.h"
+#include "object.h"
 #include "value.h"
 
 #define GROW_CAPACITY(capacity) ((capacity) < 8 ? 8 : (capacity) * 2)
@@ -15,8 +16,104 @@
 
 #define ALLOCATE(type, count) (type*)reallocate(NULL, 0, sizeof(type) * (count))
 
+// @Note: young objects are bump allocated out of fixed size blocks. A minor collection is
+// triggered once NURSERY_SIZE bytes were allocated since the last collection.
+#define HEAP_BLOCK_SIZE (32 * 1024)
+#define NURSERY_SIZE (256 * 1024)
+#define LARGE_OBJECT_SIZE (HEAP_BLOCK_SIZE / 4)
+
+// @Note: cells are rounded up to a size class, 16 byte steps up to 256 bytes and then powers of two
+// up to LARGE_OBJECT_SIZE. The cells dead objects leave behind in old blocks go on a free list per
+// class and are handed out again before the nursery is bumped.
+#define SIZE_CLASS_STEP 16
+#define SIZE_CLASS_SMALL_MAX 256
+#define SIZE_CLASS_COUNT 20
+
+// @Note: a dead cell, its type is OBJ_FREE so a walk over a block can tell it from an object
+typedef struct FreeCell {
+	ObjType type;
+	uint32_t size;
+	struct FreeCell* next;
+	struct FreeCell* prev;
+} FreeCell;
+
+// @Note: an incremental major collection marks in slices of at most gcPauseBudget nanoseconds,
+// a slice runs every GC_STEP_SIZE allocated bytes. After a major collection the blocks are swept
+// lazily, when allocation runs out of free cells and one more every GC_STEP_SIZE bytes.
+#define GC_STEP_SIZE (32 * 1024)
+#define GC_PAUSE_BUDGET_DEFAULT (500 * 1000)
+#define GC_THREADS_MAX 64
+
+// @Note: the first major collection runs once the heap reaches GC_INITIAL_HEAP_DEFAULT bytes, the next
+// one once it grew by GC_GROW_FACTOR_DEFAULT over what survived. All three can be set at run time,
+// a heap limit of 0 means none.
+#define GC_INITIAL_HEAP_DEFAULT (1024 * 1024)
+#define GC_GROW_FACTOR_DEFAULT 2.0
+#define GC_HEAP_LIMIT_DEFAULT 0
+
+// @Note: what a collection did, the last GC_CYCLE_HISTORY of them are kept. The bytes are
+// the heap as the collector counts it, garbage that waits to be swept left out.
+#define GC_CYCLE_HISTORY 64
+
+typedef struct {
+	bool isMajor;
+	uint64_t pause; // @Note: summed over the slices of an incremental cycle
+	size_t bytesBefore;
+	size_t bytesAfter;
+	size_t freed[OBJ_FREE]; // @Note: per ObjType, the lazy sweep after a major keeps adding to it
+} GcCycle;
+
+typedef enum {
+	GC_IDLE,
+	GC_MARKING,
+} GcPhase;
+
+// @Note: one mark bit per MARK_GRANULE bytes of the block, for the object starting there
+#define MARK_GRANULE 16
+#define MARK_WORDS (HEAP_BLOCK_SIZE / MARK_GRANULE / 64)
+
+typedef struct HeapBlock {
+	struct HeapBlock* next;
+	struct HeapBlock* prev;
+	struct HeapBlock* youngNext; // @Note: blocks bump allocated into since the last collection
+	struct HeapBlock* sweepNext;
+	uint8_t* top;
+	uint8_t* swept; // @Note: cells from here to top were allocated since the last collection
+	int liveCount;
+	bool isLarge; // @Note: a single object bigger than LARGE_OBJECT_SIZE, the block is as big as needed
+	bool isYoung;
+	bool needsSweep;
+	uint64_t marks[MARK_WORDS];
+} HeapBlock;
+
+#define BLOCK_OF(object) ((HeapBlock*)((uintptr_t)(object) & ~(uintptr_t)(HEAP_BLOCK_SIZE - 1)))
+
+static inline bool is_marked(Obj* object) {
+	HeapBlock* block = BLOCK_OF(object);
+	size_t bit = ((uintptr_t)object - (uintptr_t)block) / MARK_GRANULE;
+	return (block->marks[bit / 64] >> (bit % 64)) & 1;
+}
+
+static inline void set_mark(Obj* object) {
+	HeapBlock* block = BLOCK_OF(object);
+	size_t bit = ((uintptr_t)object - (uintptr_t)block) / MARK_GRANULE;
+	block->marks[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+// @Note: logging every object the collector touches is only compiled into `make debug`,
+// --trace=gc then turns it on next to the line per collection
+#ifdef DEBUG_LOG_GC
+#define GC_LOG_OBJECTS() (vm.traceFlags & TRACE_GC)
+#else
+#define GC_LOG_OBJECTS() false
+#endif
+
 void* reallocate(void* pointer, size_t oldSize, size_t newSize);
 
+void* gc_reallocate(void* pointer, size_t oldSize, size_t newSize);
+
+Obj* allocate_cell(size_t size);
+
 void free_objects();
 
 void mark_object(Obj *object);
@@ -25,4 +122,24 @@ void mark_value(Value value);
 
 void collect_garbage();
 
+void collect_young();
+
+void gc_barrier(Obj* owner, Obj* target);
+
+void gc_track_slice(ObjSlice* slice);
+
+void gc_report();
+
+int gc_format_cycle(int number, char* buffer, size_t size);
+
+// @Note: marks are sticky, between collections a marked object is an old one.
+// Every store of a Value into a heap object has to go through the write barrier. Between
+// collections it remembers old-to-young references for the minor collections, while an incremental
+// major collection is marking it shades the stored object so a black object never points at a white one.
+static inline void gc_write_barrier(Obj* owner, Value value) {
+	if (IS_OBJ(value) && is_marked(owner) && !is_marked(AS_OBJ(value))) {
+		gc_barrier(owner, AS_OBJ(value));
+	}
+}
+
 #endif
@@ -1,6 +1,9 @@
+#include <limits.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -10,37 +13,56 @@
 #define ALLOCATE_OBJ(type, objectType) (type*)allocate_object(sizeof(type), objectType)
 
 static Obj* allocate_object(size_t size, ObjType type) {
-    Obj* object = (Obj*)reallocate(NULL, 0, size);
+    Obj* object = allocate_cell(size);
     object->type = type;
-    object->next = vm.objects;
-    vm.objects = object;
-    object->isMarked = false;
-#ifdef DEBUG_LOG_GC
-    printf("%p allocate %zu for %d\n", (void*)object, size, type);
-#endif
+    if (GC_LOG_OBJECTS()) printf("%p allocate %zu for %d\n", (void*)object, size, type);
     return object;
 }
 
-static uint32_t hash_string(const char* chars, int length) {
-    uint32_t hash = 2166136261u;
-    for (int i = 0; i < length; i++) {
-        hash ^= (uint8_t)chars[i];
-        hash *= 16777619;
+// @Note: the caller fills in the characters
+static ObjString* allocate_string(int length) {
+    ObjString* string = (ObjString*)allocate_object(STRING_SIZE(length), OBJ_STRING);
+    string->length = length;
+    string->isHashed = false;
+    string->isInterned = false;
+    string->chars[length] = '\0';
+    return string;
+}
+
+uint32_t string_hash(ObjString* string) {
+    if (!string->isHashed) {
+        string->hash = hash_chars(string->chars, string->length);
+        string->isHashed = true;
     }
-    return hash;
+    return string->hash;
 }
 
-static ObjString* allocate_string(char* chars, int length, uint32_t hash) {
-    ObjString* string = ALLOCATE_OBJ(ObjString, OBJ_STRING);
-    string->length = length;
-    string->chars = chars;
-    string->hash = hash;
+// @Note: returns the one interned string with these characters, which is `string` itself if
+// there was none yet. Needed before a string is used as a table key.
+ObjString* intern_string(ObjString* string) {
+    if (string->isInterned) return string;
+    uint32_t hash = string_hash(string);
+    ObjString* interned = table_find_string(&vm.strings, string->chars, string->length, hash);
+    if (interned != NULL) return interned;
+    string->isInterned = true;
     push(OBJ_VAL(string));
-    table_set(&vm.strings,string, NIL_VAL());
+    table_set(&vm.strings, string, NIL_VAL());
     pop();
     return string;
 }
 
+// @Note: a and b are strings or slices and two different objects, interned strings are equal just when they are the same
+bool strings_equal(Obj* a, Obj* b) {
+    if (flat_length(a) != flat_length(b)) return false;
+    if (a->type == OBJ_STRING && b->type == OBJ_STRING) {
+        ObjString* left = (ObjString*)a;
+        ObjString* right = (ObjString*)b;
+        if (left->isInterned && right->isInterned) return false;
+        if (left->isHashed && right->isHashed && left->hash != right->hash) return false;
+    }
+    return chars_equal(flat_chars(a), flat_chars(b), flat_length(a));
+}
+
 static void print_func(ObjFunction* func) {
     if (func->name == NULL) {
         printf("<script>");
@@ -49,15 +71,150 @@ static void print_func(ObjFunction* func) {
     printf("<fn %s>", func->name->chars);
 }
 
+// @Note: for the program text and names, which are looked up by their characters
 ObjString* copy_string(const char* chars, int length) {
-    // char* heapChars = reallocate(NULL, 0, sizeof(char) * (length + 1));
-    char* heapChars = ALLOCATE(char, length + 1);
-    uint32_t hash = hash_string(chars, length);
+    uint32_t hash = hash_chars(chars, length);
     ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
     if (interned != NULL) return interned;
-    memcpy(heapChars, chars, length);
-    heapChars[length] = '\0';
-    return allocate_string(heapChars, length, hash);
+    ObjString* string = allocate_string(length);
+    memcpy(string->chars, chars, length);
+    string->hash = hash;
+    string->isHashed = true;
+    return intern_string(string);
+}
+
+// @Note: for strings made at run time, neither hashed nor interned until something needs it
+ObjString* new_string(const char* chars, int length) {
+    ObjString* string = allocate_string(length);
+    memcpy(string->chars, chars, length);
+    return string;
+}
+
+typedef void (*PieceFn)(const char* chars, int length, void* context);
+
+#define ROPE_WALK_STACK 64
+
+// @Note: visits the pieces of a string or rope left to right. A rope built in a loop is about as deep
+// as it has pieces, so the walk keeps its own stack instead of recursing. Past ROPE_WALK_STACK it grows
+// through reallocate, which may collect or fail with the usual error, so the rope has to be reachable.
+static void rope_pieces(Obj* string, PieceFn visit, void* context) {
+    Obj* local[ROPE_WALK_STACK];
+    Obj** stack = local;
+    int capacity = ROPE_WALK_STACK;
+    int count = 0;
+    stack[count++] = string;
+    while (count > 0) {
+        Obj* node = stack[--count];
+        if (node->type == OBJ_ROPE && ((ObjRope*)node)->flat != NULL) {
+            node = (Obj*)((ObjRope*)node)->flat;
+        }
+        if (node->type != OBJ_ROPE) {
+            visit(flat_chars(node), flat_length(node), context);
+            continue;
+        }
+        if (capacity < count + 2) {
+            int oldCapacity = capacity;
+            capacity = GROW_CAPACITY(capacity);
+            if (stack == local) {
+                stack = GROW_ARRAY(Obj*, NULL, 0, capacity);
+                memcpy(stack, local, sizeof(Obj*) * count);
+            } else {
+                stack = GROW_ARRAY(Obj*, stack, oldCapacity, capacity);
+            }
+        }
+        stack[count++] = ((ObjRope*)node)->right;
+        stack[count++] = ((ObjRope*)node)->left;
+    }
+    if (stack != local) FREE_ARRAY(Obj*, stack, capacity);
+}
+
+typedef struct {
+    char* chars;
+    int offset;
+} PieceCursor;
+
+static void copy_piece(const char* chars, int length, void* context) {
+    PieceCursor* cursor = (PieceCursor*)context;
+    memcpy(cursor->chars + cursor->offset, chars, length);
+    cursor->offset += length;
+}
+
+static void print_piece(const char* chars, int length, void* context) {
+    (void)context;
+    printf("%.*s", length, chars);
+}
+
+static Obj* unwrap_rope(Obj* string) {
+    if (string->type == OBJ_ROPE && ((ObjRope*)string)->flat != NULL) {
+        return (Obj*)((ObjRope*)string)->flat;
+    }
+    return string;
+}
+
+static int string_length(Obj* string) {
+    if (string->type == OBJ_ROPE) return ((ObjRope*)string)->length;
+    return flat_length(string);
+}
+
+// @Note: a and b are strings or ropes and have to be reachable, allocating the result may collect.
+// NULL when the result would be longer than a length can hold, doubling a rope gets there quickly.
+Obj* concat_strings(Obj* a, Obj* b) {
+    a = unwrap_rope(a);
+    b = unwrap_rope(b);
+    int aLength = string_length(a);
+    int bLength = string_length(b);
+    if (aLength == 0) return b;
+    if (bLength == 0) return a;
+    if (aLength > INT_MAX - bLength) return NULL;
+    if (aLength + bLength < ROPE_MIN_LENGTH) {
+        // every rope is longer than this, both are strings or slices
+        ObjString* string = allocate_string(aLength + bLength);
+        memcpy(string->chars, flat_chars(a), aLength);
+        memcpy(string->chars + aLength, flat_chars(b), bLength);
+        return (Obj*)string;
+    }
+    ObjRope* rope = ALLOCATE_OBJ(ObjRope, OBJ_ROPE);
+    rope->length = aLength + bLength;
+    rope->left = a;
+    rope->right = b;
+    rope->flat = NULL;
+    gc_write_barrier((Obj*)rope, OBJ_VAL(a));
+    gc_write_barrier((Obj*)rope, OBJ_VAL(b));
+    return (Obj*)rope;
+}
+
+// @Note: the rope has to be reachable. It keeps pointing at the flat string and lets go of its pieces.
+ObjString* flatten_rope(ObjRope* rope) {
+    if (rope->flat != NULL) return rope->flat;
+    ObjString* string = allocate_string(rope->length);
+    // @Note: hung on the rope before the walk, which may collect. The pieces are walked from the children,
+    // the rope itself already reads as the unfinished string.
+    rope->flat = string;
+    gc_write_barrier((Obj*)rope, OBJ_VAL(string));
+    PieceCursor cursor = {string->chars, 0};
+    rope_pieces(rope->left, copy_piece, &cursor);
+    rope_pieces(rope->right, copy_piece, &cursor);
+    rope->left = NULL;
+    rope->right = NULL;
+    return string;
+}
+
+// @Note: string is a string, slice or rope and has to be reachable, start and length have to be in range
+Obj* new_slice(Obj* string, int start, int length) {
+    if (string->type == OBJ_ROPE) string = (Obj*)flatten_rope((ObjRope*)string);
+    if (length == flat_length(string)) return string;
+    if (length < SLICE_MIN_LENGTH) return (Obj*)new_string(flat_chars(string) + start, length);
+    ObjSlice* slice = ALLOCATE_OBJ(ObjSlice, OBJ_SLICE);
+    // @Note: read after allocating, the collection may have given a slice its own characters
+    Obj* parent = string;
+    // a slice of a slice shares the parent rather than pointing at the slice
+    if (string->type == OBJ_SLICE && ((ObjSlice*)string)->parent != NULL) parent = ((ObjSlice*)string)->parent;
+    slice->length = length;
+    slice->chars = flat_chars(string) + start;
+    slice->parent = parent;
+    gc_write_barrier((Obj*)slice, OBJ_VAL(parent));
+    gc_track_slice(slice);
+    return (Obj*)slice;
 }
 
 ObjUpvalue* new_upvalue(Value* slot) {
@@ -75,24 +232,19 @@ void print_obj(Value value) {
         case OBJ_NATIVE: printf("<native fn>"); break;
         case OBJ_CLOSURE: print_func(AS_CLOSURE(value)->fn); break;
         case OBJ_UPVALUE: printf("upvalue"); break;
+        case OBJ_ROPE: rope_pieces(AS_OBJ(value), print_piece, NULL); break;
+        case OBJ_SLICE: printf("%.*s", AS_SLICE(value)->length, AS_SLICE(value)->chars); break;
+        case OBJ_FREE: break;
     }
 }
 
-ObjString* take_string(char* chars, int length) {
-    uint32_t hash = hash_string(chars, length);
-    ObjString* interned = table_find_string(&vm.strings, chars, length, hash);
-    if (interned != NULL) {
-        FREE_ARRAY(char, chars, length + 1);
-        return interned;
-    }
-    return allocate_string(chars, length, hash);
-}
-
 ObjFunction* new_function() {
     ObjFunction* func = ALLOCATE_OBJ(ObjFunction, OBJ_FUNCTION);
     func->arity = 0;
     func->name = NULL;
     func->upvalueCount = 0;
+    func->registers = 0;
+    func->maxStack = 0;
     init_chunk(&func->chunk);
     return func;
 }
@@ -106,13 +258,12 @@ ObjNative* new_native(NativeFn fn) {
 }
 
 ObjClosure* new_closure(ObjFunction* fn) {
-    ObjUpvalue** uvs = ALLOCATE(ObjUpvalue*, fn->upvalueCount);
+    ObjClosure* closure = (ObjClosure*)allocate_object(CLOSURE_SIZE(fn->upvalueCount), OBJ_CLOSURE);
+    closure->upvalueCount = fn->upvalueCount;
     for (int i = 0; i < fn->upvalueCount; i++) {
-        uvs[i] = NULL;
+        closure->upvalues[i] = NULL;
     }
-    ObjClosure* closure = ALLOCATE_OBJ(ObjClosure, OBJ_CLOSURE);
-    closure->upvalues = uvs;
-    closure->upvalueCount = fn->upvalueCount;
     closure->fn = fn;
+    gc_write_barrier((Obj*)closure, OBJ_VAL(fn));
     return closure;
 }
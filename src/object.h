@@ -10,11 +10,17 @@
 #define IS_FUNCTION(value) is_obj_type(value, OBJ_FUNCTION)
 #define IS_NATIVE(value) is_obj_type(value, OBJ_NATIVE)
 #define IS_CLOSURE(value) is_obj_type(value, OBJ_CLOSURE)
+#define IS_ROPE(value) is_obj_type(value, OBJ_ROPE)
+#define IS_SLICE(value) is_obj_type(value, OBJ_SLICE)
+#define IS_FLAT_STRING(value) (IS_STRING(value) || IS_SLICE(value))
+#define IS_ANY_STRING(value) (IS_FLAT_STRING(value) || IS_ROPE(value))
 #define AS_STRING(value) ((ObjString*)AS_OBJ(value))
 #define AS_CSTRING(value) (((ObjString*)AS_OBJ(value))->chars)
 #define AS_FUNCTION(value) ((ObjFunction*)AS_OBJ(value))
 #define AS_NATIVE(value) (((ObjNative*)AS_OBJ(value))->fn)
 #define AS_CLOSURE(value) ((ObjClosure*)AS_OBJ(value))
+#define AS_ROPE(value) ((ObjRope*)AS_OBJ(value))
+#define AS_SLICE(value) ((ObjSlice*)AS_OBJ(value))
 
 typedef enum {
 	OBJ_STRING,
@@ -22,12 +28,15 @@ typedef enum {
 	OBJ_NATIVE,
 	OBJ_CLOSURE,
 	OBJ_UPVALUE,
+	OBJ_ROPE,
+	OBJ_SLICE,
+	OBJ_FREE, // @Note: not an object, a dead heap cell
 } ObjType;
 
+// @Note: objects live in heap blocks which keep their mark bits on the side, see memory.h
 struct Obj {
 	ObjType type;
-	struct Obj* next;
-	bool isMarked;
+	bool isRemembered;
 };
 
 typedef struct ObjFunction {
@@ -35,6 +44,8 @@ typedef struct ObjFunction {
 	int arity;
 	Chunk chunk;
 	int upvalueCount;
+	int registers; // @Note: the frame size of a register tier function, 0 for the stack tier
+	int maxStack; // @Note: the most values a stack tier frame holds at once, 0 for the register tier
 	ObjString* name;
 } ObjFunction;
 
@@ -45,13 +56,48 @@ typedef struct {
 	NativeFn fn;
 } ObjNative;
 
+// @Note: only the strings of the program text and names are interned when they are made. Strings
+// built at run time start out unhashed and uninterned, see intern_string and strings_equal.
 struct ObjString {
 	Obj obj;
 	int length;
-	char* chars;
-	uint32_t hash;
+	uint32_t hash; // @Note: only valid once isHashed is set, see string_hash
+	bool isHashed;
+	bool isInterned;
+	char chars[]; // @Note: allocated inline and nul terminated, see STRING_SIZE
 };
 
+#define STRING_SIZE(length) (sizeof(ObjString) + (length) + 1)
+
+// @Note: `+` on long strings makes a rope instead of copying, so building a string in a loop
+// stays linear. A rope is flattened the first time it is compared, printing walks the pieces.
+// Shorter results are copied right away.
+#define ROPE_MIN_LENGTH 64
+
+typedef struct {
+	Obj obj;
+	int length;
+	Obj* left; // @Note: ObjString or ObjRope, both NULL once flattened
+	Obj* right;
+	ObjString* flat;
+} ObjRope;
+
+// @Note: substr, trim and split return a view into the characters of their argument instead of
+// a copy. Results shorter than SLICE_MIN_LENGTH are copied, a slice costs as much as those.
+#define SLICE_MIN_LENGTH 16
+
+// @Note: a slice keeps its parent alive unless it is a small part of a big one, see slice_may_detach.
+// A slice that outlives such a parent gets its own copy of the characters during the collection.
+#define SLICE_DETACH_PARENT_LENGTH 1024
+#define SLICE_DETACH_RATIO 8
+
+typedef struct {
+	Obj obj;
+	int length;
+	const char* chars; // @Note: into the parent, or owned by the slice once parent is NULL
+	Obj* parent; // @Note: an ObjString or a slice that owns its characters
+} ObjSlice;
+
 typedef struct ObjUpvalue {
 	Obj obj;
 	Value* location;
@@ -63,21 +109,50 @@ typedef struct ObjUpvalue {
 typedef struct {
 	Obj obj;
 	ObjFunction* fn;
-	ObjUpvalue** upvalues;
 	int upvalueCount;
+	ObjUpvalue* upvalues[]; // @Note: allocated inline, see new_closure
 } ObjClosure;
 
+#define CLOSURE_SIZE(upvalueCount) (sizeof(ObjClosure) + sizeof(ObjUpvalue*) * (upvalueCount))
+
 static inline bool is_obj_type(Value value, ObjType type) {
 	return IS_OBJ(value) && AS_OBJ(value)->type == type;
 }
 
+static inline int flat_length(Obj* string) {
+	if (string->type == OBJ_SLICE) return ((ObjSlice*)string)->length;
+	return ((ObjString*)string)->length;
+}
+
+static inline const char* flat_chars(Obj* string) {
+	if (string->type == OBJ_SLICE) return ((ObjSlice*)string)->chars;
+	return ((ObjString*)string)->chars;
+}
+
+static inline bool slice_may_detach(ObjSlice* slice) {
+	int parentLength = flat_length(slice->parent);
+	return parentLength >= SLICE_DETACH_PARENT_LENGTH && slice->length < parentLength / SLICE_DETACH_RATIO;
+}
+
 ObjString* copy_string(const char* chars, int length);
 
+ObjString* new_string(const char* chars, int length);
+
+uint32_t string_hash(ObjString* string);
+
+ObjString* intern_string(ObjString* string);
+
+bool strings_equal(Obj* a, Obj* b);
+
 ObjUpvalue* new_upvalue(Value* slot);
 
 void print_obj(Value value);
 
-ObjString* take_string(char* chars, int length);
+Obj* concat_strings(Obj* a, Obj* b);
+
+ObjString* flatten_rope(ObjRope* rope);
+
+Obj* new_slice(Obj* string, int start, int length);
 
 ObjFunction* new_function();
 
@@ -0,0 +1,262 @@
+#include <string.h>
+
+#include "optimize.h"
+
+// @Note: only what the VM would compute the same way on every run is folded: arithmetic and
+// comparisons on number literals, `+` on string literals, `!` and `==` on any literal. Anything
+// that could raise a runtime error, like `-"a"` or `1 < nil`, is left for the VM to report.
+
+typedef enum {
+	CONST_NONE,
+	CONST_NUMBER,
+	CONST_STRING,
+	CONST_TRUE,
+	CONST_FALSE,
+	CONST_NIL,
+} ConstKind;
+
+static ConstKind const_kind(Expr* expr) {
+    if (expr == NULL) return CONST_NONE;
+    switch (expr->type) {
+        case EXPR_NUMBER: return CONST_NUMBER;
+        case EXPR_STRING: return CONST_STRING;
+        case EXPR_LITERAL:
+            switch (expr->token.type) {
+                case TOKEN_TRUE: return CONST_TRUE;
+                case TOKEN_FALSE: return CONST_FALSE;
+                case TOKEN_NIL: return CONST_NIL;
+                default: return CONST_NONE;
+            }
+        default: return CONST_NONE;
+    }
+}
+
+static bool const_falsey(ConstKind kind) {
+    return kind == CONST_NIL || kind == CONST_FALSE;
+}
+
+static bool consts_equal(Expr* a, Expr* b) {
+    ConstKind kind = const_kind(a);
+    if (kind != const_kind(b)) return false;
+    switch (kind) {
+        case CONST_NUMBER: return ((NumberExpr*)a)->value == ((NumberExpr*)b)->value;
+        case CONST_STRING: {
+            StringExpr* s1 = (StringExpr*)a;
+            StringExpr* s2 = (StringExpr*)b;
+            return s1->length == s2->length && memcmp(s1->chars, s2->chars, s1->length) == 0;
+        }
+        default: return true;
+    }
+}
+
+// @Note: the folded node keeps the operator's token, so its line still goes with the instruction
+static Expr* bool_expr(Token token, bool value) {
+    token.type = value ? TOKEN_TRUE : TOKEN_FALSE;
+    token.start = value ? "true" : "false";
+    token.length = value ? 4 : 5;
+    return new_expr(sizeof(Expr), EXPR_LITERAL, token);
+}
+
+static Expr* number_expr(Token token, double value) {
+    NumberExpr* expr = NEW_EXPR(NumberExpr, EXPR_NUMBER, token);
+    expr->value = value;
+    return (Expr*)expr;
+}
+
+static Expr* fold_expr(Expr* expr);
+
+static Expr* fold_unary(UnaryExpr* expr) {
+    expr->operand = fold_expr(expr->operand);
+    ConstKind kind = const_kind(expr->operand);
+    if (expr->base.token.type == TOKEN_MINUS && kind == CONST_NUMBER) {
+        return number_expr(expr->base.token, -((NumberExpr*)expr->operand)->value);
+    }
+    if (expr->base.token.type == TOKEN_BANG && kind != CONST_NONE) {
+        return bool_expr(expr->base.token, const_falsey(kind));
+    }
+    return (Expr*)expr;
+}
+
+static Expr* fold_binary(BinaryExpr* expr) {
+    expr->left = fold_expr(expr->left);
+    expr->right = fold_expr(expr->right);
+    ConstKind left = const_kind(expr->left);
+    ConstKind right = const_kind(expr->right);
+    if (left == CONST_NONE || right == CONST_NONE) return (Expr*)expr;
+
+    Token token = expr->base.token;
+    switch (token.type) {
+        case TOKEN_EQ_EQ: return bool_expr(token, consts_equal(expr->left, expr->right));
+        case TOKEN_BANG_EQ: return bool_expr(token, !consts_equal(expr->left, expr->right));
+        default: break;
+    }
+
+    if (left == CONST_STRING && right == CONST_STRING && token.type == TOKEN_PLUS) {
+        StringExpr* s1 = (StringExpr*)expr->left;
+        StringExpr* s2 = (StringExpr*)expr->right;
+        char* chars = (char*)ast_alloc(s1->length + s2->length);
+        memcpy(chars, s1->chars, s1->length);
+        memcpy(chars + s1->length, s2->chars, s2->length);
+        StringExpr* string = NEW_EXPR(StringExpr, EXPR_STRING, token);
+        string->chars = chars;
+        string->length = s1->length + s2->length;
+        return (Expr*)string;
+    }
+
+    if (left != CONST_NUMBER || right != CONST_NUMBER) return (Expr*)expr;
+    double a = ((NumberExpr*)expr->left)->value;
+    double b = ((NumberExpr*)expr->right)->value;
+    switch (token.type) {
+        case TOKEN_PLUS: return number_expr(token, a + b);
+        case TOKEN_MINUS: return number_expr(token, a - b);
+        case TOKEN_STAR: return number_expr(token, a * b);
+        case TOKEN_SLASH: return number_expr(token, a / b);
+        case TOKEN_GREATER: return bool_expr(token, a > b);
+        case TOKEN_LESS: return bool_expr(token, a < b);
+        // @Note: these run as OP_LESS, OP_NOT and OP_GREATER, OP_NOT, which matters for NaN
+        case TOKEN_GEQ: return bool_expr(token, !(a < b));
+        case TOKEN_LEQ: return bool_expr(token, !(a > b));
+        default: return (Expr*)expr;
+    }
+}
+
+// @Note: `and` and `or` leave their left side when it decides the result, and the right side otherwise
+static Expr* fold_logical(BinaryExpr* expr) {
+    expr->left = fold_expr(expr->left);
+    expr->right = fold_expr(expr->right);
+    ConstKind left = const_kind(expr->left);
+    if (left == CONST_NONE) return (Expr*)expr;
+
+    bool falsey = const_falsey(left);
+    if (expr->base.token.type == TOKEN_AND) {
+        return falsey ? expr->left : expr->right;
+    }
+    return falsey ? expr->right : expr->left;
+}
+
+static Expr* fold_expr(Expr* expr) {
+    if (expr == NULL) return NULL;
+    switch (expr->type) {
+        case EXPR_UNARY: return fold_unary((UnaryExpr*)expr);
+        case EXPR_BINARY: return fold_binary((BinaryExpr*)expr);
+        case EXPR_LOGICAL: return fold_logical((BinaryExpr*)expr);
+        case EXPR_ASSIGN: {
+            AssignExpr* assign = (AssignExpr*)expr;
+            assign->value = fold_expr(assign->value);
+            return expr;
+        }
+        case EXPR_CALL: {
+            CallExpr* call = (CallExpr*)expr;
+            call->callee = fold_expr(call->callee);
+            for (int i = 0; i < call->argCount; i++) {
+                call->args[i] = fold_expr(call->args[i]);
+            }
+            return expr;
+        }
+        default: return expr;
+    }
+}
+
+static Stmt* optimize_stmt(Stmt* stmt);
+
+// @Note: control never gets past a return, or a block or if that returns on every path
+static bool always_returns(Stmt* stmt) {
+    if (stmt == NULL) return false;
+    switch (stmt->type) {
+        case STMT_RETURN: return true;
+        case STMT_BLOCK: {
+            StmtList* body = &((BlockStmt*)stmt)->body;
+            return body->count > 0 && always_returns(body->items[body->count - 1]);
+        }
+        case STMT_IF: {
+            IfStmt* ifStmt = (IfStmt*)stmt;
+            return always_returns(ifStmt->thenBranch) && always_returns(ifStmt->elseBranch);
+        }
+        default: return false;
+    }
+}
+
+static void optimize_list(StmtList* list) {
+    int count = 0;
+    for (int i = 0; i < list->count; i++) {
+        Stmt* stmt = optimize_stmt(list->items[i]);
+        if (stmt == NULL) continue;
+        list->items[count++] = stmt;
+        if (always_returns(stmt)) break;
+    }
+    list->count = count;
+}
+
+static Stmt* optimize_if(IfStmt* stmt) {
+    stmt->condition = fold_expr(stmt->condition);
+    stmt->thenBranch = optimize_stmt(stmt->thenBranch);
+    stmt->elseBranch = optimize_stmt(stmt->elseBranch);
+    ConstKind kind = const_kind(stmt->condition);
+    if (kind == CONST_NONE) return (Stmt*)stmt;
+    return const_falsey(kind) ? stmt->elseBranch : stmt->thenBranch;
+}
+
+static Stmt* optimize_while(WhileStmt* stmt) {
+    stmt->condition = fold_expr(stmt->condition);
+    stmt->body = optimize_stmt(stmt->body);
+    ConstKind kind = const_kind(stmt->condition);
+    if (kind == CONST_NONE) return (Stmt*)stmt;
+    if (const_falsey(kind)) return NULL;
+    stmt->condition = NULL;
+    return (Stmt*)stmt;
+}
+
+static Stmt* optimize_for(ForStmt* stmt) {
+    stmt->init = optimize_stmt(stmt->init);
+    stmt->condition = fold_expr(stmt->condition);
+    stmt->increment = fold_expr(stmt->increment);
+    stmt->body = optimize_stmt(stmt->body);
+    ConstKind kind = const_kind(stmt->condition);
+    if (kind == CONST_NONE) return (Stmt*)stmt;
+    if (!const_falsey(kind)) {
+        stmt->condition = NULL;
+        return (Stmt*)stmt;
+    }
+    // @Note: the initializer still runs once, in a scope of its own like the loop gave it
+    if (stmt->init == NULL) return NULL;
+    BlockStmt* block = NEW_STMT(BlockStmt, STMT_BLOCK, stmt->base.token);
+    stmt_list_add(&block->body, stmt->init);
+    return (Stmt*)block;
+}
+
+// @Note: returns the statement to emit in place of stmt, NULL when nothing is left of it
+static Stmt* optimize_stmt(Stmt* stmt) {
+    if (stmt == NULL) return NULL;
+    switch (stmt->type) {
+        case STMT_EXPRESSION: {
+            ExprStmt* exprStmt = (ExprStmt*)stmt;
+            exprStmt->expr = fold_expr(exprStmt->expr);
+            return const_kind(exprStmt->expr) != CONST_NONE ? NULL : stmt;
+        }
+        case STMT_PRINT:
+            ((ExprStmt*)stmt)->expr = fold_expr(((ExprStmt*)stmt)->expr);
+            return stmt;
+        case STMT_LET:
+            ((LetStmt*)stmt)->init = fold_expr(((LetStmt*)stmt)->init);
+            return stmt;
+        case STMT_FUN:
+            optimize_list(&((FunStmt*)stmt)->body);
+            return stmt;
+        case STMT_BLOCK: {
+            StmtList* body = &((BlockStmt*)stmt)->body;
+            optimize_list(body);
+            return body->count == 0 ? NULL : stmt;
+        }
+        case STMT_IF: return optimize_if((IfStmt*)stmt);
+        case STMT_WHILE: return optimize_while((WhileStmt*)stmt);
+        case STMT_FOR: return optimize_for((ForStmt*)stmt);
+        case STMT_RETURN:
+            ((ReturnStmt*)stmt)->value = fold_expr(((ReturnStmt*)stmt)->value);
+            return stmt;
+    }
+    return stmt;
+}
+
+void optimize(StmtList* program) {
+    optimize_list(program);
+}
@@ -0,0 +1,9 @@
+#ifndef comp_optimize_h
+#define comp_optimize_h
+
+#include "ast.h"
+
+// @Note: folds constant expressions and drops the code they make unreachable, in place
+void optimize(StmtList* program);
+
+#endif // comp_optimize_h
@@ -0,0 +1,382 @@
+#include <string.h>
+
+#include "memory.h"
+#include "object.h"
+#include "peephole.h"
+
+// @Note: the chunk is decoded into a list of instructions. The rewrites only mark instructions dead
+// or change their opcode and target, then the live ones are written back. Until then a jump points
+// at an instruction rather than an offset, so dropping code never has to patch it, and every jump
+// gets the short or the OP_WIDE form again for its new distance. Every byte of an instruction is
+// written with its line, so runtime errors still point at the right one.
+
+// @Note: how many jumps in a row a jump is threaded through
+#define THREAD_LIMIT 16
+
+typedef struct {
+	uint8_t op;
+	int start; // @Note: offset in the old code, anything but a jump is copied from there as it was
+	int length;
+	int line;
+	int target; // @Note: the instruction a jump lands on, -1 for the rest
+	bool isTarget;
+	bool live;
+	bool reached;
+	int offset; // @Note: offset in the new code
+	bool wide; // @Note: whether the jump needs OP_WIDE in the new code
+} Instr;
+
+static bool is_jump(uint8_t op) {
+    switch (op) {
+        case OP_JUMP:
+        case OP_LOOP:
+        case OP_JUMP_IF_FALSE:
+        case OP_JUMP_IF_NOT_EQ:
+        case OP_JUMP_IF_NOT_NEQ:
+        case OP_JUMP_IF_NOT_LESS:
+        case OP_JUMP_IF_NOT_GREATER:
+        case OP_JUMP_IF_NOT_GEQ:
+        case OP_JUMP_IF_NOT_LEQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+static bool is_unconditional(uint8_t op) {
+    return op == OP_JUMP || op == OP_LOOP;
+}
+
+static uint8_t fused_jump(uint8_t compare) {
+    switch (compare) {
+        case OP_EQ: return OP_JUMP_IF_NOT_EQ;
+        case OP_NEQ: return OP_JUMP_IF_NOT_NEQ;
+        case OP_LESS: return OP_JUMP_IF_NOT_LESS;
+        case OP_GREATER: return OP_JUMP_IF_NOT_GREATER;
+        case OP_GEQ: return OP_JUMP_IF_NOT_GEQ;
+        case OP_LEQ: return OP_JUMP_IF_NOT_LEQ;
+        default: return 0;
+    }
+}
+
+// @Note: pushes a value without any other effect
+static bool is_pure_push(uint8_t op) {
+    switch (op) {
+        case OP_NIL:
+        case OP_TRUE:
+        case OP_FALSE:
+        case OP_CONSTANT:
+        case OP_GET_LOCAL:
+        case OP_GET_UPVALUE:
+            return true;
+        default:
+            return false;
+    }
+}
+
+// @Note: offset is the opcode, after OP_WIDE when there is one
+static uint32_t read_operand(Chunk* chunk, int offset, bool wide) {
+    if (!wide) return chunk->code[offset + 1];
+    return chunk->code[offset + 1] | (chunk->code[offset + 2] << 8) | (chunk->code[offset + 3] << 16);
+}
+
+static int decode(Chunk* chunk, Instr* code) {
+    int* indexAt = ALLOCATE(int, chunk->count);
+    int count = 0;
+    for (int offset = 0; offset < chunk->count;) {
+        bool wide = chunk->code[offset] == OP_WIDE;
+        int opOffset = offset + (wide ? 1 : 0);
+        Instr* instr = &code[count];
+        instr->op = chunk->code[opOffset];
+        instr->start = offset;
+        instr->length = instruction_length(chunk, offset);
+        instr->line = chunk->lines[offset];
+        instr->target = -1;
+        instr->isTarget = false;
+        instr->live = true;
+        instr->wide = false;
+        indexAt[offset] = count++;
+        offset += instr->length;
+    }
+
+    for (int i = 0; i < count; i++) {
+        Instr* instr = &code[i];
+        if (!is_jump(instr->op)) continue;
+        bool wide = chunk->code[instr->start] == OP_WIDE;
+        int opOffset = instr->start + (wide ? 1 : 0);
+        uint32_t distance = wide ? read_operand(chunk, opOffset, true)
+            : (uint32_t) ((chunk->code[opOffset + 1] << 8) | chunk->code[opOffset + 2]);
+        int next = instr->start + instr->length;
+        instr->target = indexAt[instr->op == OP_LOOP ? next - (int) distance : next + (int) distance];
+    }
+    FREE_ARRAY(int, indexAt, chunk->count);
+    return count;
+}
+
+// @Note: the first live instruction from i on, where a jump to a dropped instruction lands
+static int resolve(Instr* code, int count, int i) {
+    while (i < count && !code[i].live) i++;
+    return i;
+}
+
+static int next_live(Instr* code, int count, int i) {
+    return resolve(code, count, i + 1);
+}
+
+static void mark_targets(Instr* code, int count) {
+    for (int i = 0; i < count; i++) code[i].isTarget = false;
+    for (int i = 0; i < count; i++) {
+        if (!code[i].live || code[i].target == -1) continue;
+        code[i].target = resolve(code, count, code[i].target);
+        code[code[i].target].isTarget = true;
+    }
+}
+
+// @Note: OP_LESS, OP_NOT is OP_GEQ and so on
+static bool collapse_negations(Instr* code, int count) {
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        if (!code[i].live) continue;
+        int j = next_live(code, count, i);
+        if (j == count || code[j].op != OP_NOT || code[j].isTarget) continue;
+        switch (code[i].op) {
+            case OP_EQ: code[i].op = OP_NEQ; break;
+            case OP_LESS: code[i].op = OP_GEQ; break;
+            case OP_GREATER: code[i].op = OP_LEQ; break;
+            default: continue;
+        }
+        code[j].live = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// @Note: `if` and `while` test their condition with OP_JUMP_IF_FALSE and pop it again first thing
+// on either path. After a comparison all three become one instruction that skips both pops.
+static bool fuse_compare_jumps(Instr* code, int count) {
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        if (!code[i].live || fused_jump(code[i].op) == 0) continue;
+        int jump = next_live(code, count, i);
+        if (jump == count || code[jump].op != OP_JUMP_IF_FALSE || code[jump].isTarget) continue;
+        int pop = next_live(code, count, jump);
+        if (pop == count || code[pop].op != OP_POP || code[pop].isTarget) continue;
+        int target = code[jump].target;
+        if (code[target].op != OP_POP) continue;
+
+        code[i].op = fused_jump(code[i].op);
+        code[i].target = next_live(code, count, target);
+        code[jump].live = false;
+        code[pop].live = false;
+        changed = true;
+    }
+    return changed;
+}
+
+// @Note: a jump to a jump goes straight to where that one goes. OP_JUMP_IF_FALSE can also go
+// through another one, the value it tests is still on the stack. Conditional jumps only go forward.
+static bool thread_jumps(Instr* code, int count) {
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        if (!code[i].live || code[i].target == -1) continue;
+        for (int hops = 0; hops < THREAD_LIMIT; hops++) {
+            int target = code[i].target;
+            Instr* next = &code[target];
+            bool follows = is_unconditional(next->op) ||
+                (code[i].op == OP_JUMP_IF_FALSE && next->op == OP_JUMP_IF_FALSE);
+            if (!follows || next->target == target) break;
+            if (!is_unconditional(code[i].op) && next->target <= i) break;
+            code[i].target = next->target;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+// @Note: jumps to the next instruction, and values pushed only to be popped again
+static bool drop_noops(Instr* code, int count) {
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        if (!code[i].live) continue;
+        int j = next_live(code, count, i);
+        if ((is_unconditional(code[i].op) || code[i].op == OP_JUMP_IF_FALSE) && code[i].target == j) {
+            code[i].live = false;
+            changed = true;
+        } else if (is_pure_push(code[i].op) && j < count && code[j].op == OP_POP && !code[j].isTarget) {
+            code[i].live = false;
+            code[j].live = false;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static bool drop_unreachable(Instr* code, int count) {
+    int* work = ALLOCATE(int, count);
+    int pending = 0;
+    for (int i = 0; i < count; i++) code[i].reached = false;
+    int entry = resolve(code, count, 0);
+    if (entry < count) {
+        code[entry].reached = true;
+        work[pending++] = entry;
+    }
+    while (pending > 0) {
+        int i = work[--pending];
+        int successors[2];
+        int n = 0;
+        if (code[i].target != -1) successors[n++] = code[i].target;
+        if (!is_unconditional(code[i].op) && code[i].op != OP_RETURN) successors[n++] = next_live(code, count, i);
+        for (int s = 0; s < n; s++) {
+            int next = successors[s];
+            if (next < count && !code[next].reached) {
+                code[next].reached = true;
+                work[pending++] = next;
+            }
+        }
+    }
+    FREE_ARRAY(int, work, count);
+
+    bool changed = false;
+    for (int i = 0; i < count; i++) {
+        if (code[i].live && !code[i].reached) {
+            code[i].live = false;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+static int encoded_length(Instr* instr) {
+    if (!is_jump(instr->op)) return instr->length;
+    return instr->wide ? 5 : 3;
+}
+
+// @Note: starts with every jump short and widens the ones that do not reach, until none has to be.
+// A jump only ever gets longer here, so this stops.
+static int layout(Instr* code, int count) {
+    for (;;) {
+        int offset = 0;
+        for (int i = 0; i < count; i++) {
+            if (!code[i].live) continue;
+            code[i].offset = offset;
+            offset += encoded_length(&code[i]);
+        }
+        bool grew = false;
+        for (int i = 0; i < count; i++) {
+            if (!code[i].live || code[i].target == -1 || code[i].wide) continue;
+            int next = code[i].offset + encoded_length(&code[i]);
+            int distance = code[code[i].target].offset - next;
+            if (distance < 0) distance = -distance;
+            if (distance > UINT16_MAX) {
+                code[i].wide = true;
+                grew = true;
+            }
+        }
+        if (!grew) return offset;
+    }
+}
+
+static void encode(Chunk* chunk, Instr* code, int count) {
+    int length = layout(code, count);
+    uint8_t* bytes = ALLOCATE(uint8_t, length);
+    int* lines = ALLOCATE(int, length);
+
+    int at = 0;
+    for (int i = 0; i < count; i++) {
+        Instr* instr = &code[i];
+        if (!instr->live) continue;
+        int size = encoded_length(instr);
+        for (int b = 0; b < size; b++) lines[at + b] = instr->line;
+        if (!is_jump(instr->op)) {
+            memcpy(bytes + at, chunk->code + instr->start, size);
+            // @Note: the opcode may have been rewritten, a collapsed comparison for one
+            bytes[at + (chunk->code[instr->start] == OP_WIDE ? 1 : 0)] = instr->op;
+            at += size;
+            continue;
+        }
+
+        int next = instr->offset + size;
+        int distance = code[instr->target].offset - next;
+        uint8_t op = instr->op;
+        if (is_unconditional(op)) {
+            op = distance >= 0 ? OP_JUMP : OP_LOOP;
+        }
+        if (distance < 0) distance = -distance;
+        if (instr->wide) {
+            bytes[at++] = OP_WIDE;
+            bytes[at++] = op;
+            bytes[at++] = distance & 0xff;
+            bytes[at++] = (distance >> 8) & 0xff;
+            bytes[at++] = (distance >> 16) & 0xff;
+        } else {
+            bytes[at++] = op;
+            bytes[at++] = (distance >> 8) & 0xff;
+            bytes[at++] = distance & 0xff;
+        }
+    }
+
+    FREE_ARRAY(uint8_t, chunk->code, chunk->capacity);
+    FREE_ARRAY(int, chunk->lines, chunk->capacity);
+    chunk->code = bytes;
+    chunk->lines = lines;
+    chunk->count = length;
+    chunk->capacity = length;
+}
+
+void peephole(Chunk* chunk) {
+    if (chunk->count == 0) return;
+    int capacity = chunk->count;
+    Instr* code = ALLOCATE(Instr, capacity);
+    int count = decode(chunk, code);
+
+    bool changed = true;
+    while (changed) {
+        changed = false;
+        mark_targets(code, count);
+        changed |= collapse_negations(code, count);
+        mark_targets(code, count);
+        changed |= fuse_compare_jumps(code, count);
+        mark_targets(code, count);
+        changed |= thread_jumps(code, count);
+        mark_targets(code, count);
+        changed |= drop_noops(code, count);
+        mark_targets(code, count);
+        changed |= drop_unreachable(code, count);
+    }
+    mark_targets(code, count);
+
+    encode(chunk, code, count);
+    FREE_ARRAY(Instr, code, capacity);
+}
+
+// @Note: a superinstruction is written over the first opcode of its run only, the operands and the
+// opcodes after it stay. A jump into the middle of the run still finds plain instructions there,
+// and the handler falls back on them when a guard does not hold. Runs with OP_WIDE never match.
+void select_superinstructions(Chunk* chunk) {
+    static const struct {
+        uint8_t op;
+        int length;
+        uint8_t ops[3];
+    } supers[] = {
+        #define SUPER_PATTERN(name, length, a, b, c) {name, length, {a, b, c}},
+        SUPERINSTRUCTIONS(SUPER_PATTERN)
+        #undef SUPER_PATTERN
+    };
+    int superCount = (int) (sizeof(supers) / sizeof(supers[0]));
+    for (int offset = 0; offset < chunk->count;) {
+        int next = offset + instruction_length(chunk, offset);
+        for (int s = 0; s < superCount; s++) {
+            int at = offset;
+            int k = 0;
+            for (; k < supers[s].length && at < chunk->count && chunk->code[at] == supers[s].ops[k]; k++) {
+                at += instruction_length(chunk, at);
+            }
+            if (k == supers[s].length) {
+                chunk->code[offset] = supers[s].op;
+                next = at;
+                break;
+            }
+        }
+        offset = next;
+    }
+}
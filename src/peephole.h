@@ -0,0 +1,12 @@
+#ifndef comp_peephole_h
+#define comp_peephole_h
+
+#include "chunk.h"
+
+// @Note: rewrites a finished chunk in place, its code and lines shrink and its jumps are re-encoded
+void peephole(Chunk* chunk);
+
+// @Note: writes the superinstructions of chunk.h over the runs of opcodes they stand for
+void select_superinstructions(Chunk* chunk);
+
+#endif // comp_peephole_h
@@ -1,103 +1,184 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define TABLE_MAX_LOAD 0.75
-
-static Entry* find_entry(Entry* entries, int capacity, ObjString* key) {
-    uint32_t index = key->hash % capacity;
-    Entry* tombstone = NULL;
-    for (;;) {
-        Entry* e = &entries[index];
-        if (e->key == NULL) {
-            if (IS_NIL(e->value)) {
-                return tombstone != NULL ? tombstone : e;
-            } else {
-                if (tombstone == NULL) tombstone = e;
-            }
-        } else if (e->key == key) {
-            return e;
+// @Note: a table grows once 7/8 of its slots hold a key or a tombstone. A rehash leaves it at most
+// half full, and a collection that leaves fewer than an eighth of the slots in use shrinks it.
+#define TABLE_MAX_LOAD_NUM 7
+#define TABLE_MAX_LOAD_DEN 8
+#define TABLE_MIN_LOAD_DEN 8
+
+// @Note: the low bits of the hash pick the group, the top 7 go into the control byte
+#define HASH_TAG(hash) ((uint8_t)((hash) >> 25))
+
+// @Note: bit i is set for slot i of the group
+typedef uint32_t GroupMask;
+
+static inline GroupMask group_match(const uint8_t* control, uint8_t tag) {
+#ifdef __SSE2__
+    __m128i group = _mm_loadu_si128((const __m128i*)control);
+    return (GroupMask)_mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)tag)));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if (control[i] == tag) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+// @Note: empty and deleted slots are the ones with the high bit set
+static inline GroupMask group_free(const uint8_t* control) {
+#ifdef __SSE2__
+    return (GroupMask)_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)control));
+#else
+    GroupMask mask = 0;
+    for (int i = 0; i < TABLE_GROUP_SIZE; i++) {
+        if (control[i] & 0x80) mask |= (GroupMask)1 << i;
+    }
+    return mask;
+#endif
+}
+
+static inline bool slot_full(uint8_t control) {
+    return (control & 0x80) == 0;
+}
+
+// @Note: the groups are probed at triangular offsets, which visits all of them when their number
+// is a power of two. Stepping stops at a group with an empty slot, a key would have gone there.
+#define FOR_EACH_GROUP(capacity, hash, group) \
+    for (size_t group = (hash) & ((capacity) / TABLE_GROUP_SIZE - 1), step_ = 1; ; \
+        group = (group + step_++) & ((capacity) / TABLE_GROUP_SIZE - 1))
+
+static Entry* find_entry(Table* table, ObjString* key) {
+    uint8_t tag = HASH_TAG(key->hash);
+    FOR_EACH_GROUP(table->capacity, key->hash, group) {
+        uint8_t* control = table->control + group * TABLE_GROUP_SIZE;
+        for (GroupMask match = group_match(control, tag); match != 0; match &= match - 1) {
+            Entry* e = &table->entries[group * TABLE_GROUP_SIZE + __builtin_ctz(match)];
+            if (e->key == key) return e;
         }
-        index = (index + 1) % capacity;
+        if (group_match(control, TABLE_EMPTY) != 0) return NULL;
     }
 }
 
-static void adjust_capacity(Table* table, int capacity) {
-    Entry* entries = ALLOCATE(Entry, capacity);
-    for (int i = 0; i < capacity; i++) {
-        entries[i].key = NULL;
-        entries[i].value = NIL_VAL();
+static size_t find_free_slot(uint8_t* control, int capacity, uint32_t hash) {
+    FOR_EACH_GROUP(capacity, hash, group) {
+        GroupMask free = group_free(control + group * TABLE_GROUP_SIZE);
+        if (free != 0) return group * TABLE_GROUP_SIZE + __builtin_ctz(free);
     }
+}
 
-    table->count = 0;
+// @Note: the smallest capacity that leaves count keys at most half full
+static int capacity_for(int count) {
+    int capacity = TABLE_GROUP_SIZE;
+    while (capacity < count * 2) capacity *= 2;
+    return capacity;
+}
+
+// @Note: drops the tombstones on the way. The shrink after a collection runs in the middle of one,
+// so it allocates through gc_reallocate, which cannot start another.
+static void rehash(Table* table, int capacity, bool inCollection) {
+    void* (*allocate)(void*, size_t, size_t) = inCollection ? gc_reallocate : reallocate;
+    uint8_t* control = (uint8_t*)allocate(NULL, 0, sizeof(uint8_t) * capacity);
+    Entry* entries = (Entry*)allocate(NULL, 0, sizeof(Entry) * capacity);
+    memset(control, TABLE_EMPTY, capacity);
+
+    // @Note: the old slots are only read now, allocating may have collected and shrunk this table already
     for (int i = 0; i < table->capacity; i++) {
+        if (!slot_full(table->control[i])) continue;
         Entry* e = &table->entries[i];
-        if (e->key == NULL) continue;
-        Entry* dest = find_entry(entries, capacity, e->key);
-        dest->key = e->key;
-        dest->value = e->value;
-        table->count++;
+        size_t slot = find_free_slot(control, capacity, e->key->hash);
+        control[slot] = HASH_TAG(e->key->hash);
+        entries[slot] = *e;
     }
 
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
 
+    table->control = control;
     table->entries = entries;
     table->capacity = capacity;
+    table->tombstones = 0;
+}
+
+// @Note: a slot in a group that still has an empty one can go back to empty, no probe steps past that group
+static void delete_slot(Table* table, size_t slot) {
+    uint8_t* group = table->control + slot / TABLE_GROUP_SIZE * TABLE_GROUP_SIZE;
+    if (group_match(group, TABLE_EMPTY) != 0) {
+        table->control[slot] = TABLE_EMPTY;
+    } else {
+        table->control[slot] = TABLE_DELETED;
+        table->tombstones++;
+    }
+    table->entries[slot].key = NULL;
+    table->entries[slot].value = NIL_VAL();
+    table->count--;
 }
 
 void init_table(Table* table) {
     table->count = 0;
+    table->tombstones = 0;
     table->capacity = 0;
+    table->control = NULL;
     table->entries = NULL;
 }
 
 void free_table(Table* table) {
+    FREE_ARRAY(uint8_t, table->control, table->capacity);
     FREE_ARRAY(Entry, table->entries, table->capacity);
     init_table(table);
 }
 
 bool table_set(Table* table, ObjString* key, Value value) {
-    if (table->count + 1 > table->capacity * TABLE_MAX_LOAD) {
-        int capacity = GROW_CAPACITY(table->capacity);
-        adjust_capacity(table, capacity);
+    Entry* entry = table->count == 0 ? NULL : find_entry(table, key);
+    if (entry != NULL) {
+        entry->value = value;
+        return false;
     }
-    // printf("Still working here\n"); // @Hack: this seems to stop a fatal error?!
-    Entry* entry = find_entry(table->entries, table->capacity, key);
-    bool isNewKey = entry->key == NULL;
-    if (isNewKey && IS_NIL(entry->value)) table->count++;
-    entry->key = key;
-    entry->value = value;
-    return isNewKey;
+    if ((table->count + table->tombstones + 1) * TABLE_MAX_LOAD_DEN > table->capacity * TABLE_MAX_LOAD_NUM) {
+        // @Note: mostly tombstones, this rehashes at the same capacity
+        rehash(table, capacity_for(table->count + 1), false);
+    }
+    size_t slot = find_free_slot(table->control, table->capacity, key->hash);
+    if (table->control[slot] == TABLE_DELETED) table->tombstones--;
+    table->control[slot] = HASH_TAG(key->hash);
+    table->entries[slot].key = key;
+    table->entries[slot].value = value;
+    table->count++;
+    return true;
 }
 
 void table_add_all(Table* from, Table* to) {
     for (int i = 0; i < from->capacity; i++) {
-        Entry* e = &from->entries[i];
-        if (e->key != NULL) {
-            table_set(to, e->key, e->value);
+        if (slot_full(from->control[i])) {
+            table_set(to, from->entries[i].key, from->entries[i].value);
         }
     }
 }
 
 bool table_get(Table* table, ObjString* key, Value* value) {
     if (table->count == 0) return false;
-    Entry* e = find_entry(table->entries, table->capacity, key);
-    if (e->key == NULL) return false;
+    Entry* e = find_entry(table, key);
+    if (e == NULL) return false;
     *value = e->value;
     return true;
 }
 
 bool table_delete(Table* table, ObjString* key) {
     if (table->count == 0) return false;
-    Entry* e = find_entry(table->entries, table->capacity, key);
-    if (e->key == NULL) return false;
-    e->key = NULL;
-    e->value = BOOL_VAL(true);
+    Entry* e = find_entry(table, key);
+    if (e == NULL) return false;
+    delete_slot(table, (size_t)(e - table->entries));
     return true;
 }
 
@@ -105,25 +186,22 @@ ObjString* table_find_string(Table* table, const char* chars, int length, uint32
     if (table->count == 0) {
         return NULL;
     }
-    uint32_t idx = hash % table->capacity;
-    for (;;) {
-        Entry* e = &table->entries[idx];
-        if (e->key == NULL) {
-            if (IS_NIL(e->value)) return NULL;
-        } else if (
-            e->key->length == length 
-            && e->key->hash == hash 
-            && memcmp(e->key->chars, chars, length) == 0
-        ) {
-            return e->key;
+    uint8_t tag = HASH_TAG(hash);
+    FOR_EACH_GROUP(table->capacity, hash, group) {
+        uint8_t* control = table->control + group * TABLE_GROUP_SIZE;
+        for (GroupMask match = group_match(control, tag); match != 0; match &= match - 1) {
+            ObjString* key = table->entries[group * TABLE_GROUP_SIZE + __builtin_ctz(match)].key;
+            if (key->length == length && key->hash == hash && chars_equal(key->chars, chars, length)) {
+                return key;
+            }
         }
-
-        idx = (idx + 1) % table->capacity;
+        if (group_match(control, TABLE_EMPTY) != 0) return NULL;
     }
 }
 
 void mark_table(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
+        if (!slot_full(table->control[i])) continue;
         Entry *entry = &table->entries[i];
         mark_object((Obj*)entry->key);
         mark_value(entry->value);
@@ -132,9 +210,11 @@ void mark_table(Table *table) {
 
 void table_remove_white(Table *table) {
     for (int i = 0; i < table->capacity; i++) {
-        Entry *e = &table->entries[i];
-        if (e->key != NULL && !e->key->obj.isMarked) {
-            table_delete(table, e->key);
+        if (slot_full(table->control[i]) && !is_marked(&table->entries[i].key->obj)) {
+            delete_slot(table, i);
         }
     }
+    if (table->capacity > TABLE_GROUP_SIZE && table->count * TABLE_MIN_LOAD_DEN < table->capacity) {
+        rehash(table, capacity_for(table->count), true);
+    }
 }
@@ -5,13 +5,23 @@
 #include "value.h"
 
 typedef struct {
-	ObjString* key;
+	ObjString* key; // @Note: always interned, interning is what computes the hash
 	Value value;
 } Entry;
 
+// @Note: open addressing in the way of a swiss table. The slots come in groups of TABLE_GROUP_SIZE,
+// each with a control byte that is TABLE_EMPTY, TABLE_DELETED or the top 7 bits of the key's hash,
+// so a probe tests a whole group against those bits at once and only looks at the entries that match.
+// The capacity is a power of two and at least one group.
+#define TABLE_GROUP_SIZE 16
+#define TABLE_EMPTY 0x80
+#define TABLE_DELETED 0xfe
+
 typedef struct {
 	int count;
+	int tombstones; // @Note: deleted slots still in the probe sequences, dropped on the next rehash
 	int capacity;
+	uint8_t* control;
 	Entry* entries;
 } Table;
 
@@ -26,23 +26,35 @@ void free_value_array(ValueArray *array) {
 }
 
 void print_value(Value value) {
-    switch(value.type) {
-        case VAL_BOOL: 
-            printf(AS_BOOL(value) ? "true" : "false");
-            break;
-        case VAL_NIL: printf("nil"); break;
-        case VAL_NUMBER: printf("%g", AS_NUMBER(value)); break;
-        case VAL_OBJ: print_obj(value); break;
+    if (IS_BOOL(value)) {
+        printf(AS_BOOL(value) ? "true" : "false");
+    } else if (IS_NIL(value)) {
+        printf("nil");
+    } else if (IS_NUMBER(value)) {
+        printf("%g", AS_NUMBER(value));
+    } else if (IS_OBJ(value)) {
+        print_obj(value);
     }
 }
 
 bool values_equal(Value v1, Value v2) {
+#ifdef NAN_BOXING
+    // @Note: numbers still compare as doubles, so NaN != NaN like in the tagged build
+    if (IS_NUMBER(v1) && IS_NUMBER(v2)) {
+        return AS_NUMBER(v1) == AS_NUMBER(v2);
+    }
+    if (v1 == v2) return true;
+    return IS_FLAT_STRING(v1) && IS_FLAT_STRING(v2) && strings_equal(AS_OBJ(v1), AS_OBJ(v2));
+#else
     if (v1.type != v2.type) return false;
     switch (v1.type) {
         case VAL_BOOL: return AS_BOOL(v1) == AS_BOOL(v2); break;
         case VAL_NUMBER: return AS_NUMBER(v1) == AS_NUMBER(v2); break;
         case VAL_NIL: return true; // @Note: both are nil, thus true
-        case VAL_OBJ: return AS_OBJ(v1) == AS_OBJ(v2);
+        case VAL_OBJ:
+            if (AS_OBJ(v1) == AS_OBJ(v2)) return true;
+            return IS_FLAT_STRING(v1) && IS_FLAT_STRING(v2) && strings_equal(AS_OBJ(v1), AS_OBJ(v2));
         default: return false;
     }
+#endif
 }
@@ -2,16 +2,65 @@
 #define comp_value_h
 
 #include "common.h"
+#include <string.h>
 
 typedef struct Obj Obj;
 
 typedef struct ObjString ObjString;
 
+#ifdef NAN_BOXING
+
+// @Note: A Value is a single 64 bit word. Every double that is not a quiet NaN is stored as is,
+// the remaining quiet NaN space carries nil, the booleans and (with the sign bit set) Obj pointers.
+#define SIGN_BIT ((uint64_t)0x8000000000000000)
+#define QNAN ((uint64_t)0x7ffc000000000000)
+
+#define TAG_NIL 1
+#define TAG_FALSE 2
+#define TAG_TRUE 3
+#define TAG_UNDEFINED 4
+
+typedef uint64_t Value;
+
+#define FALSE_VAL ((Value)(uint64_t)(QNAN | TAG_FALSE))
+#define TRUE_VAL ((Value)(uint64_t)(QNAN | TAG_TRUE))
+
+#define AS_BOOL(value) ((value) == TRUE_VAL)
+#define AS_NUMBER(value) value_to_num(value)
+#define AS_OBJ(value) ((Obj*)(uintptr_t)((value) & ~(SIGN_BIT | QNAN)))
+
+#define BOOL_VAL(value) ((value) ? TRUE_VAL : FALSE_VAL)
+#define NIL_VAL(value) ((Value)(uint64_t)(QNAN | TAG_NIL)) // @Cleanup: we don't need a parameter
+#define OBJ_VAL(value) (Value)(SIGN_BIT | QNAN | (uint64_t)(uintptr_t)(value))
+#define NUMBER_VAL(value) num_to_value(value)
+#define UNDEFINED_VAL ((Value)(uint64_t)(QNAN | TAG_UNDEFINED))
+
+#define IS_BOOL(value) (((value) | 1) == TRUE_VAL)
+#define IS_NIL(value) ((value) == NIL_VAL())
+#define IS_NUMBER(value) (((value) & QNAN) != QNAN)
+#define IS_OBJ(value) (((value) & (QNAN | SIGN_BIT)) == (QNAN | SIGN_BIT))
+#define IS_UNDEFINED(value) ((value) == UNDEFINED_VAL)
+
+static inline double value_to_num(Value value) {
+	double num;
+	memcpy(&num, &value, sizeof(Value));
+	return num;
+}
+
+static inline Value num_to_value(double num) {
+	Value value;
+	memcpy(&value, &num, sizeof(double));
+	return value;
+}
+
+#else
+
 typedef enum {
 	VAL_BOOL,
 	VAL_NIL,
 	VAL_NUMBER,
 	VAL_OBJ,
+	VAL_UNDEFINED, // @Note: internal marker for declared but not yet defined globals, never reaches a script
 } ValueType;
 
 typedef struct {
@@ -32,11 +81,15 @@ typedef struct {
 #define NIL_VAL(value) ((Value) {VAL_NIL, {.number = 0}}) // @Cleanup: we don't need a parameter
 #define OBJ_VAL(value) ((Value) {VAL_OBJ, {.obj = (Obj*)value}})
 #define NUMBER_VAL(value) ((Value) {VAL_NUMBER, {.number = value}})
+#define UNDEFINED_VAL ((Value) {VAL_UNDEFINED, {.number = 0}})
 
 #define IS_BOOL(value) ((value).type == VAL_BOOL)
 #define IS_NIL(value) ((value).type == VAL_NIL)
 #define IS_NUMBER(value) ((value).type == VAL_NUMBER)
 #define IS_OBJ(value) ((value).type == VAL_OBJ)
+#define IS_UNDEFINED(value) ((value).type == VAL_UNDEFINED)
+
+#endif // NAN_BOXING
 
 typedef struct {
 	int capacity;
@@ -1,5 +1,6 @@
 #include "chunk.h"
 #include "common.h"
+#include "hash.h"
 #include "memory.h"
 #include "object.h"
 #include "table.h"
@@ -7,9 +8,11 @@
 #include "vm.h"
 #include "debug.h"
 #include "compiler.h"
+#include <math.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
@@ -19,6 +22,90 @@ static Value clock_native(int argCount, Value* args) {
     return NUMBER_VAL((double)clock() / CLOCKS_PER_SEC);
 }
 
+// @Note: gc_stats() describes the last collection, gc_stats(n) the one numbered n, nil once it is gone
+static Value gc_stats_native(int argCount, Value* args) {
+    int number = vm.gcCycleCount - 1;
+    if (argCount > 0 && IS_NUMBER(args[0])) number = (int)AS_NUMBER(args[0]);
+    char text[256];
+    int length = gc_format_cycle(number, text, sizeof(text));
+    if (length <= 0) return NIL_VAL();
+    if (length >= (int)sizeof(text)) length = sizeof(text) - 1;
+    return OBJ_VAL(new_string(text, length));
+}
+
+// @Note: the string natives take ropes too, they get flattened like `==` does
+static Obj* flat_string(Value value) {
+    if (IS_ROPE(value)) return (Obj*)flatten_rope(AS_ROPE(value));
+    return AS_OBJ(value);
+}
+
+// @Note: false for NaN and the infinities. The rest is clamped to [0, length] as a double,
+// converting one outside the int range first is undefined.
+static bool clamp_index(Value value, int length, int* index) {
+    double number = AS_NUMBER(value);
+    if (!isfinite(number)) return false;
+    if (number < 0) number = 0;
+    if (number > length) number = length;
+    *index = (int)number;
+    return true;
+}
+
+// @Note: substr(s, start) or substr(s, start, length), both are clamped to the string
+static Value substr_native(int argCount, Value* args) {
+    if (argCount < 2 || !IS_ANY_STRING(args[0]) || !IS_NUMBER(args[1])) return NIL_VAL();
+    if (argCount > 2 && !IS_NUMBER(args[2])) return NIL_VAL();
+    Obj* string = flat_string(args[0]);
+    int length = flat_length(string);
+    int start;
+    if (!clamp_index(args[1], length, &start)) return NIL_VAL();
+    int count = length - start;
+    if (argCount > 2 && !clamp_index(args[2], length - start, &count)) return NIL_VAL();
+    return OBJ_VAL(new_slice(string, start, count));
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+static Value trim_native(int argCount, Value* args) {
+    if (argCount < 1 || !IS_ANY_STRING(args[0])) return NIL_VAL();
+    Obj* string = flat_string(args[0]);
+    const char* chars = flat_chars(string);
+    int start = 0;
+    int end = flat_length(string);
+    while (start < end && is_space(chars[start])) start++;
+    while (end > start && is_space(chars[end - 1])) end--;
+    return OBJ_VAL(new_slice(string, start, end - start));
+}
+
+// @Note: there are no lists, split(s, separator, n) returns the nth field counting from 0, nil past the last
+static Value split_native(int argCount, Value* args) {
+    if (argCount < 3 || !IS_ANY_STRING(args[0]) || !IS_ANY_STRING(args[1]) || !IS_NUMBER(args[2])) return NIL_VAL();
+    Obj* separator = flat_string(args[1]);
+    Obj* string = flat_string(args[0]);
+    const char* chars = flat_chars(string);
+    int length = flat_length(string);
+    const char* sep = flat_chars(separator);
+    int sepLength = flat_length(separator);
+    if (sepLength == 0 || AS_NUMBER(args[2]) < 0) return NIL_VAL();
+    // @Note: a string has at most length + 1 fields, anything past that is nil like the field after the last
+    int field;
+    if (!clamp_index(args[2], length + 1, &field)) return NIL_VAL();
+    int start = 0;
+    for (int i = 0; i + sepLength <= length && field > 0; i++) {
+        if (memcmp(chars + i, sep, sepLength) == 0) {
+            field--;
+            start = i + sepLength;
+            i += sepLength - 1;
+        }
+    }
+    if (field > 0) return NIL_VAL();
+    int end = start;
+    while (end + sepLength <= length && memcmp(chars + end, sep, sepLength) != 0) end++;
+    if (end + sepLength > length) end = length;
+    return OBJ_VAL(new_slice(string, start, end - start));
+}
+
 static void reset_stack() {
     vm.stackTop = vm.stack;
     vm.frameCount = 0;
@@ -28,27 +115,101 @@ static void reset_stack() {
 static void define_native(const char* name, NativeFn fn) {
     push(OBJ_VAL(copy_string(name, (int)strlen(name))));
     push(OBJ_VAL(new_native(fn)));
-    table_set(&vm.globals, AS_STRING(vm.stack[0]), vm.stack[1]);
+    int slot = global_slot(AS_STRING(vm.stack[0]));
+    vm.globalValues.values[slot] = vm.stack[1];
+    pop();
     pop();
+}
+
+int global_slot(ObjString* name) {
+    Value slot;
+    if (table_get(&vm.globals, name, &slot)) {
+        return (int)AS_NUMBER(slot);
+    }
+    push(OBJ_VAL(name)); // @Note: keep the name alive while the arrays grow
+    int idx = vm.globalValues.count;
+    write_value_array(&vm.globalValues, UNDEFINED_VAL);
+    write_value_array(&vm.globalNames, OBJ_VAL(name));
+    table_set(&vm.globals, name, NUMBER_VAL((double)idx));
     pop();
+    return idx;
 }
 
 void initVM() {
+    vm.gcPhase = GC_IDLE;
+    vm.gcIncremental = false;
+    vm.gcThreads = 1;
+    vm.gcGrowFactor = GC_GROW_FACTOR_DEFAULT;
+    vm.gcHeapLimit = GC_HEAP_LIMIT_DEFAULT;
+    vm.gcCycleCount = 0;
+    vm.gcMajorCycle = -1;
+    vm.errorJump = NULL;
+    vm.traceFlags = 0;
+    vm.opProfile.path = NULL;
+    vm.tier = TIER_STACK;
+    vm.gcPauseBudget = GC_PAUSE_BUDGET_DEFAULT;
+    vm.gcDebt = 0;
+    vm.gcMaxPause = 0;
+    vm.gcTotalPause = 0;
+    vm.gcPauseCount = 0;
+    vm.blocks = NULL;
+    vm.youngBlocks = NULL;
+    vm.bumpBlock = NULL;
+    vm.sweepBlocks = NULL;
+    vm.freeBlocks = NULL;
+    vm.freeBlockCount = 0;
+    for (int i = 0; i < SIZE_CLASS_COUNT; i++) {
+        vm.freeCells[i] = NULL;
+    }
+    vm.youngCellCapacity = 0;
+    vm.youngCellCount = 0;
+    vm.youngCells = NULL;
+    vm.sliceCapacity = 0;
+    vm.sliceCount = 0;
+    vm.slices = NULL;
+    vm.youngBytes = 0;
+    vm.cellBytes = 0;
+    vm.markedBytes = 0;
+    vm.garbageBytes = 0;
+    vm.blockSlack = 0;
+    vm.stressCount = 0;
+    vm.rememberedCapacity = 0;
+    vm.rememberedCount = 0;
+    vm.remembered = NULL;
+    vm.bytesallocated = 0;
+    vm.nextgc = GC_INITIAL_HEAP_DEFAULT;
+    vm.stack = NULL;
+    vm.stackCapacity = 0;
+    vm.frames = NULL;
+    vm.frameCapacity = 0;
+    vm.stack = GROW_ARRAY(Value, vm.stack, 0, STACK_INITIAL);
+    vm.stackCapacity = STACK_INITIAL;
+    vm.frames = GROW_ARRAY(CallFrame, vm.frames, 0, FRAMES_INITIAL);
+    vm.frameCapacity = FRAMES_INITIAL;
     reset_stack();
     vm.grayCount = 0;
     vm.grayCapacity = 0;
     vm.grayStack = NULL;
-    vm.bytesallocated = 0;
-    vm.nextgc = 1024 * 1024;
     init_table(&vm.strings);
     init_table(&vm.globals);
+    init_value_array(&vm.globalValues);
+    init_value_array(&vm.globalNames);
     define_native("clock", clock_native);
-    vm.objects = NULL;
+    define_native("gc_stats", gc_stats_native);
+    define_native("substr", substr_native);
+    define_native("trim", trim_native);
+    define_native("split", split_native);
 }
 void freeVM() {
     free_table(&vm.strings);
     free_table(&vm.globals);
+    free_value_array(&vm.globalValues);
+    free_value_array(&vm.globalNames);
     free_objects();
+    FREE_ARRAY(Value, vm.stack, vm.stackCapacity);
+    FREE_ARRAY(CallFrame, vm.frames, vm.frameCapacity);
+    vm.stack = NULL;
+    vm.frames = NULL;
 }
 
 static Value peek(int distance) {
@@ -79,20 +240,72 @@ static bool is_falsey(Value value) {
     return IS_NIL(value) || (IS_BOOL(value) && !AS_BOOL(value));
 }
 
-static void concatenate() {
-    ObjString* b = AS_STRING(peek(0));
-    ObjString* a = AS_STRING(peek(1));
+// @Note: compares a rope as the flat string it caches, like POP_EQUAL
+static bool registers_equal(Value a, Value b) {
+    if (IS_ROPE(a)) a = OBJ_VAL(flatten_rope(AS_ROPE(a)));
+    if (IS_ROPE(b)) b = OBJ_VAL(flatten_rope(AS_ROPE(b)));
+    return values_equal(a, b);
+}
 
-    int length = a->length + b->length;
-    char* chars = ALLOCATE(char, length + 1);
-    memcpy(chars, a->chars, a->length);
-    memcpy(chars + a->length, b->chars, b->length);
-    chars[length] = '\0';
+static bool concatenate() {
+    Obj* b = AS_OBJ(peek(0));
+    Obj* a = AS_OBJ(peek(1));
 
-    ObjString* result = take_string(chars, length);
+    Obj* result = concat_strings(a, b);
+    if (result == NULL) return false;
     pop(); // @Note: cleanup b and a
     pop();
     push(OBJ_VAL(result));
+    return true;
+}
+
+// @Note: makes sure `needed` more values fit above stackTop. Moving the stack invalidates every
+// pointer into it, so the frames and the open upvalues are rebased onto the new block.
+static bool ensure_stack(int needed) {
+    int used = (int)(vm.stackTop - vm.stack);
+    if (used + needed <= vm.stackCapacity) return true;
+    if (used + needed > STACK_MAX) {
+        runtime_error("Stack overflow.");
+        return false;
+    }
+    int capacity = vm.stackCapacity;
+    while (capacity < used + needed) {
+        capacity = GROW_CAPACITY(capacity);
+    }
+    if (capacity > STACK_MAX) capacity = STACK_MAX;
+
+    Value* oldStack = vm.stack;
+    vm.stack = GROW_ARRAY(Value, vm.stack, vm.stackCapacity, capacity);
+    vm.stackCapacity = capacity;
+    if (vm.stack == oldStack) return true;
+
+    vm.stackTop = vm.stack + used;
+    for (int i = 0; i < vm.frameCount; i++) {
+        vm.frames[i].slots = vm.stack + (vm.frames[i].slots - oldStack);
+    }
+    for (ObjUpvalue* uv = vm.openUpvalues; uv != NULL; uv = uv->next) {
+        uv->location = vm.stack + (uv->location - oldStack);
+    }
+    return true;
+}
+
+// @Note: a register tier frame owns the slots up to its frame size and keeps stackTop there. The
+// registers past the arguments may hold anything left above the old top, so they start out nil.
+static void open_registers(CallFrame* frame) {
+    int registers = frame->closure->fn->registers;
+    if (registers == 0) return;
+    Value* top = frame->slots + registers;
+    for (Value* reg = vm.stackTop; reg < top; reg++) {
+        *reg = NIL_VAL();
+    }
+    vm.stackTop = top;
+}
+
+// @Note: back in a register tier frame after a call. The collector kept its window alive all along
+// (see mark_roots), so its registers are as the call left them and only stackTop comes back up.
+static void reopen_registers(CallFrame* frame) {
+    int registers = frame->closure->fn->registers;
+    if (registers > 0) vm.stackTop = frame->slots + registers;
 }
 
 static bool call(ObjClosure* closure, int argCount) {
@@ -100,14 +313,23 @@ static bool call(ObjClosure* closure, int argCount) {
         runtime_error("Expected %d arguments, got %d instead.", closure->fn->arity, argCount);
         return false;
     }
-    if (vm.frameCount == FRAMES_MAX) {
-        runtime_error("Stack overflow.");
-        return false;
+    if (vm.frameCount == vm.frameCapacity) {
+        if (vm.frameCapacity == FRAMES_MAX) {
+            runtime_error("Stack overflow.");
+            return false;
+        }
+        int capacity = GROW_CAPACITY(vm.frameCapacity);
+        if (capacity > FRAMES_MAX) capacity = FRAMES_MAX;
+        vm.frames = GROW_ARRAY(CallFrame, vm.frames, vm.frameCapacity, capacity);
+        vm.frameCapacity = capacity;
     }
+    // @Note: the compiler records how deep the frame gets, see note_stack
+    if (!ensure_stack(closure->fn->maxStack + closure->fn->registers)) return false;
     CallFrame* frame = &vm.frames[vm.frameCount++];
     frame->closure = closure;
     frame->ip = closure->fn->chunk.code;
     frame->slots = vm.stackTop - argCount - 1;
+    open_registers(frame);
     return true;
 }
 
@@ -155,207 +377,982 @@ static void close_upvalues(Value* last) {
         ObjUpvalue* uv = vm.openUpvalues;
         uv->closed = *uv->location;
         uv->location = &uv->closed;
+        gc_write_barrier((Obj*)uv, uv->closed);
         vm.openUpvalues = uv->next;
     }
 }
 
+static void trace_instruction(CallFrame* frame, uint8_t* ip) {
+    disassemble_instruction(&frame->closure->fn->chunk, (int)(ip - frame->closure->fn->chunk.code));
+    printf("     ");
+    for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
+        printf("[  ");
+        print_value(*slot);
+        printf("  ]");
+    }
+    printf("\n");
+}
+
+// @Note: the opcodes a profile counts are the ones the compiler writes, a quickened one counts
+// as its generic opcode
+#define PROFILE_OPS OP_ADD_NUM
+
+static uint8_t generic_opcode(uint8_t op) {
+    switch (op) {
+        case OP_ADD_NUM:
+        case OP_ADD_STR: return OP_ADD;
+        case OP_SUBSTRACT_NUM: return OP_SUBSTRACT;
+        case OP_MULTIPLY_NUM: return OP_MULTIPLY;
+        case OP_DIVIDE_NUM: return OP_DIVIDE;
+        case OP_GREATER_NUM: return OP_GREATER;
+        case OP_LESS_NUM: return OP_LESS;
+        default: return op;
+    }
+}
+
+void start_op_profile(const char* path) {
+    vm.opProfile.path = path;
+    vm.opProfile.sequences = NULL;
+    vm.opProfile.sequenceCount = 0;
+    vm.opProfile.sequenceCapacity = 0;
+    vm.opProfile.current.length = 0;
+    vm.opProfile.next = NULL;
+}
+
+static ProfileSequence* find_sequence(ProfileSequence* sequences, int capacity, const uint8_t* ops, int length) {
+    uint32_t index = hash_chars((const char*)ops, length) & (capacity - 1);
+    for (;;) {
+        ProfileSequence* sequence = &sequences[index];
+        if (sequence->count == 0) return sequence;
+        if (sequence->length == length && memcmp(sequence->ops, ops, length) == 0) return sequence;
+        index = (index + 1) & (capacity - 1);
+    }
+}
+
+// @Note: a single opcode cannot become a superinstruction, it is not worth a line
+static void add_sequence(const uint8_t* ops, int length, uint64_t count) {
+    OpProfile* profile = &vm.opProfile;
+    if (length < 2 || count == 0) return;
+    if ((profile->sequenceCount + 1) * 2 > profile->sequenceCapacity) {
+        int capacity = profile->sequenceCapacity < 256 ? 256 : profile->sequenceCapacity * 2;
+        ProfileSequence* sequences = calloc(capacity, sizeof(ProfileSequence));
+        if (sequences == NULL) {
+            fprintf(stderr, "Not enough memory for the opcode profile.\n");
+            exit(74);
+        }
+        for (int i = 0; i < profile->sequenceCapacity; i++) {
+            ProfileSequence* old = &profile->sequences[i];
+            if (old->count != 0) *find_sequence(sequences, capacity, old->ops, old->length) = *old;
+        }
+        free(profile->sequences);
+        profile->sequences = sequences;
+        profile->sequenceCapacity = capacity;
+    }
+    ProfileSequence* sequence = find_sequence(profile->sequences, profile->sequenceCapacity, ops, length);
+    if (sequence->count == 0) {
+        sequence->length = length;
+        memcpy(sequence->ops, ops, length);
+        profile->sequenceCount++;
+    }
+    sequence->count += count;
+}
+
+static void end_sequence(OpProfile* profile) {
+    add_sequence(profile->current.ops, profile->current.length, 1);
+    profile->current.length = 0;
+}
+
+// @Note: a sequence only goes on with the instruction the last one falls through to, a superinstruction
+// cannot stand for one that jumps, calls or returns in the middle. OP_WIDE ends it.
+static void profile_instruction(CallFrame* frame, uint8_t* ip) {
+    OpProfile* profile = &vm.opProfile;
+    uint8_t op = generic_opcode(*ip);
+    if (ip != profile->next || profile->current.length == PROFILE_SEQUENCE_MAX) end_sequence(profile);
+    if (op == OP_WIDE || op >= PROFILE_OPS) {
+        end_sequence(profile);
+        profile->next = NULL;
+        return;
+    }
+    profile->current.ops[profile->current.length++] = op;
+    Chunk* chunk = &frame->closure->fn->chunk;
+    profile->next = ip + instruction_length(chunk, (int)(ip - chunk->code));
+}
+
+static int compare_sequences(const void* a, const void* b) {
+    const ProfileSequence* x = a;
+    const ProfileSequence* y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    if (x->length != y->length) return x->length - y->length;
+    return memcmp(x->ops, y->ops, x->length);
+}
+
+static int opcode_named(const char* name) {
+    for (int op = 0; op < PROFILE_OPS; op++) {
+        const char* known = opcode_name(op);
+        if (known != NULL && strcmp(known, name) == 0) return op;
+    }
+    return -1;
+}
+
+// @Note: the counts already in the file are added to, so one profile can cover several programs.
+// Lines are sorted by count and then by opcode, the same runs always give the same file.
+void write_op_profile() {
+    OpProfile* profile = &vm.opProfile;
+    end_sequence(profile);
+    FILE* file = fopen(profile->path, "r");
+    if (file != NULL) {
+        char line[4096];
+        while (fgets(line, sizeof(line), file)) {
+            if (line[0] == '#') continue;
+            char* end;
+            uint64_t count = strtoull(line, &end, 10);
+            uint8_t ops[PROFILE_SEQUENCE_MAX];
+            int length = 0;
+            bool known = true;
+            for (char* name = strtok(end, " \t\n"); name != NULL; name = strtok(NULL, " \t\n")) {
+                int op = opcode_named(name);
+                if (op < 0 || length == PROFILE_SEQUENCE_MAX) {
+                    known = false;
+                    break;
+                }
+                ops[length++] = (uint8_t)op;
+            }
+            if (known) add_sequence(ops, length, count);
+        }
+        fclose(file);
+    }
+
+    ProfileSequence* lines = malloc((profile->sequenceCount + 1) * sizeof(ProfileSequence));
+    int count = 0;
+    for (int i = 0; lines != NULL && i < profile->sequenceCapacity; i++) {
+        if (profile->sequences[i].count != 0) lines[count++] = profile->sequences[i];
+    }
+    qsort(lines, count, sizeof(ProfileSequence), compare_sequences);
+
+    file = fopen(profile->path, "w");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write \"%s\".\n", profile->path);
+    } else {
+        fprintf(file, "# straight-line opcode sequences and how often each ran, written by --profile-ops\n");
+        for (int i = 0; i < count; i++) {
+            fprintf(file, "%llu", (unsigned long long)lines[i].count);
+            for (int k = 0; k < lines[i].length; k++) fprintf(file, " %s", opcode_name(lines[i].ops[k]));
+            fprintf(file, "\n");
+        }
+        fclose(file);
+    }
+    free(lines);
+    free(profile->sequences);
+}
+
 static InterpretResult run() {
     CallFrame* frame = &vm.frames[vm.frameCount - 1];
-    #define READ_BYTE() (*frame->ip++)
-    // #define READ_CONSTANT() (frame->function->chunk.constants.values[READ_BYTE()])
-    #define READ_CONSTANT_LONG() (frame->closure->fn->chunk.constants.values[READ_BYTE() | READ_BYTE() << 8 | READ_BYTE() << 16])
-    #define READ_STRING() AS_STRING(READ_CONSTANT_LONG())
-    #define READ_SHORT() (frame->ip += 2, (uint16_t)((frame->ip[-2] << 8) | frame->ip[-1]))
-    #define BINARY_OP(value_type, op) \
+    // @Note: the hot frame state lives in locals so the compiler can keep it in registers.
+    // It has to be written back (STORE_FRAME) before anything that reads frame->ip.
+    register uint8_t* ip = frame->ip;
+    register Value* slots = frame->slots;
+    register Value* constants = frame->closure->fn->chunk.constants.values;
+    // @Note: the operand of the instruction at hand, read by its handler or by OP_WIDE before it
+    uint32_t operand;
+    bool wide;
+
+    #define READ_BYTE() (*ip++)
+    #define READ_SHORT() (ip += 2, (uint16_t)((ip[-2] << 8) | ip[-1]))
+    #define READ_LONG() (ip += 3, (uint32_t)(ip[-3] | (ip[-2] << 8) | (ip[-1] << 16)))
+    // @Note: the label in a handler where OP_WIDE joins it, once the operand is read
+    #define WIDE(op) wide_##op
+    #define STORE_FRAME() (frame->ip = ip)
+    #define LOAD_FRAME() \
         do { \
-        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
-            runtime_error("Operands must be numbers. Got %s and %s", peek(0), peek(1)); \
+            frame = &vm.frames[vm.frameCount - 1]; \
+            ip = frame->ip; \
+            slots = frame->slots; \
+            constants = frame->closure->fn->chunk.constants.values; \
+        } while (false)
+    #define RUNTIME_ERROR(...) \
+        do { \
+            STORE_FRAME(); \
+            runtime_error(__VA_ARGS__); \
             return INTERPRET_RUNTIME_ERR; \
+        } while (false)
+    // @Note: the generic arithmetic opcodes quicken themselves. Once the operand types are known
+    // they rewrite their own opcode in the chunk to the specialised variant, which only checks a guard.
+    #define QUICKEN(op) (ip[-1] = (op))
+    #define BINARY_OP(value_type, op, quickOp) \
+        do { \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
         } \
+            QUICKEN(quickOp); \
             double b = AS_NUMBER(pop()); \
             double a = AS_NUMBER(pop()); \
             push(value_type(a op b)); \
         } while (false)
-    #ifdef DEBUG_TRACE_EXECUTION
-            printf("    === DEBUG TRACE EXECUTION ===\n");
-    #endif
+    // @Note: if the guard fails we deoptimise. The instruction is turned back into its generic
+    // opcode and dispatched again, so the generic handler reports errors or quickens it anew.
+    #define NUM_BINARY_OP(value_type, op, genericOp) \
+        if (!IS_NUMBER(vm.stackTop[-1]) || !IS_NUMBER(vm.stackTop[-2])) { \
+            ip[-1] = (genericOp); \
+            ip--; \
+        } else { \
+            vm.stackTop[-2] = value_type(AS_NUMBER(vm.stackTop[-2]) op AS_NUMBER(vm.stackTop[-1])); \
+            vm.stackTop--; \
+        }
+    // @Note: pops two values into a and b for the comparisons that have no quickened form
+    #define POP_NUMBERS() \
+        if (!IS_NUMBER(peek(0)) || !IS_NUMBER(peek(1))) { \
+            RUNTIME_ERROR("Operands must be numbers."); \
+        } \
+        double b = AS_NUMBER(vm.stackTop[-1]); \
+        double a = AS_NUMBER(vm.stackTop[-2]); \
+        vm.stackTop -= 2
+    // @Note: pops two values and compares them, a rope as the flat string it caches
+    #define POP_EQUAL() \
+        if (IS_ROPE(peek(0)) || IS_ROPE(peek(1))) { \
+            STORE_FRAME(); \
+            if (IS_ROPE(peek(0))) vm.stackTop[-1] = OBJ_VAL(flatten_rope(AS_ROPE(peek(0)))); \
+            if (IS_ROPE(peek(1))) vm.stackTop[-2] = OBJ_VAL(flatten_rope(AS_ROPE(peek(1)))); \
+        } \
+        bool equal = values_equal(vm.stackTop[-1], vm.stackTop[-2]); \
+        vm.stackTop -= 2
+    // @Note: an RK operand of the register tier, see RK_CONSTANT
+    #define READ_RK() (ip++, ip[-1] & RK_CONSTANT ? constants[ip[-1] & ~RK_CONSTANT] : slots[ip[-1]])
+    // @Note: A gets result, computed from the numbers x and y read through the operands B and C
+    #define R_NUMBERS(result) \
+        do { \
+            uint8_t a = READ_BYTE(); \
+            Value b = READ_RK(); \
+            Value c = READ_RK(); \
+            if (!IS_NUMBER(b) || !IS_NUMBER(c)) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            double x = AS_NUMBER(b); \
+            double y = AS_NUMBER(c); \
+            slots[a] = (result); \
+        } while (false)
+    // @Note: jumps when the condition on the numbers x and y read through the operands is false
+    #define R_JUMP_UNLESS(condition) \
+        do { \
+            Value b = READ_RK(); \
+            Value c = READ_RK(); \
+            uint16_t offset = READ_SHORT(); \
+            if (!IS_NUMBER(b) || !IS_NUMBER(c)) { \
+                RUNTIME_ERROR("Operands must be numbers."); \
+            } \
+            double x = AS_NUMBER(b); \
+            double y = AS_NUMBER(c); \
+            if (!(condition)) ip += offset; \
+        } while (false)
+
+    if (vm.traceFlags & TRACE_EXEC) printf("    === TRACE EXECUTION ===\n");
+
+    #ifdef COMPUTED_GOTO
+        // @Note: one indirect jump per handler instead of the single shared one of the switch,
+        // so the branch predictor gets a separate history for every opcode.
+        static void* dispatchTable[] = {
+            [OP_CONSTANT] = &&do_OP_CONSTANT,
+            [OP_NIL] = &&do_OP_NIL,
+            [OP_TRUE] = &&do_OP_TRUE,
+            [OP_FALSE] = &&do_OP_FALSE,
+            [OP_NOT] = &&do_OP_NOT,
+            [OP_GREATER] = &&do_OP_GREATER,
+            [OP_LESS] = &&do_OP_LESS,
+            [OP_EQ] = &&do_OP_EQ,
+            [OP_GEQ] = &&do_OP_GEQ,
+            [OP_LEQ] = &&do_OP_LEQ,
+            [OP_NEQ] = &&do_OP_NEQ,
+            [OP_NEGATE] = &&do_OP_NEGATE,
+            [OP_ADD] = &&do_OP_ADD,
+            [OP_SUBSTRACT] = &&do_OP_SUBSTRACT,
+            [OP_MULTIPLY] = &&do_OP_MULTIPLY,
+            [OP_DIVIDE] = &&do_OP_DIVIDE,
+            [OP_RETURN] = &&do_OP_RETURN,
+            [OP_PRINT] = &&do_OP_PRINT,
+            [OP_POP] = &&do_OP_POP,
+            [OP_DEFINE_GLOBAL] = &&do_OP_DEFINE_GLOBAL,
+            [OP_GET_GLOBAL] = &&do_OP_GET_GLOBAL,
+            [OP_SET_GLOBAL] = &&do_OP_SET_GLOBAL,
+            [OP_GET_LOCAL] = &&do_OP_GET_LOCAL,
+            [OP_SET_LOCAL] = &&do_OP_SET_LOCAL,
+            [OP_JUMP_IF_FALSE] = &&do_OP_JUMP_IF_FALSE,
+            [OP_JUMP] = &&do_OP_JUMP,
+            [OP_LOOP] = &&do_OP_LOOP,
+            [OP_CALL] = &&do_OP_CALL,
+            [OP_TAIL_CALL] = &&do_OP_TAIL_CALL,
+            [OP_CLOSURE] = &&do_OP_CLOSURE,
+            [OP_SET_UPVALUE] = &&do_OP_SET_UPVALUE,
+            [OP_GET_UPVALUE] = &&do_OP_GET_UPVALUE,
+            [OP_CLOSE_UPVALUE] = &&do_OP_CLOSE_UPVALUE,
+            [OP_WIDE] = &&do_OP_WIDE,
+            [OP_JUMP_IF_NOT_EQ] = &&do_OP_JUMP_IF_NOT_EQ,
+            [OP_JUMP_IF_NOT_NEQ] = &&do_OP_JUMP_IF_NOT_NEQ,
+            [OP_JUMP_IF_NOT_LESS] = &&do_OP_JUMP_IF_NOT_LESS,
+            [OP_JUMP_IF_NOT_GREATER] = &&do_OP_JUMP_IF_NOT_GREATER,
+            [OP_JUMP_IF_NOT_GEQ] = &&do_OP_JUMP_IF_NOT_GEQ,
+            [OP_JUMP_IF_NOT_LEQ] = &&do_OP_JUMP_IF_NOT_LEQ,
+            [OP_ADD_NUM] = &&do_OP_ADD_NUM,
+            [OP_ADD_STR] = &&do_OP_ADD_STR,
+            [OP_SUBSTRACT_NUM] = &&do_OP_SUBSTRACT_NUM,
+            [OP_MULTIPLY_NUM] = &&do_OP_MULTIPLY_NUM,
+            [OP_DIVIDE_NUM] = &&do_OP_DIVIDE_NUM,
+            [OP_GREATER_NUM] = &&do_OP_GREATER_NUM,
+            [OP_LESS_NUM] = &&do_OP_LESS_NUM,
+            #define SUPER_ENTRY(name, ...) [name] = &&do_##name,
+            SUPERINSTRUCTIONS(SUPER_ENTRY)
+            #undef SUPER_ENTRY
+            [OP_R_CONSTANT] = &&do_OP_R_CONSTANT,
+            [OP_R_NIL] = &&do_OP_R_NIL,
+            [OP_R_TRUE] = &&do_OP_R_TRUE,
+            [OP_R_FALSE] = &&do_OP_R_FALSE,
+            [OP_R_MOVE] = &&do_OP_R_MOVE,
+            [OP_R_DEFINE_GLOBAL] = &&do_OP_R_DEFINE_GLOBAL,
+            [OP_R_GET_GLOBAL] = &&do_OP_R_GET_GLOBAL,
+            [OP_R_SET_GLOBAL] = &&do_OP_R_SET_GLOBAL,
+            [OP_R_GET_UPVALUE] = &&do_OP_R_GET_UPVALUE,
+            [OP_R_SET_UPVALUE] = &&do_OP_R_SET_UPVALUE,
+            [OP_R_ADD] = &&do_OP_R_ADD,
+            [OP_R_SUBSTRACT] = &&do_OP_R_SUBSTRACT,
+            [OP_R_MULTIPLY] = &&do_OP_R_MULTIPLY,
+            [OP_R_DIVIDE] = &&do_OP_R_DIVIDE,
+            [OP_R_EQ] = &&do_OP_R_EQ,
+            [OP_R_NEQ] = &&do_OP_R_NEQ,
+            [OP_R_LESS] = &&do_OP_R_LESS,
+            [OP_R_GREATER] = &&do_OP_R_GREATER,
+            [OP_R_GEQ] = &&do_OP_R_GEQ,
+            [OP_R_LEQ] = &&do_OP_R_LEQ,
+            [OP_R_NEGATE] = &&do_OP_R_NEGATE,
+            [OP_R_NOT] = &&do_OP_R_NOT,
+            [OP_R_JUMP_IF_FALSE] = &&do_OP_R_JUMP_IF_FALSE,
+            [OP_R_JUMP_IF_TRUE] = &&do_OP_R_JUMP_IF_TRUE,
+            [OP_R_JUMP_IF_NOT_EQ] = &&do_OP_R_JUMP_IF_NOT_EQ,
+            [OP_R_JUMP_IF_NOT_NEQ] = &&do_OP_R_JUMP_IF_NOT_NEQ,
+            [OP_R_JUMP_IF_NOT_LESS] = &&do_OP_R_JUMP_IF_NOT_LESS,
+            [OP_R_JUMP_IF_NOT_GREATER] = &&do_OP_R_JUMP_IF_NOT_GREATER,
+            [OP_R_JUMP_IF_NOT_GEQ] = &&do_OP_R_JUMP_IF_NOT_GEQ,
+            [OP_R_JUMP_IF_NOT_LEQ] = &&do_OP_R_JUMP_IF_NOT_LEQ,
+            [OP_R_PRINT] = &&do_OP_R_PRINT,
+            [OP_R_CALL] = &&do_OP_R_CALL,
+            [OP_R_TAIL_CALL] = &&do_OP_R_TAIL_CALL,
+            [OP_R_RETURN] = &&do_OP_R_RETURN,
+            [OP_R_CLOSURE] = &&do_OP_R_CLOSURE,
+            [OP_R_CLOSE_UPVALUE] = &&do_OP_R_CLOSE_UPVALUE,
+        };
+        // @Note: --trace=exec swaps in a table that sends every opcode through do_trace first,
+        // so the plain loop carries no check for it
+        static void* traceTable[] = {
+            [0 ... UINT8_MAX] = &&do_trace,
+        };
+        // @Note: and --profile-ops one that goes through do_profile
+        static void* profileTable[] = {
+            [0 ... UINT8_MAX] = &&do_profile,
+        };
+        void** table = vm.traceFlags & TRACE_EXEC ? traceTable
+            : vm.opProfile.path != NULL ? profileTable : dispatchTable;
+        #define DISPATCH() goto *table[READ_BYTE()]
+        #define CASE(op) do_##op
+        #define DEFAULT do_unknown
+        #define UNKNOWN() goto do_unknown
+
+        DISPATCH();
+    do_trace:
+        trace_instruction(frame, ip - 1);
+        goto *dispatchTable[ip[-1]];
+    do_profile:
+        profile_instruction(frame, ip - 1);
+        goto *dispatchTable[ip[-1]];
+    #else
+        #define DISPATCH() break
+        #define CASE(op) case op
+        #define DEFAULT default
+        #define UNKNOWN() return INTERPRET_OK
+
+    bool tracing = vm.traceFlags & TRACE_EXEC;
+    bool profiling = vm.opProfile.path != NULL;
     for (;;) {
-        #ifdef DEBUG_TRACE_EXECUTION
-            disassemble_instruction(&frame->closure->fn->chunk, (int)(frame->ip - frame->closure->fn->chunk.code));
-            printf("     ");
-            for (Value* slot = vm.stack; slot < vm.stackTop; slot++) {
-                printf("[  ");
-                print_value(*slot);
-                printf("  ]");
-            }
-            printf("\n");
-        #endif
-        uint8_t instruction;
-        switch (instruction = READ_BYTE()) {
-            case OP_NEGATE: 
+        if (tracing) trace_instruction(frame, ip);
+        else if (profiling) profile_instruction(frame, ip);
+        switch (READ_BYTE()) {
+    #endif
+            CASE(OP_NEGATE): 
                 if (!IS_NUMBER(peek(0))) {
-                    runtime_error("Operand must be a number, got %d", peek(0));
-                    return INTERPRET_RUNTIME_ERR;
+                    RUNTIME_ERROR("Operand must be a number.");
                 }
-                push(NUMBER_VAL(-AS_NUMBER(pop()))); break;
-            // case OP_CONSTANT: {
-            //     Value constant = READ_CONSTANT();
-            //     push(constant);
-            //     break;
-            // }
-            case OP_CONSTANT_LONG: {
-                Value constant = READ_CONSTANT_LONG();
-                push(constant);
-                break;
-            }
-            case OP_EQ: {
-                Value a = pop();
-                Value b = pop();
-                push(BOOL_VAL(values_equal(a, b)));
-                break;
-            }
-            case OP_GREATER: BINARY_OP(BOOL_VAL, >); break;
-            case OP_LESS: BINARY_OP(BOOL_VAL, <); break;
-            case OP_ADD: {
-                if (IS_STRING(peek(0)) && IS_STRING(peek(1))) {
-                    concatenate();
+                push(NUMBER_VAL(-AS_NUMBER(pop())));
+                DISPATCH();
+            CASE(OP_CONSTANT):
+                operand = READ_BYTE();
+            WIDE(OP_CONSTANT):
+                push(constants[operand]);
+                DISPATCH();
+            CASE(OP_EQ): {
+                POP_EQUAL();
+                push(BOOL_VAL(equal));
+                DISPATCH();
+            }
+            CASE(OP_NEQ): {
+                POP_EQUAL();
+                push(BOOL_VAL(!equal));
+                DISPATCH();
+            }
+            CASE(OP_GREATER): BINARY_OP(BOOL_VAL, >, OP_GREATER_NUM); DISPATCH();
+            CASE(OP_LESS): BINARY_OP(BOOL_VAL, <, OP_LESS_NUM); DISPATCH();
+            CASE(OP_GEQ): {
+                POP_NUMBERS();
+                push(BOOL_VAL(!(a < b)));
+                DISPATCH();
+            }
+            CASE(OP_LEQ): {
+                POP_NUMBERS();
+                push(BOOL_VAL(!(a > b)));
+                DISPATCH();
+            }
+            CASE(OP_ADD): {
+                if (IS_ANY_STRING(peek(0)) && IS_ANY_STRING(peek(1))) {
+                    QUICKEN(OP_ADD_STR);
+                    STORE_FRAME(); // @Note: running out of memory reports the line
+                    if (!concatenate()) RUNTIME_ERROR("String too long.");
                 } else if (IS_NUMBER(peek(0)) && IS_NUMBER(peek(1))) {
+                    QUICKEN(OP_ADD_NUM);
                     double b = AS_NUMBER(pop());
                     double a = AS_NUMBER(pop());
                     push(NUMBER_VAL(a + b));
                 } else {
-                    runtime_error("Operands must be both numbers or strings, got %s and %s", peek(0).type, peek(1).type);
-                    return INTERPRET_RUNTIME_ERR;
+                    RUNTIME_ERROR("Operands must be both numbers or strings.");
                 }
-                break;
+                DISPATCH();
             } 
-            case OP_PRINT: {
-                print_value(pop());
+            CASE(OP_PRINT): {
+                // @Note: popped after printing, walking a deep rope may collect
+                print_value(peek(0));
                 printf("\n");
-                break;
+                pop();
+                DISPATCH();
             }
-            case OP_RETURN: {
+            CASE(OP_RETURN): {
                 Value result = pop();
-                close_upvalues(frame->slots);
+                close_upvalues(slots);
                 vm.frameCount--;
                 if (vm.frameCount == 0) {
                     pop();
                     return INTERPRET_OK;
                 }
-                vm.stackTop = frame->slots;
+                vm.stackTop = slots;
                 push(result);
-                frame = &vm.frames[vm.frameCount-1];
-                break;
-            }
-            case OP_SUBSTRACT: BINARY_OP(NUMBER_VAL, -); break;
-            case OP_MULTIPLY: BINARY_OP(NUMBER_VAL, *); break;
-            case OP_DIVIDE: BINARY_OP(NUMBER_VAL, /); break;
-            case OP_NIL: push(NIL_VAL()); break;
-            case OP_TRUE: push(BOOL_VAL(true)); break;
-            case OP_FALSE: push(BOOL_VAL(false)); break;
-            case OP_NOT: push(BOOL_VAL(is_falsey(pop()))); break;
-            case OP_POP: pop(); break;
-            case OP_DEFINE_GLOBAL: {
-                ObjString* name = READ_STRING();
-                table_set(&vm.globals, name, peek(0));
-                pop();
-                break;
+                LOAD_FRAME();
+                reopen_registers(frame);
+                DISPATCH();
             }
-            case OP_GET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                Value value;
-                if (!table_get(&vm.globals, name, &value)) {
-                    runtime_error("Undefined variable '%s'", name->chars);
-                    return INTERPRET_RUNTIME_ERR;
+            CASE(OP_SUBSTRACT): BINARY_OP(NUMBER_VAL, -, OP_SUBSTRACT_NUM); DISPATCH();
+            CASE(OP_MULTIPLY): BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY_NUM); DISPATCH();
+            CASE(OP_DIVIDE): BINARY_OP(NUMBER_VAL, /, OP_DIVIDE_NUM); DISPATCH();
+            CASE(OP_ADD_NUM): NUM_BINARY_OP(NUMBER_VAL, +, OP_ADD); DISPATCH();
+            CASE(OP_ADD_STR): {
+                if (!IS_ANY_STRING(peek(0)) || !IS_ANY_STRING(peek(1))) {
+                    ip[-1] = OP_ADD;
+                    ip--;
+                } else {
+                    STORE_FRAME();
+                    if (!concatenate()) RUNTIME_ERROR("String too long.");
+                }
+                DISPATCH();
+            }
+            CASE(OP_SUBSTRACT_NUM): NUM_BINARY_OP(NUMBER_VAL, -, OP_SUBSTRACT); DISPATCH();
+            CASE(OP_MULTIPLY_NUM): NUM_BINARY_OP(NUMBER_VAL, *, OP_MULTIPLY); DISPATCH();
+            CASE(OP_DIVIDE_NUM): NUM_BINARY_OP(NUMBER_VAL, /, OP_DIVIDE); DISPATCH();
+            CASE(OP_GREATER_NUM): NUM_BINARY_OP(BOOL_VAL, >, OP_GREATER); DISPATCH();
+            CASE(OP_LESS_NUM): NUM_BINARY_OP(BOOL_VAL, <, OP_LESS); DISPATCH();
+            CASE(OP_NIL): push(NIL_VAL()); DISPATCH();
+            CASE(OP_TRUE): push(BOOL_VAL(true)); DISPATCH();
+            CASE(OP_FALSE): push(BOOL_VAL(false)); DISPATCH();
+            CASE(OP_NOT): push(BOOL_VAL(is_falsey(pop()))); DISPATCH();
+            CASE(OP_POP): pop(); DISPATCH();
+            CASE(OP_DEFINE_GLOBAL):
+                operand = READ_BYTE();
+            WIDE(OP_DEFINE_GLOBAL):
+                vm.globalValues.values[operand] = peek(0);
+                pop();
+                DISPATCH();
+            CASE(OP_GET_GLOBAL):
+                operand = READ_BYTE();
+            WIDE(OP_GET_GLOBAL): {
+                Value value = vm.globalValues.values[operand];
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'", AS_CSTRING(vm.globalNames.values[operand]));
                 }
                 push(value);
-                break;
+                DISPATCH();
             }
-            case OP_SET_GLOBAL: {
-                ObjString* name = READ_STRING();
-                if (table_set(&vm.globals, name, peek(0))) {
+            CASE(OP_SET_GLOBAL):
+                operand = READ_BYTE();
+            WIDE(OP_SET_GLOBAL):
+                if (IS_UNDEFINED(vm.globalValues.values[operand])) {
                     // @Note: allow this if we do implicit variable declaration
-                    table_delete(&vm.globals, name);
-                    runtime_error("Undefined variable '%s'.", name->chars);
-                    return INTERPRET_RUNTIME_ERR;
+                    RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[operand]));
                 }
-                break;
-            }
-            case OP_GET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                push(frame->slots[slot]);
-                break;
+                vm.globalValues.values[operand] = peek(0);
+                DISPATCH();
+            CASE(OP_GET_LOCAL):
+                operand = READ_BYTE();
+            WIDE(OP_GET_LOCAL):
+                push(slots[operand]);
+                DISPATCH();
+            CASE(OP_SET_LOCAL):
+                operand = READ_BYTE();
+            WIDE(OP_SET_LOCAL):
+                slots[operand] = peek(0);
+                DISPATCH();
+            CASE(OP_JUMP_IF_FALSE):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_FALSE):
+                if (is_falsey(peek(0))) {
+                    ip += operand;
+                }
+                DISPATCH();
+            CASE(OP_JUMP):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP):
+                ip += operand;
+                DISPATCH();
+            CASE(OP_LOOP):
+                operand = READ_SHORT();
+            WIDE(OP_LOOP):
+                ip -= operand;
+                DISPATCH();
+            CASE(OP_JUMP_IF_NOT_EQ):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_EQ): {
+                POP_EQUAL();
+                if (!equal) ip += operand;
+                DISPATCH();
             }
-            case OP_SET_LOCAL: {
-                uint8_t slot = READ_BYTE();
-                frame->slots[slot] = peek(0);
-                break;
+            CASE(OP_JUMP_IF_NOT_NEQ):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_NEQ): {
+                POP_EQUAL();
+                if (equal) ip += operand;
+                DISPATCH();
             }
-            case OP_JUMP_IF_FALSE: {
-                uint16_t offset = READ_SHORT();
-                if (is_falsey(peek(0))) {
-                    frame->ip += offset;
-                } 
-                break;
+            CASE(OP_JUMP_IF_NOT_LESS):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_LESS): {
+                POP_NUMBERS();
+                if (!(a < b)) ip += operand;
+                DISPATCH();
             }
-            case OP_JUMP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip += offset;
-                break;
+            CASE(OP_JUMP_IF_NOT_GREATER):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_GREATER): {
+                POP_NUMBERS();
+                if (!(a > b)) ip += operand;
+                DISPATCH();
             }
-            case OP_LOOP: {
-                uint16_t offset = READ_SHORT();
-                frame->ip -= offset;
-                break;
+            CASE(OP_JUMP_IF_NOT_GEQ):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_GEQ): {
+                POP_NUMBERS();
+                if (a < b) ip += operand;
+                DISPATCH();
             }
-            case OP_GET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                push(*frame->closure->upvalues[slot]->location);
-                break;
+            CASE(OP_JUMP_IF_NOT_LEQ):
+                operand = READ_SHORT();
+            WIDE(OP_JUMP_IF_NOT_LEQ): {
+                POP_NUMBERS();
+                if (a > b) ip += operand;
+                DISPATCH();
             }
-            case OP_SET_UPVALUE: {
-                uint8_t slot = READ_BYTE();
-                *frame->closure->upvalues[slot]->location = peek(0);
-                break;
+            CASE(OP_GET_UPVALUE):
+                operand = READ_BYTE();
+            WIDE(OP_GET_UPVALUE):
+                push(*frame->closure->upvalues[operand]->location);
+                DISPATCH();
+            CASE(OP_SET_UPVALUE):
+                operand = READ_BYTE();
+            WIDE(OP_SET_UPVALUE): {
+                ObjUpvalue* uv = frame->closure->upvalues[operand];
+                *uv->location = peek(0);
+                gc_write_barrier((Obj*)uv, peek(0));
+                DISPATCH();
             }
-            case OP_CLOSE_UPVALUE: {
+            CASE(OP_CLOSE_UPVALUE): {
                 close_upvalues(vm.stackTop - 1);
                 pop();
-                break;
+                DISPATCH();
             }
-            case OP_CLOSURE: {
-                ObjFunction* func = AS_FUNCTION(READ_CONSTANT_LONG());
+            CASE(OP_CLOSURE):
+                operand = READ_BYTE();
+                wide = false;
+            WIDE(OP_CLOSURE): {
+                ObjFunction* func = AS_FUNCTION(constants[operand]);
+                STORE_FRAME();
                 ObjClosure* closure = new_closure(func);
                 push(OBJ_VAL(closure));
                 for (int i = 0; i < closure->upvalueCount; i++) {
                     uint8_t isLocal = READ_BYTE();
-                    uint8_t idx = READ_BYTE();
+                    uint32_t idx = wide ? READ_LONG() : READ_BYTE();
                     if (isLocal) {
-                        closure->upvalues[i] = capture_upvalue(frame->slots + idx);
+                        closure->upvalues[i] = capture_upvalue(slots + idx);
                     } else {
                         closure->upvalues[i] = frame->closure->upvalues[idx];
                     }
+                    gc_write_barrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
                 }
-                break;
+                DISPATCH();
             }
-            case OP_CALL: {
+            CASE(OP_CALL): {
                 int argCount = READ_BYTE();
+                STORE_FRAME();
                 if (!call_value(peek(argCount), argCount)) {
                     return INTERPRET_RUNTIME_ERR;
                 }
-                frame = &vm.frames[vm.frameCount - 1];
-                break;
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_TAIL_CALL): {
+                int argCount = READ_BYTE();
+                Value callee = peek(argCount);
+                if (!IS_CLOSURE(callee)) {
+                    // @Note: natives return right away, the OP_RETURN after us hands on their result
+                    STORE_FRAME();
+                    if (!call_value(callee, argCount)) {
+                        return INTERPRET_RUNTIME_ERR;
+                    }
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
+                ObjClosure* closure = AS_CLOSURE(callee);
+                if (argCount != closure->fn->arity) {
+                    RUNTIME_ERROR("Expected %d arguments, got %d instead.", closure->fn->arity, argCount);
+                }
+                // @Note: reuse the current frame: close what the callee could still see of our locals,
+                // then slide the callee and its arguments down into our stack window.
+                close_upvalues(slots);
+                memmove(slots, vm.stackTop - argCount - 1, sizeof(Value) * (argCount + 1));
+                vm.stackTop = slots + argCount + 1;
+                STORE_FRAME();
+                if (!ensure_stack(closure->fn->maxStack + closure->fn->registers)) {
+                    return INTERPRET_RUNTIME_ERR;
+                }
+                frame->closure = closure;
+                frame->ip = closure->fn->chunk.code;
+                open_registers(frame);
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_R_CONSTANT): {
+                uint8_t a = READ_BYTE();
+                slots[a] = constants[READ_BYTE()];
+                DISPATCH();
+            }
+            CASE(OP_R_NIL): slots[READ_BYTE()] = NIL_VAL(); DISPATCH();
+            CASE(OP_R_TRUE): slots[READ_BYTE()] = BOOL_VAL(true); DISPATCH();
+            CASE(OP_R_FALSE): slots[READ_BYTE()] = BOOL_VAL(false); DISPATCH();
+            CASE(OP_R_MOVE): {
+                uint8_t a = READ_BYTE();
+                slots[a] = slots[READ_BYTE()];
+                DISPATCH();
+            }
+            CASE(OP_R_DEFINE_GLOBAL): {
+                uint8_t a = READ_BYTE();
+                vm.globalValues.values[READ_BYTE()] = slots[a];
+                DISPATCH();
+            }
+            CASE(OP_R_GET_GLOBAL): {
+                uint8_t a = READ_BYTE();
+                uint8_t global = READ_BYTE();
+                Value value = vm.globalValues.values[global];
+                if (IS_UNDEFINED(value)) {
+                    RUNTIME_ERROR("Undefined variable '%s'", AS_CSTRING(vm.globalNames.values[global]));
+                }
+                slots[a] = value;
+                DISPATCH();
+            }
+            CASE(OP_R_SET_GLOBAL): {
+                uint8_t a = READ_BYTE();
+                uint8_t global = READ_BYTE();
+                if (IS_UNDEFINED(vm.globalValues.values[global])) {
+                    RUNTIME_ERROR("Undefined variable '%s'.", AS_CSTRING(vm.globalNames.values[global]));
+                }
+                vm.globalValues.values[global] = slots[a];
+                DISPATCH();
+            }
+            CASE(OP_R_GET_UPVALUE): {
+                uint8_t a = READ_BYTE();
+                slots[a] = *frame->closure->upvalues[READ_BYTE()]->location;
+                DISPATCH();
+            }
+            CASE(OP_R_SET_UPVALUE): {
+                uint8_t a = READ_BYTE();
+                ObjUpvalue* uv = frame->closure->upvalues[READ_BYTE()];
+                *uv->location = slots[a];
+                gc_write_barrier((Obj*)uv, slots[a]);
+                DISPATCH();
+            }
+            CASE(OP_R_ADD): {
+                uint8_t a = READ_BYTE();
+                Value b = READ_RK();
+                Value c = READ_RK();
+                if (IS_NUMBER(b) && IS_NUMBER(c)) {
+                    slots[a] = NUMBER_VAL(AS_NUMBER(b) + AS_NUMBER(c));
+                } else if (IS_ANY_STRING(b) && IS_ANY_STRING(c)) {
+                    STORE_FRAME(); // @Note: running out of memory reports the line
+                    Obj* result = concat_strings(AS_OBJ(b), AS_OBJ(c));
+                    if (result == NULL) RUNTIME_ERROR("String too long.");
+                    slots[a] = OBJ_VAL(result);
+                } else {
+                    RUNTIME_ERROR("Operands must be both numbers or strings.");
+                }
+                DISPATCH();
+            }
+            CASE(OP_R_SUBSTRACT): R_NUMBERS(NUMBER_VAL(x - y)); DISPATCH();
+            CASE(OP_R_MULTIPLY): R_NUMBERS(NUMBER_VAL(x * y)); DISPATCH();
+            CASE(OP_R_DIVIDE): R_NUMBERS(NUMBER_VAL(x / y)); DISPATCH();
+            CASE(OP_R_LESS): R_NUMBERS(BOOL_VAL(x < y)); DISPATCH();
+            CASE(OP_R_GREATER): R_NUMBERS(BOOL_VAL(x > y)); DISPATCH();
+            CASE(OP_R_GEQ): R_NUMBERS(BOOL_VAL(!(x < y))); DISPATCH();
+            CASE(OP_R_LEQ): R_NUMBERS(BOOL_VAL(!(x > y))); DISPATCH();
+            CASE(OP_R_EQ): {
+                uint8_t a = READ_BYTE();
+                Value b = READ_RK();
+                Value c = READ_RK();
+                STORE_FRAME();
+                slots[a] = BOOL_VAL(registers_equal(b, c));
+                DISPATCH();
+            }
+            CASE(OP_R_NEQ): {
+                uint8_t a = READ_BYTE();
+                Value b = READ_RK();
+                Value c = READ_RK();
+                STORE_FRAME();
+                slots[a] = BOOL_VAL(!registers_equal(b, c));
+                DISPATCH();
+            }
+            CASE(OP_R_NEGATE): {
+                uint8_t a = READ_BYTE();
+                Value b = slots[READ_BYTE()];
+                if (!IS_NUMBER(b)) {
+                    RUNTIME_ERROR("Operand must be a number.");
+                }
+                slots[a] = NUMBER_VAL(-AS_NUMBER(b));
+                DISPATCH();
+            }
+            CASE(OP_R_NOT): {
+                uint8_t a = READ_BYTE();
+                slots[a] = BOOL_VAL(is_falsey(slots[READ_BYTE()]));
+                DISPATCH();
+            }
+            CASE(OP_R_JUMP_IF_FALSE): {
+                Value value = slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (is_falsey(value)) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_R_JUMP_IF_TRUE): {
+                Value value = slots[READ_BYTE()];
+                uint16_t offset = READ_SHORT();
+                if (!is_falsey(value)) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_R_JUMP_IF_NOT_EQ): {
+                Value b = READ_RK();
+                Value c = READ_RK();
+                uint16_t offset = READ_SHORT();
+                STORE_FRAME();
+                if (!registers_equal(b, c)) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_R_JUMP_IF_NOT_NEQ): {
+                Value b = READ_RK();
+                Value c = READ_RK();
+                uint16_t offset = READ_SHORT();
+                STORE_FRAME();
+                if (registers_equal(b, c)) ip += offset;
+                DISPATCH();
+            }
+            CASE(OP_R_JUMP_IF_NOT_LESS): R_JUMP_UNLESS(x < y); DISPATCH();
+            CASE(OP_R_JUMP_IF_NOT_GREATER): R_JUMP_UNLESS(x > y); DISPATCH();
+            CASE(OP_R_JUMP_IF_NOT_GEQ): R_JUMP_UNLESS(!(x < y)); DISPATCH();
+            CASE(OP_R_JUMP_IF_NOT_LEQ): R_JUMP_UNLESS(!(x > y)); DISPATCH();
+            CASE(OP_R_PRINT): {
+                print_value(slots[READ_BYTE()]);
+                printf("\n");
+                DISPATCH();
+            }
+            CASE(OP_R_CALL): {
+                uint8_t a = READ_BYTE();
+                int argCount = READ_BYTE();
+                Value callee = slots[a];
+                vm.stackTop = slots + a + argCount + 1;
+                STORE_FRAME();
+                if (IS_CLOSURE(callee)) {
+                    if (!call(AS_CLOSURE(callee), argCount)) {
+                        return INTERPRET_RUNTIME_ERR;
+                    }
+                } else {
+                    if (!call_value(callee, argCount)) {
+                        return INTERPRET_RUNTIME_ERR;
+                    }
+                    // @Note: a native is done already and left its result in A
+                    reopen_registers(frame);
+                }
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_R_TAIL_CALL): {
+                uint8_t a = READ_BYTE();
+                int argCount = READ_BYTE();
+                Value callee = slots[a];
+                vm.stackTop = slots + a + argCount + 1;
+                if (!IS_CLOSURE(callee)) {
+                    // @Note: natives return right away, the OP_R_RETURN after us hands on their result
+                    STORE_FRAME();
+                    if (!call_value(callee, argCount)) {
+                        return INTERPRET_RUNTIME_ERR;
+                    }
+                    reopen_registers(frame);
+                    LOAD_FRAME();
+                    DISPATCH();
+                }
+                ObjClosure* closure = AS_CLOSURE(callee);
+                if (argCount != closure->fn->arity) {
+                    RUNTIME_ERROR("Expected %d arguments, got %d instead.", closure->fn->arity, argCount);
+                }
+                close_upvalues(slots);
+                memmove(slots, slots + a, sizeof(Value) * (argCount + 1));
+                vm.stackTop = slots + argCount + 1;
+                STORE_FRAME();
+                if (!ensure_stack(closure->fn->maxStack + closure->fn->registers)) {
+                    return INTERPRET_RUNTIME_ERR;
+                }
+                frame->closure = closure;
+                frame->ip = closure->fn->chunk.code;
+                open_registers(frame);
+                LOAD_FRAME();
+                DISPATCH();
+            }
+            CASE(OP_R_RETURN): {
+                Value result = slots[READ_BYTE()];
+                close_upvalues(slots);
+                vm.frameCount--;
+                vm.stackTop = slots;
+                if (vm.frameCount == 0) {
+                    return INTERPRET_OK;
+                }
+                push(result);
+                LOAD_FRAME();
+                reopen_registers(frame);
+                DISPATCH();
             }
-            default: return INTERPRET_OK;
+            CASE(OP_R_CLOSURE): {
+                uint8_t a = READ_BYTE();
+                ObjFunction* func = AS_FUNCTION(constants[READ_BYTE()]);
+                STORE_FRAME();
+                ObjClosure* closure = new_closure(func);
+                slots[a] = OBJ_VAL(closure);
+                for (int i = 0; i < closure->upvalueCount; i++) {
+                    uint8_t isLocal = READ_BYTE();
+                    uint8_t idx = READ_BYTE();
+                    if (isLocal) {
+                        closure->upvalues[i] = capture_upvalue(slots + idx);
+                    } else {
+                        closure->upvalues[i] = frame->closure->upvalues[idx];
+                    }
+                    gc_write_barrier((Obj*)closure, OBJ_VAL(closure->upvalues[i]));
+                }
+                DISPATCH();
+            }
+            CASE(OP_R_CLOSE_UPVALUE): close_upvalues(slots + READ_BYTE()); DISPATCH();
+            // @Generated: superinstructions, by `make superinstructions` from bench/opcodes.profile
+            CASE(OP_GET_LOCAL_CONSTANT_SUBSTRACT): {
+                Value v0 = slots[ip[0]];
+                Value v1 = constants[ip[2]];
+                if (!IS_NUMBER(v0)) goto OP_GET_LOCAL_CONSTANT_SUBSTRACT_fallback;
+                if (!IS_NUMBER(v1)) goto OP_GET_LOCAL_CONSTANT_SUBSTRACT_fallback;
+                double v2 = AS_NUMBER(v0) - AS_NUMBER(v1);
+                push(NUMBER_VAL(v2));
+                ip += 4;
+                DISPATCH();
+            OP_GET_LOCAL_CONSTANT_SUBSTRACT_fallback:
+                operand = ip[0];
+                ip++;
+                goto WIDE(OP_GET_LOCAL);
+            }
+            CASE(OP_GET_LOCAL_CONSTANT_JUMP_IF_NOT_LESS): {
+                Value v0 = slots[ip[0]];
+                Value v1 = constants[ip[2]];
+                if (!IS_NUMBER(v0)) goto OP_GET_LOCAL_CONSTANT_JUMP_IF_NOT_LESS_fallback;
+                if (!IS_NUMBER(v1)) goto OP_GET_LOCAL_CONSTANT_JUMP_IF_NOT_LESS_fallback;
+                bool jump = !(AS_NUMBER(v0) < AS_NUMBER(v1));
+                operand = (ip[4] << 8) | ip[5];
+                ip += 6;
+                if (jump) ip += operand;
+                DISPATCH();
+            OP_GET_LOCAL_CONSTANT_JUMP_IF_NOT_LESS_fallback:
+                operand = ip[0];
+                ip++;
+                goto WIDE(OP_GET_LOCAL);
+            }
+            CASE(OP_GET_LOCAL_CONSTANT): {
+                Value v0 = slots[ip[0]];
+                Value v1 = constants[ip[2]];
+                push(v0);
+                push(v1);
+                ip += 3;
+                DISPATCH();
+            }
+            // @End generated
+            CASE(OP_WIDE): {
+                // @Note: only huge functions have these, so they go through a switch rather than
+                // the table and then share the tail of the short handler
+                uint8_t instruction = READ_BYTE();
+                operand = READ_LONG();
+                wide = true;
+                switch (instruction) {
+                    case OP_CONSTANT: goto WIDE(OP_CONSTANT);
+                    case OP_DEFINE_GLOBAL: goto WIDE(OP_DEFINE_GLOBAL);
+                    case OP_GET_GLOBAL: goto WIDE(OP_GET_GLOBAL);
+                    case OP_SET_GLOBAL: goto WIDE(OP_SET_GLOBAL);
+                    case OP_GET_LOCAL: goto WIDE(OP_GET_LOCAL);
+                    case OP_SET_LOCAL: goto WIDE(OP_SET_LOCAL);
+                    case OP_JUMP_IF_FALSE: goto WIDE(OP_JUMP_IF_FALSE);
+                    case OP_JUMP: goto WIDE(OP_JUMP);
+                    case OP_LOOP: goto WIDE(OP_LOOP);
+                    case OP_GET_UPVALUE: goto WIDE(OP_GET_UPVALUE);
+                    case OP_SET_UPVALUE: goto WIDE(OP_SET_UPVALUE);
+                    case OP_CLOSURE: goto WIDE(OP_CLOSURE);
+                    case OP_JUMP_IF_NOT_EQ: goto WIDE(OP_JUMP_IF_NOT_EQ);
+                    case OP_JUMP_IF_NOT_NEQ: goto WIDE(OP_JUMP_IF_NOT_NEQ);
+                    case OP_JUMP_IF_NOT_LESS: goto WIDE(OP_JUMP_IF_NOT_LESS);
+                    case OP_JUMP_IF_NOT_GREATER: goto WIDE(OP_JUMP_IF_NOT_GREATER);
+                    case OP_JUMP_IF_NOT_GEQ: goto WIDE(OP_JUMP_IF_NOT_GEQ);
+                    case OP_JUMP_IF_NOT_LEQ: goto WIDE(OP_JUMP_IF_NOT_LEQ);
+                    default: UNKNOWN();
+                }
+            }
+            DEFAULT: return INTERPRET_OK;
+    #ifndef COMPUTED_GOTO
         }
     }
+    #endif
 
     #undef READ_BYTE
-    #undef READ_STRING
     #undef READ_SHORT
-    // #undef READ_CONSTANT
-    #undef READ_CONSTANT_LONG
+    #undef READ_LONG
+    #undef WIDE
+    #undef STORE_FRAME
+    #undef LOAD_FRAME
+    #undef RUNTIME_ERROR
+    #undef QUICKEN
     #undef BINARY_OP
+    #undef NUM_BINARY_OP
+    #undef POP_NUMBERS
+    #undef POP_EQUAL
+    #undef READ_RK
+    #undef R_NUMBERS
+    #undef R_JUMP_UNLESS
+    #undef DISPATCH
+    #undef CASE
+    #undef DEFAULT
+    #undef UNKNOWN
 }
 
 InterpretResult interpret(const char* source) {
@@ -372,7 +1369,17 @@ InterpretResult interpret(const char* source) {
     pop();
     push(OBJ_VAL(closure));
     call(closure, 0);
-    return run();
+
+    jmp_buf jump;
+    vm.errorJump = &jump;
+    if (setjmp(jump) != 0) {
+        vm.errorJump = NULL;
+        runtime_error("Out of memory.");
+        return INTERPRET_RUNTIME_ERR;
+    }
+    InterpretResult result = run();
+    vm.errorJump = NULL;
+    return result;
 }
 
 void push(Value value) {
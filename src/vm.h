@@ -1,13 +1,21 @@
 #ifndef comp_vm_h
 #define comp_vm_h
 
+#include <setjmp.h>
 #include "chunk.h"
+#include "memory.h"
 #include "object.h"
 #include "table.h"
 #include "value.h"
 
-#define FRAMES_MAX 64
-#define STACK_MAX (FRAMES_MAX * UINT8_COUNT) // @Improve: grow dynamically
+// @Note: the frame array and the value stack start small and double on demand.
+// FRAMES_MAX caps the call depth and can be set at build time, e.g. `make DEFINES=FRAMES_MAX=1024`.
+#ifndef FRAMES_MAX
+#define FRAMES_MAX 65536
+#endif
+#define STACK_MAX (FRAMES_MAX * UINT8_COUNT)
+#define FRAMES_INITIAL 8
+#define STACK_INITIAL UINT8_COUNT
 
 typedef struct {
 	ObjClosure* closure;
@@ -15,22 +23,98 @@ typedef struct {
 	Value* slots;
 } CallFrame;
 
+// @Note: what --trace=exec,gc,code turns on
+typedef enum {
+	TRACE_EXEC = 1 << 0,
+	TRACE_GC = 1 << 1,
+	TRACE_CODE = 1 << 2,
+} TraceFlag;
+
+// @Note: which instruction set --tier=stack,register has the compiler write
+typedef enum {
+	TIER_STACK,
+	TIER_REGISTER,
+} Tier;
+
+// @Note: what --profile-ops=<path> counts, how often each straight-line sequence of opcodes ran.
+// A sequence goes on as long as each instruction falls through to the next, a longer one is cut.
+#define PROFILE_SEQUENCE_MAX 32
+
 typedef struct {
-	CallFrame frames[FRAMES_MAX];
+	uint64_t count;
+	int length;
+	uint8_t ops[PROFILE_SEQUENCE_MAX];
+} ProfileSequence;
+
+typedef struct {
+	const char* path;
+	ProfileSequence* sequences; // @Note: open addressing on the opcodes, a zero count is an empty slot
+	int sequenceCount;
+	int sequenceCapacity;
+	ProfileSequence current;
+	uint8_t* next; // @Note: where the last instruction falls through to, the sequence goes on only there
+} OpProfile;
+
+typedef struct {
+	CallFrame* frames;
 	int frameCount;
-	Value stack[STACK_MAX]; // @Improve: grow dynamically
+	int frameCapacity;
+	Value* stack;
 	Value* stackTop;
+	int stackCapacity;
 	Table strings;
-	Table globals;
+	Table globals; // @Note: maps a global name to its slot in globalValues, only used by the compiler
+	ValueArray globalValues;
+	ValueArray globalNames;
 	ObjUpvalue* openUpvalues;
-	Obj* objects;
+	HeapBlock* blocks;
+	HeapBlock* youngBlocks;
+	HeapBlock* bumpBlock;
+	HeapBlock* sweepBlocks;
+	HeapBlock* freeBlocks;
+	int freeBlockCount;
+	FreeCell* freeCells[SIZE_CLASS_COUNT];
+	int youngCellCapacity;
+	int youngCellCount;
+	Obj** youngCells; // @Note: young objects allocated out of a free list rather than the nursery
+	int sliceCapacity;
+	int sliceCount;
+	ObjSlice** slices; // @Note: the slices that still point at a parent, see detach_slices
 
 	size_t bytesallocated;
 	size_t nextgc;
+	size_t youngBytes;
+	size_t cellBytes;
+	size_t markedBytes;
+	size_t garbageBytes; // @Note: dead cells not swept yet, they do not count against nextgc
+	size_t blockSlack; // @Note: unused space in old blocks, counts against nextgc
+	int stressCount;
+
+	int rememberedCapacity;
+	int rememberedCount;
+	Obj** remembered;
 
 	int grayCapacity;
 	int grayCount;
 	Obj **grayStack;
+
+	GcPhase gcPhase;
+	bool gcIncremental;
+	int gcThreads; // @Note: threads a stop-the-world major collection marks and sweeps on
+	double gcGrowFactor;
+	size_t gcHeapLimit;
+	int gcCycleCount;
+	int gcMajorCycle; // @Note: the last major collection, its sweep and slices are counted there
+	GcCycle gcCycles[GC_CYCLE_HISTORY];
+	jmp_buf* errorJump; // @Note: where running out of memory unwinds to while a program runs
+	int traceFlags;
+	OpProfile opProfile;
+	Tier tier;
+	uint64_t gcPauseBudget;
+	size_t gcDebt;
+	uint64_t gcMaxPause;
+	uint64_t gcTotalPause;
+	int gcPauseCount;
 } VM;
 
 typedef enum {
@@ -46,5 +130,8 @@ void freeVM();
 InterpretResult interpret(const char* source);
 void push(Value value);
 Value pop();
+int global_slot(ObjString* name);
+void start_op_profile(const char* path);
+void write_op_profile();
 
 #endif
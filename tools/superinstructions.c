@@ -0,0 +1,550 @@
+// Picks superinstructions out of an opcode profile written by --profile-ops and writes them into the
+// generated parts of src/chunk.h and src/vm.c, see `make superinstructions`. The profile holds the
+// straight-line opcode sequences that ran, and the picks are judged by running the compiler's own
+// left to right matching over them, so overlapping runs are not counted twice.
+//
+//     superinstructions <profile> <chunk.h> <vm.c>
+//
+// A superinstruction runs two or three opcodes with a single dispatch. It is written over the first
+// opcode of its run and reads the operands of the others where they still are, so its handler is
+// built out of what each of them does:
+// - everything is read first and kept in C locals, guards are checked as the values come in
+// - stores to locals and to the stack are only made once every guard held
+// - when a guard fails the first opcode runs on its own and the rest of the run follows as usual,
+//   which reports errors exactly like the plain instructions would
+// Only opcodes with a fast path that cannot fail once its guards hold are taken apart like this.
+
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// @Note: how many superinstructions to pick, each one is a handler and a slot in the dispatch table
+#define SUPER_MAX 8
+#define RUN_MAX 3
+// @Note: PROFILE_SEQUENCE_MAX in src/vm.h, with room to spare
+#define SEQUENCE_MAX 64
+
+#define BEGIN_MARKER "@Generated: superinstructions"
+#define END_MARKER "@End generated"
+
+typedef enum {
+	KIND_GET_LOCAL,
+	KIND_GET_GLOBAL,
+	KIND_CONSTANT,
+	KIND_SET_LOCAL,
+	KIND_ARITHMETIC,
+	KIND_COMPARE,
+	KIND_POP,
+	KIND_JUMP_IF_NOT,
+	KIND_JUMP,
+} Kind;
+
+typedef struct {
+	const char* name;
+	Kind kind;
+	const char* op; // @Note: the C operator, and for a jump the direction it goes
+	bool negate; // @Note: a conditional jump is taken when the comparison is false
+	int length;
+} Component;
+
+static const Component components[] = {
+	{"OP_GET_LOCAL", KIND_GET_LOCAL, NULL, false, 2},
+	{"OP_GET_GLOBAL", KIND_GET_GLOBAL, NULL, false, 2},
+	{"OP_CONSTANT", KIND_CONSTANT, NULL, false, 2},
+	{"OP_SET_LOCAL", KIND_SET_LOCAL, NULL, false, 2},
+	{"OP_ADD", KIND_ARITHMETIC, "+", false, 1},
+	{"OP_SUBSTRACT", KIND_ARITHMETIC, "-", false, 1},
+	{"OP_MULTIPLY", KIND_ARITHMETIC, "*", false, 1},
+	{"OP_DIVIDE", KIND_ARITHMETIC, "/", false, 1},
+	{"OP_LESS", KIND_COMPARE, "<", false, 1},
+	{"OP_GREATER", KIND_COMPARE, ">", false, 1},
+	{"OP_POP", KIND_POP, NULL, false, 1},
+	{"OP_JUMP_IF_NOT_LESS", KIND_JUMP_IF_NOT, "<", true, 3},
+	{"OP_JUMP_IF_NOT_GREATER", KIND_JUMP_IF_NOT, ">", true, 3},
+	{"OP_JUMP_IF_NOT_GEQ", KIND_JUMP_IF_NOT, "<", false, 3},
+	{"OP_JUMP_IF_NOT_LEQ", KIND_JUMP_IF_NOT, ">", false, 3},
+	{"OP_JUMP", KIND_JUMP, "+", false, 3},
+	{"OP_LOOP", KIND_JUMP, "-", false, 3},
+};
+
+#define COMPONENT_COUNT ((int) (sizeof(components) / sizeof(components[0])))
+
+typedef struct {
+	uint64_t count; // @Note: how often the opcodes ran back to back, overlapping places included
+	uint64_t saved; // @Note: the dispatches it saves where the compiler would write it
+	int length;
+	int ops[RUN_MAX]; // @Note: index into components
+	bool picked;
+} Run;
+
+typedef struct {
+	uint64_t count;
+	int length;
+	int ops[SEQUENCE_MAX]; // @Note: index into components, -1 for an opcode no run can hold
+} Sequence;
+
+typedef struct {
+	char* chars;
+	size_t length;
+	size_t capacity;
+} Buffer;
+
+static void append(Buffer* buffer, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int needed = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+    if (buffer->length + needed + 1 > buffer->capacity) {
+        buffer->capacity = (buffer->length + needed + 1) * 2;
+        buffer->chars = realloc(buffer->chars, buffer->capacity);
+        if (buffer->chars == NULL) {
+            fprintf(stderr, "Out of memory.\n");
+            exit(74);
+        }
+    }
+    va_start(args, format);
+    vsnprintf(buffer->chars + buffer->length, needed + 1, format, args);
+    va_end(args);
+    buffer->length += needed;
+}
+
+static int component_named(const char* name) {
+    for (int i = 0; i < COMPONENT_COUNT; i++) {
+        if (strcmp(components[i].name, name) == 0) return i;
+    }
+    return -1;
+}
+
+static bool is_jump(Kind kind) {
+    return kind == KIND_JUMP_IF_NOT || kind == KIND_JUMP;
+}
+
+// @Note: the first opcode of a run is the one the handler falls back on, it has to have an operand
+// so OP_WIDE can join its handler. A jump can only end a run. A local is not read again after a
+// store to it, the handler reads every local before it stores any.
+static bool can_fuse(Run* run) {
+    Kind first = components[run->ops[0]].kind;
+    if (first != KIND_GET_LOCAL && first != KIND_GET_GLOBAL && first != KIND_CONSTANT && first != KIND_SET_LOCAL) {
+        return false;
+    }
+    bool stored = false;
+    int depth = 0;
+    for (int i = 0; i < run->length; i++) {
+        Kind kind = components[run->ops[i]].kind;
+        if (is_jump(kind) && i != run->length - 1) return false;
+        if (kind == KIND_GET_LOCAL && stored) return false;
+        if (kind == KIND_SET_LOCAL) stored = true;
+        switch (kind) {
+            case KIND_GET_LOCAL:
+            case KIND_GET_GLOBAL:
+            case KIND_CONSTANT:
+                depth++;
+                break;
+            case KIND_ARITHMETIC:
+            case KIND_COMPARE:
+                depth = depth >= 2 ? depth - 1 : 0;
+                break;
+            case KIND_JUMP_IF_NOT:
+                depth = depth >= 2 ? depth - 2 : 0;
+                break;
+            case KIND_POP:
+                // @Note: a value loaded only to be dropped again, the peephole pass removes those
+                if (depth > 0) return false;
+                break;
+            default:
+                break;
+        }
+    }
+    return true;
+}
+
+static void super_name(Run* run, char* name) {
+    strcpy(name, "OP");
+    for (int i = 0; i < run->length; i++) {
+        strcat(name, components[run->ops[i]].name + 2);
+    }
+}
+
+static int read_profile(const char* path, Sequence* sequences, int capacity) {
+    FILE* file = fopen(path, "r");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        exit(74);
+    }
+    int count = 0;
+    char line[4096];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == '#') continue;
+        if (count == capacity) break;
+        char* end;
+        Sequence* sequence = &sequences[count];
+        sequence->count = strtoull(line, &end, 10);
+        sequence->length = 0;
+        for (char* name = strtok(end, " \t\n"); name != NULL; name = strtok(NULL, " \t\n")) {
+            if (sequence->length == SEQUENCE_MAX) break;
+            sequence->ops[sequence->length++] = component_named(name);
+        }
+        if (sequence->length >= 2) count++;
+    }
+    fclose(file);
+    return count;
+}
+
+static bool same_ops(const int* a, const int* b, int length) {
+    for (int i = 0; i < length; i++) {
+        if (a[i] != b[i]) return false;
+    }
+    return true;
+}
+
+// @Note: every run of two or three opcodes that can be fused and shows up in a sequence
+static int collect_runs(Sequence* sequences, int sequenceCount, Run* runs, int capacity) {
+    int count = 0;
+    for (int i = 0; i < sequenceCount; i++) {
+        Sequence* sequence = &sequences[i];
+        for (int at = 0; at < sequence->length; at++) {
+            for (int length = 2; length <= RUN_MAX && at + length <= sequence->length; length++) {
+                Run run = {.length = length};
+                bool known = true;
+                for (int k = 0; k < length; k++) {
+                    run.ops[k] = sequence->ops[at + k];
+                    if (run.ops[k] == -1) known = false;
+                }
+                if (!known || !can_fuse(&run)) continue;
+                int found = 0;
+                while (found < count && (runs[found].length != length || !same_ops(runs[found].ops, run.ops, length))) {
+                    found++;
+                }
+                if (found == count) {
+                    if (count == capacity) continue;
+                    runs[count++] = run;
+                }
+                runs[found].count += sequence->count;
+            }
+        }
+    }
+    return count;
+}
+
+// @Note: the order the compiler tries them in, triples before pairs and otherwise as picked
+static void compiler_order(Run** picked, int count, Run** ordered) {
+    int at = 0;
+    for (int length = RUN_MAX; length >= 2; length--) {
+        for (int i = 0; i < count; i++) {
+            if (picked[i]->length == length) ordered[at++] = picked[i];
+        }
+    }
+}
+
+// @Note: select_superinstructions in src/peephole.c over the profiled sequences. At each opcode the
+// first run in order that matches is written and the opcodes it covers are skipped. Returns the
+// dispatches saved in total and sets what each run saves.
+static uint64_t simulate(Sequence* sequences, int sequenceCount, Run** ordered, int count) {
+    uint64_t total = 0;
+    for (int i = 0; i < count; i++) ordered[i]->saved = 0;
+    for (int i = 0; i < sequenceCount; i++) {
+        Sequence* sequence = &sequences[i];
+        for (int at = 0; at < sequence->length;) {
+            int next = at + 1;
+            for (int r = 0; r < count; r++) {
+                Run* run = ordered[r];
+                if (at + run->length > sequence->length || !same_ops(sequence->ops + at, run->ops, run->length)) continue;
+                uint64_t saved = sequence->count * (run->length - 1);
+                run->saved += saved;
+                total += saved;
+                next = at + run->length;
+                break;
+            }
+            at = next;
+        }
+    }
+    return total;
+}
+
+// @Note: each round takes the run that adds the most saved dispatches to the ones already picked,
+// with the compiler choosing between them the way it does. A run that would only take places from
+// another one adds nothing. Runs that add less than a hundredth of the first pick are left out.
+static int pick(Sequence* sequences, int sequenceCount, Run* runs, int count, Run** picked) {
+    Run* ordered[SUPER_MAX];
+    uint64_t total = 0;
+    uint64_t first = 0;
+    int pickedCount = 0;
+    while (pickedCount < SUPER_MAX) {
+        Run* best = NULL;
+        uint64_t bestGain = 0;
+        for (int i = 0; i < count; i++) {
+            if (runs[i].picked || runs[i].count * (runs[i].length - 1) <= bestGain) continue;
+            picked[pickedCount] = &runs[i];
+            compiler_order(picked, pickedCount + 1, ordered);
+            uint64_t with = simulate(sequences, sequenceCount, ordered, pickedCount + 1);
+            uint64_t gain = with > total ? with - total : 0;
+            if (gain > bestGain) {
+                best = &runs[i];
+                bestGain = gain;
+            }
+        }
+        if (best == NULL || bestGain * 100 < first) break;
+        if (first == 0) first = bestGain;
+        best->picked = true;
+        picked[pickedCount++] = best;
+        total += bestGain;
+    }
+    compiler_order(picked, pickedCount, ordered);
+    simulate(sequences, sequenceCount, ordered, pickedCount);
+    for (int i = 0; i < pickedCount; i++) picked[i] = ordered[i];
+    return pickedCount;
+}
+
+static void write_list(Buffer* out, Run** picked, int count) {
+    append(out, "// @Note: the superinstruction, how many opcodes it stands for and those opcodes\n");
+    append(out, "#define SUPERINSTRUCTIONS(X)%s\n", count > 0 ? " \\" : "");
+    for (int i = 0; i < count; i++) {
+        char name[64];
+        super_name(picked[i], name);
+        append(out, "\tX(%s, %d", name, picked[i]->length);
+        for (int k = 0; k < RUN_MAX; k++) {
+            append(out, ", %s", k < picked[i]->length ? components[picked[i]->ops[k]].name : "0");
+        }
+        append(out, ")%s\n", i < count - 1 ? " \\" : "");
+    }
+}
+
+typedef struct {
+	char expr[32];
+	bool number; // @Note: a double rather than a Value
+} Entry;
+
+typedef struct {
+	Buffer* out;
+	const char* name;
+	Entry stack[RUN_MAX * 2];
+	int depth;
+	int consumed; // @Note: values taken off the real stack
+	int temps;
+	bool guarded;
+} Handler;
+
+static Entry pop_entry(Handler* handler) {
+    if (handler->depth > 0) return handler->stack[--handler->depth];
+    Entry entry = {.number = false};
+    handler->consumed++;
+    snprintf(entry.expr, sizeof(entry.expr), "s%d", handler->consumed);
+    append(handler->out, "                Value s%d = vm.stackTop[-%d];\n", handler->consumed, handler->consumed);
+    return entry;
+}
+
+static void push_entry(Handler* handler, const char* expr, bool number) {
+    Entry* entry = &handler->stack[handler->depth++];
+    snprintf(entry->expr, sizeof(entry->expr), "%s", expr);
+    entry->number = number;
+}
+
+static const char* new_temp(Handler* handler, char* buffer) {
+    sprintf(buffer, "v%d", handler->temps++);
+    return buffer;
+}
+
+// @Note: the entry as a double, after a guard that it is a number
+static void as_number(Handler* handler, Entry* entry, char* buffer) {
+    if (entry->number) {
+        strcpy(buffer, entry->expr);
+        return;
+    }
+    append(handler->out, "                if (!IS_NUMBER(%s)) goto %s_fallback;\n", entry->expr, handler->name);
+    handler->guarded = true;
+    sprintf(buffer, "AS_NUMBER(%s)", entry->expr);
+}
+
+static void as_value(Entry* entry, char* buffer) {
+    if (entry->number) {
+        sprintf(buffer, "NUMBER_VAL(%s)", entry->expr);
+    } else {
+        strcpy(buffer, entry->expr);
+    }
+}
+
+static void write_handler(Buffer* out, Run* run) {
+    char name[64];
+    super_name(run, name);
+    Handler handler = {.out = out, .name = name};
+    char temp[16];
+    char a[48];
+    char b[48];
+    struct {
+        int at;
+        Entry value;
+    } stores[RUN_MAX];
+    int storeCount = 0;
+    const Component* jump = NULL;
+    int jumpAt = 0;
+    // @Note: ip is past the superinstruction, so the operand of the opcode at offset at is ip[at]
+    int at = 0;
+
+    append(out, "            CASE(%s): {\n", name);
+    for (int i = 0; i < run->length; i++) {
+        const Component* component = &components[run->ops[i]];
+        switch (component->kind) {
+            case KIND_GET_LOCAL:
+                append(out, "                Value %s = slots[ip[%d]];\n", new_temp(&handler, temp), at);
+                push_entry(&handler, temp, false);
+                break;
+            case KIND_GET_GLOBAL:
+                append(out, "                Value %s = vm.globalValues.values[ip[%d]];\n", new_temp(&handler, temp), at);
+                append(out, "                if (IS_UNDEFINED(%s)) goto %s_fallback;\n", temp, name);
+                handler.guarded = true;
+                push_entry(&handler, temp, false);
+                break;
+            case KIND_CONSTANT:
+                append(out, "                Value %s = constants[ip[%d]];\n", new_temp(&handler, temp), at);
+                push_entry(&handler, temp, false);
+                break;
+            case KIND_SET_LOCAL: {
+                Entry value = pop_entry(&handler);
+                push_entry(&handler, value.expr, value.number);
+                stores[storeCount].at = at;
+                stores[storeCount++].value = value;
+                break;
+            }
+            case KIND_ARITHMETIC:
+            case KIND_COMPARE: {
+                Entry right = pop_entry(&handler);
+                Entry left = pop_entry(&handler);
+                as_number(&handler, &left, a);
+                as_number(&handler, &right, b);
+                if (component->kind == KIND_ARITHMETIC) {
+                    append(out, "                double %s = %s %s %s;\n", new_temp(&handler, temp), a, component->op, b);
+                    push_entry(&handler, temp, true);
+                } else {
+                    append(out, "                Value %s = BOOL_VAL(%s %s %s);\n", new_temp(&handler, temp), a, component->op, b);
+                    push_entry(&handler, temp, false);
+                }
+                break;
+            }
+            case KIND_POP:
+                pop_entry(&handler);
+                break;
+            case KIND_JUMP_IF_NOT: {
+                Entry right = pop_entry(&handler);
+                Entry left = pop_entry(&handler);
+                as_number(&handler, &left, a);
+                as_number(&handler, &right, b);
+                append(out, "                bool jump = %s(%s %s %s);\n", component->negate ? "!" : "", a, component->op, b);
+                jump = component;
+                jumpAt = at;
+                break;
+            }
+            case KIND_JUMP:
+                jump = component;
+                jumpAt = at;
+                break;
+        }
+        at += component->length;
+    }
+
+    for (int i = 0; i < storeCount; i++) {
+        as_value(&stores[i].value, a);
+        append(out, "                slots[ip[%d]] = %s;\n", stores[i].at, a);
+    }
+    if (handler.consumed > 0) append(out, "                vm.stackTop -= %d;\n", handler.consumed);
+    for (int i = 0; i < handler.depth; i++) {
+        as_value(&handler.stack[i], a);
+        append(out, "                push(%s);\n", a);
+    }
+    if (jump != NULL) {
+        append(out, "                operand = (ip[%d] << 8) | ip[%d];\n", jumpAt, jumpAt + 1);
+    }
+    append(out, "                ip += %d;\n", at - 1);
+    if (jump != NULL && jump->kind == KIND_JUMP_IF_NOT) {
+        append(out, "                if (jump) ip += operand;\n");
+    } else if (jump != NULL) {
+        append(out, "                ip %s= operand;\n", jump->op);
+    }
+    append(out, "                DISPATCH();\n");
+    if (handler.guarded) {
+        append(out, "            %s_fallback:\n", name);
+        append(out, "                operand = ip[0];\n");
+        append(out, "                ip++;\n");
+        append(out, "                goto WIDE(%s);\n", components[run->ops[0]].name);
+    }
+    append(out, "            }\n");
+}
+
+static char* read_file(const char* path, size_t* length) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not open \"%s\".\n", path);
+        exit(74);
+    }
+    fseek(file, 0L, SEEK_END);
+    *length = ftell(file);
+    rewind(file);
+    char* chars = malloc(*length + 1);
+    if (chars == NULL || fread(chars, 1, *length, file) < *length) {
+        fprintf(stderr, "Could not read \"%s\".\n", path);
+        exit(74);
+    }
+    chars[*length] = '\0';
+    fclose(file);
+    return chars;
+}
+
+// @Note: replaces the lines between the two markers, the marker lines themselves stay
+static void replace_generated(const char* path, Buffer* generated) {
+    size_t length;
+    char* chars = read_file(path, &length);
+    char* begin = strstr(chars, BEGIN_MARKER);
+    char* end = begin != NULL ? strstr(begin, END_MARKER) : NULL;
+    if (end == NULL) {
+        fprintf(stderr, "No generated part in \"%s\".\n", path);
+        exit(65);
+    }
+    begin = strchr(begin, '\n') + 1;
+    while (end > chars && end[-1] != '\n') end--;
+
+    FILE* file = fopen(path, "wb");
+    if (file == NULL) {
+        fprintf(stderr, "Could not write \"%s\".\n", path);
+        exit(74);
+    }
+    fwrite(chars, 1, begin - chars, file);
+    fwrite(generated->chars, 1, generated->length, file);
+    fwrite(end, 1, length - (end - chars), file);
+    fclose(file);
+    free(chars);
+}
+
+int main(int argc, const char* argv[]) {
+    if (argc != 4) {
+        fprintf(stderr, "Usage: superinstructions <profile> <chunk.h> <vm.c>\n");
+        return 64;
+    }
+    enum { SEQUENCES_MAX = 16384, RUNS_MAX = 4096 };
+    static Sequence sequences[SEQUENCES_MAX];
+    static Run runs[RUNS_MAX];
+    int sequenceCount = read_profile(argv[1], sequences, SEQUENCES_MAX);
+    int count = collect_runs(sequences, sequenceCount, runs, RUNS_MAX);
+    Run* picked[SUPER_MAX];
+    int pickedCount = pick(sequences, sequenceCount, runs, count, picked);
+
+    Buffer list = {0};
+    append(&list, "");
+    write_list(&list, picked, pickedCount);
+    replace_generated(argv[2], &list);
+
+    Buffer handlers = {0};
+    append(&handlers, "");
+    for (int i = 0; i < pickedCount; i++) write_handler(&handlers, picked[i]);
+    replace_generated(argv[3], &handlers);
+
+    for (int i = 0; i < pickedCount; i++) {
+        char name[64];
+        super_name(picked[i], name);
+        printf("%-40s %llu dispatches saved\n", name, (unsigned long long) picked[i]->saved);
+    }
+    free(list.chars);
+    free(handlers.chars);
+    return 0;
+}